@@ -63,9 +63,15 @@ using hotstuff::MsgRespCmd;
 using hotstuff::get_hash;
 using hotstuff::promise_t;
 
-using HotStuff = hotstuff::HotStuffSecp256k1;
-
+/** The application replica, instantiated for each supported crypto backend
+ * (HotStuffSecp256k1, HotStuffSchnorr, HotStuffEd25519). */
+template<typename HotStuff>
 class HotStuffApp: public HotStuff {
+    using HotStuff::blk_size;
+    using HotStuff::exec_command;
+    using HotStuff::get_decision_waiting;
+    using HotStuff::get_pace_maker;
+
     double stat_period;
     double impeach_timeout;
     EventContext ec;
@@ -82,6 +88,11 @@ class HotStuffApp: public HotStuff {
 
     std::unordered_map<const uint256_t, promise_t> unconfirmed;
 
+    /** The replicated state: the number of executed commands and a hash
+     * chained over them. */
+    uint64_t nexecuted;
+    uint256_t state_hash;
+
     using conn_t = ClientNetwork<opcode_t>::conn_t;
     using resp_queue_t = salticidae::MPSCQueueEventDriven<std::pair<Finality, NetAddr>>;
 
@@ -107,17 +118,38 @@ class HotStuffApp: public HotStuff {
 
     void state_machine_execute(const Finality &fin) override {
         reset_imp_timer();
+        DataStream s;
+        s << state_hash << fin.cmd_hash;
+        state_hash = s.get_hash();
+        nexecuted++;
 #ifndef HOTSTUFF_ENABLE_BENCHMARK
         HOTSTUFF_LOG_INFO("replicated %s", std::string(fin).c_str());
 #endif
     }
 
+    bool state_machine_snapshot(uint32_t, bytearray_t &snapshot) override {
+        DataStream s;
+        s << hotstuff::htole(nexecuted) << state_hash;
+        snapshot = bytearray_t(std::move(s));
+        return true;
+    }
+
+    void state_machine_restore(uint32_t height, const bytearray_t &snapshot) override {
+        DataStream s(snapshot.data(), snapshot.data() + snapshot.size());
+        s >> nexecuted >> state_hash;
+        nexecuted = hotstuff::letoh(nexecuted);
+        HOTSTUFF_LOG_INFO("restored the state at height %u: %lu commands executed",
+                        height, nexecuted);
+    }
+
 #ifdef HOTSTUFF_MSG_STAT
     std::unordered_set<conn_t> client_conns;
     void print_stat() const;
 #endif
 
     public:
+    using Net = hotstuff::HotStuffBase::Net;
+
     HotStuffApp(uint32_t blk_size,
                 double stat_period,
                 double impeach_timeout,
@@ -129,7 +161,8 @@ class HotStuffApp: public HotStuff {
                 const EventContext &ec,
                 size_t nworker,
                 const Net::Config &repnet_config,
-                const ClientNetwork<opcode_t>::Config &clinet_config);
+                const ClientNetwork<opcode_t>::Config &clinet_config,
+                uint8_t nchain);
 
     void start(const std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> &reps);
     void stop();
@@ -142,8 +175,6 @@ std::pair<std::string, std::string> split_ip_port_cport(const std::string &s) {
     return std::make_pair(ret[0], ret[1]);
 }
 
-salticidae::BoxObj<HotStuffApp> papp = nullptr;
-
 int main(int argc, char **argv) {
     Config config("hotstuff.conf");
 
@@ -171,8 +202,17 @@ int main(int argc, char **argv) {
     auto opt_clinworker = Config::OptValInt::create(8);
     auto opt_cliburst = Config::OptValInt::create(1000);
     auto opt_notls = Config::OptValFlag::create(false);
+    auto opt_algo = Config::OptValStr::create("secp256k1");
+    auto opt_two_step = Config::OptValFlag::create(false);
+    auto opt_fast_commit = Config::OptValFlag::create(false);
+    auto opt_fast_timeout = Config::OptValDouble::create(0.01);
     auto opt_max_rep_msg = Config::OptValInt::create(4 << 20); // 4M by default
     auto opt_max_cli_msg = Config::OptValInt::create(65536); // 64K by default
+    auto opt_safety_log = Config::OptValStr::create();
+    auto opt_ledger = Config::OptValStr::create();
+    auto opt_checkpoint = Config::OptValInt::create(0);
+    auto opt_prune_retention = Config::OptValInt::create(-1);
+    auto opt_prune_blk_max = Config::OptValInt::create(0);
 
     config.add_opt("block-size", opt_blk_size, Config::SET_VAL);
     config.add_opt("parent-limit", opt_parent_limit, Config::SET_VAL);
@@ -194,8 +234,17 @@ int main(int argc, char **argv) {
     config.add_opt("clinworker", opt_clinworker, Config::SET_VAL, 'M', "the number of threads for client network");
     config.add_opt("cliburst", opt_cliburst, Config::SET_VAL, 'B', "");
     config.add_opt("notls", opt_notls, Config::SWITCH_ON, 's', "disable TLS");
+    config.add_opt("algo", opt_algo, Config::SET_VAL, 'A', "the signature scheme of the keys (secp256k1, schnorr, ed25519)");
+    config.add_opt("two-step", opt_two_step, Config::SWITCH_ON, 'w', "use two-step HotStuff (instead of three-step HS)");
+    config.add_opt("fast-commit", opt_fast_commit, Config::SWITCH_ON, 'F', "wait for all votes to commit with a two-chain");
+    config.add_opt("fast-timeout", opt_fast_timeout, Config::SET_VAL, 'T', "set the time to wait for the rest of the votes (for fast-commit)");
     config.add_opt("max-rep-msg", opt_max_rep_msg, Config::SET_VAL, 'S', "the maximum replica message size");
     config.add_opt("max-cli-msg", opt_max_cli_msg, Config::SET_VAL, 'S', "the maximum client message size");
+    config.add_opt("safety-log", opt_safety_log, Config::SET_VAL, 'W', "log the safety state to this file before voting");
+    config.add_opt("ledger", opt_ledger, Config::SET_VAL, 'L', "store the committed blocks in this directory");
+    config.add_opt("checkpoint", opt_checkpoint, Config::SET_VAL, 'K', "checkpoint the state every this many commits (0 to disable)");
+    config.add_opt("prune-retention", opt_prune_retention, Config::SET_VAL, 'R', "keep this many committed heights in memory (0 to keep all; by default all of them, or 4096 with a ledger or checkpoints)");
+    config.add_opt("prune-blk-max", opt_prune_blk_max, Config::SET_VAL, 'X', "keep fewer committed heights in memory beyond this many blocks (0 for no limit)");
     config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
 
     EventContext ec;
@@ -239,7 +288,7 @@ int main(int argc, char **argv) {
     else
         pmaker = new hotstuff::PaceMakerRR(ec, parent_limit, opt_base_timeout->get(), opt_prop_delay->get());
 
-    HotStuffApp::Net::Config repnet_config;
+    hotstuff::HotStuffBase::Net::Config repnet_config;
     ClientNetwork<opcode_t>::Config clinet_config;
     repnet_config.max_msg_size(opt_max_rep_msg->get());
     clinet_config.max_msg_size(opt_max_cli_msg->get());
@@ -262,18 +311,6 @@ int main(int argc, char **argv) {
     clinet_config
         .burst_size(opt_cliburst->get())
         .nworker(opt_clinworker->get());
-    papp = new HotStuffApp(opt_blk_size->get(),
-                        opt_stat_period->get(),
-                        opt_imp_timeout->get(),
-                        idx,
-                        hotstuff::from_hex(opt_privkey->get()),
-                        plisten_addr,
-                        NetAddr("0.0.0.0", client_port),
-                        std::move(pmaker),
-                        ec,
-                        opt_nworker->get(),
-                        repnet_config,
-                        clinet_config);
     std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> reps;
     for (auto &r: replicas)
     {
@@ -283,18 +320,57 @@ int main(int argc, char **argv) {
             hotstuff::from_hex(std::get<1>(r)),
             hotstuff::from_hex(std::get<2>(r))));
     }
-    auto shutdown = [&](int) { papp->stop(); };
-    salticidae::SigEvent ev_sigint(ec, shutdown);
-    salticidae::SigEvent ev_sigterm(ec, shutdown);
-    ev_sigint.add(SIGINT);
-    ev_sigterm.add(SIGTERM);
-
-    papp->start(reps);
+    /* runs the replica with the crypto backend of HotStuff (given by hs) */
+    auto run = [&](auto *hs) {
+        using App = HotStuffApp<typename std::remove_pointer<decltype(hs)>::type>;
+        salticidae::BoxObj<App> papp = new App(opt_blk_size->get(),
+                            opt_stat_period->get(),
+                            opt_imp_timeout->get(),
+                            idx,
+                            hotstuff::from_hex(opt_privkey->get()),
+                            plisten_addr,
+                            NetAddr("0.0.0.0", client_port),
+                            std::move(pmaker),
+                            ec,
+                            opt_nworker->get(),
+                            repnet_config,
+                            clinet_config,
+                            opt_two_step->get() ? 2 : 3);
+        papp->set_fast_commit(opt_fast_commit->get());
+        papp->set_fast_qc_timeout(opt_fast_timeout->get());
+        if (!opt_safety_log->get().empty())
+            papp->open_safety_log(opt_safety_log->get());
+        if (!opt_ledger->get().empty())
+            papp->open_ledger(opt_ledger->get());
+        papp->set_checkpoint_interval(opt_checkpoint->get());
+        if (opt_prune_retention->get() >= 0 || opt_prune_blk_max->get())
+            papp->set_prune(opt_prune_retention->get() >= 0 ?
+                                opt_prune_retention->get() :
+                                hotstuff::prune_retention_default,
+                            opt_prune_blk_max->get());
+        auto shutdown = [&](int) { papp->stop(); };
+        salticidae::SigEvent ev_sigint(ec, shutdown);
+        salticidae::SigEvent ev_sigterm(ec, shutdown);
+        ev_sigint.add(SIGINT);
+        ev_sigterm.add(SIGTERM);
+
+        papp->start(reps);
+    };
+    const auto &algo = opt_algo->get();
+    if (algo == "secp256k1")
+        run((hotstuff::HotStuffSecp256k1 *)nullptr);
+    else if (algo == "schnorr")
+        run((hotstuff::HotStuffSchnorr *)nullptr);
+    else if (algo == "ed25519")
+        run((hotstuff::HotStuffEd25519 *)nullptr);
+    else
+        throw HotStuffError("unsupported crypto algo: %s", algo.c_str());
     elapsed.stop(true);
     return 0;
 }
 
-HotStuffApp::HotStuffApp(uint32_t blk_size,
+template<typename HotStuff>
+HotStuffApp<HotStuff>::HotStuffApp(uint32_t blk_size,
                         double stat_period,
                         double impeach_timeout,
                         ReplicaID idx,
@@ -305,14 +381,16 @@ HotStuffApp::HotStuffApp(uint32_t blk_size,
                         const EventContext &ec,
                         size_t nworker,
                         const Net::Config &repnet_config,
-                        const ClientNetwork<opcode_t>::Config &clinet_config):
+                        const ClientNetwork<opcode_t>::Config &clinet_config,
+                        uint8_t nchain):
     HotStuff(blk_size, idx, raw_privkey,
-            plisten_addr, std::move(pmaker), ec, nworker, repnet_config),
+            plisten_addr, std::move(pmaker), ec, nworker, repnet_config, nchain),
     stat_period(stat_period),
     impeach_timeout(impeach_timeout),
     ec(ec),
     cn(req_ec, clinet_config),
-    clisten_addr(clisten_addr) {
+    clisten_addr(clisten_addr),
+    nexecuted(0) {
     /* prepare the thread used for sending back confirmations */
     resp_tcall = new salticidae::ThreadCall(resp_ec);
     req_tcall = new salticidae::ThreadCall(req_ec);
@@ -335,7 +413,8 @@ HotStuffApp::HotStuffApp(uint32_t blk_size,
     cn.listen(clisten_addr);
 }
 
-void HotStuffApp::client_request_cmd_handler(MsgReqCmd &&msg, const conn_t &conn) {
+template<typename HotStuff>
+void HotStuffApp<HotStuff>::client_request_cmd_handler(MsgReqCmd &&msg, const conn_t &conn) {
     const NetAddr addr = conn->get_addr();
     auto cmd = parse_cmd(msg.serialized);
     const auto &cmd_hash = cmd->get_hash();
@@ -345,11 +424,11 @@ void HotStuffApp::client_request_cmd_handler(MsgReqCmd &&msg, const conn_t &conn
     });
 }
 
-void HotStuffApp::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> &reps) {
+template<typename HotStuff>
+void HotStuffApp<HotStuff>::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> &reps) {
     ev_stat_timer = TimerEvent(ec, [this](TimerEvent &) {
         HotStuff::print_stat();
         HotStuffApp::print_stat();
-        //HotStuffCore::prune(100);
         ev_stat_timer.add(stat_period);
     });
     ev_stat_timer.add(stat_period);
@@ -378,11 +457,12 @@ void HotStuffApp::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytea
     ec.dispatch();
 }
 
-void HotStuffApp::stop() {
-    papp->req_tcall->async_call([this](salticidae::ThreadCall::Handle &) {
+template<typename HotStuff>
+void HotStuffApp<HotStuff>::stop() {
+    req_tcall->async_call([this](salticidae::ThreadCall::Handle &) {
         req_ec.stop();
     });
-    papp->resp_tcall->async_call([this](salticidae::ThreadCall::Handle &) {
+    resp_tcall->async_call([this](salticidae::ThreadCall::Handle &) {
         resp_ec.stop();
     });
 
@@ -391,7 +471,8 @@ void HotStuffApp::stop() {
     ec.stop();
 }
 
-void HotStuffApp::print_stat() const {
+template<typename HotStuff>
+void HotStuffApp<HotStuff>::print_stat() const {
 #ifdef HOTSTUFF_MSG_STAT
     HOTSTUFF_LOG_INFO("--- client msg. (10s) ---");
     size_t _nsent = 0;
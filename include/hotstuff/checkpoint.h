@@ -0,0 +1,83 @@
+/**
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_CHECKPOINT_H
+#define _HOTSTUFF_CHECKPOINT_H
+
+#include <algorithm>
+#include <vector>
+
+#include "hotstuff/type.h"
+#include "hotstuff/crypto.h"
+
+namespace hotstuff {
+
+/** size of the pieces a snapshot is sent in */
+const uint32_t snapshot_chunk_size = 1 << 20;
+
+/** A snapshot of the application state right after the committed block at
+ * height has been executed.
+ *
+ * The snapshot is cut into chunks of snapshot_chunk_size bytes. Its digest
+ * covers the height, the block and the hash of every chunk, so once a QC
+ * certifies the digest, each chunk fetched from any replica can be checked
+ * on its own. */
+struct Checkpoint {
+    uint32_t height;
+    uint256_t blk_hash;
+    /** the snapshot, as produced by the application */
+    bytearray_t data;
+    std::vector<uint256_t> chunk_hashes;
+    uint256_t digest;
+    /** QC on digest, once a majority has made the same checkpoint */
+    quorum_cert_bt qc;
+
+    Checkpoint(uint32_t height, const uint256_t &blk_hash, bytearray_t &&data):
+            height(height), blk_hash(blk_hash), data(std::move(data)), qc(nullptr) {
+        for (uint32_t i = 0; i < get_nchunks(this->data.size()); i++)
+            chunk_hashes.push_back(get_chunk_hash(get_chunk(i), get_chunk_size(i)));
+        digest = get_digest(height, blk_hash, this->data.size(), chunk_hashes);
+    }
+
+    static uint32_t get_nchunks(size_t size) {
+        return (size + snapshot_chunk_size - 1) / snapshot_chunk_size;
+    }
+
+    static uint256_t get_chunk_hash(const uint8_t *chunk, size_t size) {
+        return DataStream(chunk, chunk + size).get_hash();
+    }
+
+    static uint256_t get_digest(uint32_t height, const uint256_t &blk_hash,
+                                uint32_t size, const std::vector<uint256_t> &chunk_hashes) {
+        DataStream s;
+        s << htole(height) << blk_hash << htole(size);
+        for (const auto &h: chunk_hashes) s << h;
+        return s.get_hash();
+    }
+
+    const uint8_t *get_chunk(uint32_t idx) const {
+        return data.data() + (size_t)idx * snapshot_chunk_size;
+    }
+
+    size_t get_chunk_size(uint32_t idx) const {
+        return std::min(data.size() - (size_t)idx * snapshot_chunk_size,
+                        (size_t)snapshot_chunk_size);
+    }
+};
+
+}
+
+#endif
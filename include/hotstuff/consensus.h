@@ -19,8 +19,11 @@
 #define _HOTSTUFF_CONSENSUS_H
 
 #include <cassert>
+#include <queue>
 #include <set>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <future>
 
 #include "rse-merkle/RSE.h"
@@ -49,30 +52,62 @@ class HotStuffCore {
     block_t b_lock;                            /**< locked block */
     block_t b_exec;                            /**< last executed block */
     uint32_t vheight;          /**< height of the block last voted for */
+    /** height of the newest block restored without its parents: the
+     * history below it is not known here */
+    uint32_t root_height;
     /* === auxilliary variables === */
     privkey_bt priv_key;            /**< private key for signing votes */
     std::set<block_t> tails;   /**< set of tail blocks */
+    BlockWindow window;        /**< delivered blocks from b_exec up */
+    /** the only thread touching block handles */
+    std::thread::id consensus_thread;
+    /** delivered blocks not pruned yet, lowest first */
+    using prune_entry_t = std::pair<uint32_t, uint256_t>;
+    struct PruneEntryCmp {
+        bool operator()(const prune_entry_t &a, const prune_entry_t &b) const {
+            return a.first > b.first;
+        }
+    };
+    std::priority_queue<prune_entry_t, std::vector<prune_entry_t>,
+                        PruneEntryCmp> prune_queue;
     ReplicaConfig config;                   /**< replica configuration */
     /* === async event queues === */
     std::unordered_map<block_t, promise_t> qc_waiting;
+    /** blocks having a majority QC, waiting for the rest of the votes */
+    std::unordered_set<block_t> fast_qc_waiting;
     promise_t propose_waiting;
     promise_t receive_proposal_waiting;
     promise_t hqc_update_waiting;
     /* == feature switches == */
+    /** length of the chain of direct QCs required to commit (2 or 3) */
+    uint8_t nchain;
+    /** commit rule for the configured chain length */
+    void (HotStuffCore::*update_fn)(const block_t &nblk);
     /** always vote negatively, useful for some PaceMakers */
     bool vote_disabled;
+    /** wait for all n votes and commit with a two-chain when they arrive;
+     * the replica then locks on the one-chain block, as with nchain = 2 */
+    bool fast_commit;
 
     block_t get_delivered_blk(const uint256_t &blk_hash);
     void sanity_check_delivered(const block_t &blk);
-    void update(const block_t &nblk);
+    void update(const block_t &nblk) { (this->*update_fn)(nblk); }
+    template<uint8_t N> void update_chain(const block_t &nblk);
+    void decode_cmds(const block_t &blk);
+    void commit(const block_t &blk);
     void update_hqc(const block_t &_hqc, const quorum_cert_bt &qc);
     void on_hqc_update();
+    void finish_qc(const block_t &blk);
     void on_qc_finish(const block_t &blk);
     void on_propose_(const Proposal &prop);
     void on_receive_proposal_(const Proposal &prop);
 
     protected:
     ReplicaID id;                  /**< identity of the replica itself */
+    /** Sign obj_hash with the key of the replica. */
+    part_cert_bt sign(const uint256_t &obj_hash) {
+        return create_part_cert(*priv_key, obj_hash);
+    }
 
     public:
     BoxObj<EntityStorage> storage;
@@ -82,7 +117,7 @@ class HotStuffCore {
     std::unordered_map<string, std::shared_future<std::vector<uint256_t> > > futures;
 
 
-    HotStuffCore(ReplicaID id, privkey_bt &&priv_key);
+    HotStuffCore(ReplicaID id, privkey_bt &&priv_key, uint8_t nchain = 3);
     virtual ~HotStuffCore() {
         b0->qc_ref = nullptr;
     }
@@ -107,6 +142,21 @@ class HotStuffCore {
      * The block mentioned in the message should be already delivered. */
     void on_receive_proposal(const Proposal &prop);
 
+    /* Calls to resume from the state persisted before a restart, after
+     * on_init() and before any other input, or from a checkpoint fetched
+     * from the other replicas. */
+    /** Deliver blk, known to be at height, again. Its parents must have
+     * been restored, unless root is set: the oldest committed block then
+     * stands without them, as the history below is not restored.
+     * @return true if delivered */
+    bool on_restore_blk(const block_t &blk, uint32_t height, bool root = false);
+    /** Resume with the given safety state, whose blocks are restored; a
+     * null block leaves the corresponding variable as it is, and b_lock
+     * only moves up. */
+    void on_restore_state(uint32_t vheight, const block_t &b_lock,
+                        const block_t &b_exec, const block_t &hqc_blk,
+                        quorum_cert_bt &&hqc_qc);
+
     /** Call upon the delivery of a vote message.
      * The block mentioned in the message should be already delivered. */
     void on_receive_vote(const Vote &vote);
@@ -114,6 +164,15 @@ class HotStuffCore {
     /** Call upon the delivery of a slice message.*/
     void on_receive_slice(const Slice &slice);
 
+    /** Call when the fast path gives up waiting for the votes missing from
+     * the QC of blk (see do_fast_qc_wait()). The QC formed by the majority is
+     * then used as in the normal path. */
+    void on_fast_qc_timeout(const block_t &blk);
+
+    /** Number of further votes on blk (proposed by itself) that can still
+     * contribute to its QC; 0 once the QC is finished. */
+    size_t get_nvotes_needed(const block_t &blk) const;
+
     /** Call to submit new commands to be decided (executed). "Parents" must
      * contain at least one block, and the first block is the actual parent,
      * while the others are uncles/aunts */
@@ -141,6 +200,29 @@ class HotStuffCore {
      * should send the vote message to a *good* proposer to have good liveness,
      * while safety is always guaranteed by HotStuffCore. */
     virtual void do_vote(ReplicaID last_proposer, const Vote &vote) = 0;
+    /** Called when the QC of blk has got the majority while the fast path
+     * still waits for the votes of all replicas. The user should call
+     * on_fast_qc_timeout() if the remaining votes do not arrive in time. */
+    virtual void do_fast_qc_wait(const block_t &blk) = 0;
+    /** Called for each block dropped by prune(), so that the user can drop
+     * what it keeps about the block. */
+    virtual void do_prune(const block_t &) {}
+    /* Called upon each change of the safety state, before any vote
+     * depending on it is passed to do_vote(). The user may make it durable
+     * and hold the votes back until it is, then resume from it after a
+     * restart (see on_restore_blk()); the state is only kept in memory by
+     * default. */
+    /** blk has been delivered. */
+    virtual void do_persist_blk(const block_t &/*blk*/) {}
+    /** vheight is raised to the height of blk, which gets the vote. */
+    virtual void do_persist_vote(const block_t &/*blk*/) {}
+    virtual void do_persist_b_lock(const block_t &/*blk*/) {}
+    virtual void do_persist_b_exec(const block_t &/*blk*/) {}
+    virtual void do_persist_hqc(const block_t &/*blk*/, const QuorumCert &/*qc*/) {}
+    /** Called for each committed block, in the order of heights, with the
+     * commands it decides. */
+    virtual void do_persist_commit(const block_t &/*blk*/,
+                                const std::vector<uint256_t> &/*cmds*/) {}
 
     /* The user plugs in the detailed instances for those
      * polymorphic data types. */
@@ -160,8 +242,11 @@ class HotStuffCore {
     /** Add a replica to the current configuration. This should only be called
      * before running HotStuffCore protocol. */
     void add_replica(ReplicaID rid, const PeerId &peer_id, pubkey_bt &&pub_key);
-    /** Try to prune blocks lower than last committed height - staleness. */
-    void prune(uint32_t staleness);
+    /** Release up to nmax delivered blocks lower than last committed
+     * height - staleness, lowest first, with their links, votes and QCs;
+     * those still referred to elsewhere go once they are not.
+     * @return the number of blocks pruned, nmax if more may be due */
+    size_t prune(uint32_t staleness, size_t nmax = SIZE_MAX);
 
     /* PaceMaker can use these functions to monitor the core protocol state
      * transition */
@@ -176,14 +261,45 @@ class HotStuffCore {
 
     /* Other useful functions */
     const block_t &get_genesis() const { return b0; }
+    const block_t &get_b_exec() const { return b_exec; }
+    const block_t &get_b_lock() const { return b_lock; }
     const block_t &get_hqc() { return hqc.first; }
+    const quorum_cert_bt &get_hqc_qc() const { return hqc.second; }
     const ReplicaConfig &get_config() const { return config; }
     ReplicaID get_id() const { return id; }
-    const std::set<block_t> get_tails() const { return tails; }
+    /** The delivered blocks no other block extends, kept up to date as
+     * blocks are delivered and pruned. */
+    const std::set<block_t> &get_tails() const { return tails; }
+    /** The delivered block of blk_hash, or nullptr. */
+    block_t find_delivered_blk(const uint256_t &blk_hash);
+    /** The delivered blocks from height up, lowest first: the committed
+     * ones below b_exec still in memory, then all those from b_exec up. */
+    std::vector<block_t> get_delivered_blks(uint32_t height) const;
+    /** A copy of blk that may be handed to another thread: the reference
+     * counts of block handles are not atomic, so a block_t must never
+     * leave the consensus thread. Throws if called from another thread. */
+    shared_block_t share_blk(const block_t &blk) const;
+    /** Whether a is b or one of its ancestors, in O(log h). */
+    bool is_ancestor(const block_t &a, const block_t &b) const {
+        return window.is_ancestor(a, b);
+    }
     operator std::string () const;
     void set_vote_disabled(bool f) { vote_disabled = f; }
+    /** Commit a block by the two-chain once all replicas have voted for its
+     * child (three-step HotStuff only). This is a cluster-wide setting: the
+     * blocks carry the setting of their proposer, and a replica does not
+     * vote for a block whose setting differs from its own, so all replicas
+     * must be started with the same one. */
+    void set_fast_commit(bool f) { fast_commit = f; }
+    bool is_fast_commit() const { return fast_commit; }
+    /** 2 for two-step HotStuff, 3 for the original three-step one. */
+    uint8_t get_nchain() const { return nchain; }
 };
 
+/* the commit rules, selected at construction */
+template<> void HotStuffCore::update_chain<2>(const block_t &nblk);
+template<> void HotStuffCore::update_chain<3>(const block_t &nblk);
+
 struct Slice: public MerkleProof {
     uint256_t m_blk_hash;
 
@@ -330,7 +446,7 @@ struct Proposal: public Serializable {
 };
 
 /** Abstraction for vote messages. */
-struct Vote: public Serializable {
+struct Vote: public Serializable, public PoolAllocated<Vote> {
     ReplicaID voter;
     /** block being voted */
     uint256_t blk_hash;
@@ -373,9 +489,9 @@ struct Vote: public Serializable {
                 cert->get_obj_hash() == blk_hash;
     }
 
-    promise_t verify(VeriPool &vpool) const {
+    veri_promise_t verify(VeriPool &vpool, const veri_token_t &token = veri_token_t()) const {
         assert(hsc != nullptr);
-        return cert->verify(hsc->get_config().get_pubkey(voter), vpool).then([this](bool result) {
+        return cert->verify(hsc->get_config().get_pubkey(voter), vpool, token).then([this](bool result) {
             return result && cert->get_obj_hash() == blk_hash;
         });
     }
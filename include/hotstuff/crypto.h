@@ -17,7 +17,11 @@
 #ifndef _HOTSTUFF_CRYPTO_H
 #define _HOTSTUFF_CRYPTO_H
 
+#include <queue>
+#include <unordered_set>
 #include <openssl/rand.h>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
 
 #include "secp256k1.h"
 #include "salticidae/crypto.h"
@@ -48,7 +52,10 @@ using privkey_bt = BoxObj<PrivKey>;
 class PartCert: public Serializable, public Cloneable {
     public:
     virtual ~PartCert() = default;
-    virtual promise_t verify(const PubKey &pubkey, VeriPool &vpool) = 0;
+    /** Verify in vpool; the check is skipped (resolves false) once token is
+     * set before a worker picks it up. */
+    virtual veri_promise_t verify(const PubKey &pubkey, VeriPool &vpool,
+                            const veri_token_t &token = veri_token_t()) = 0;
     virtual bool verify(const PubKey &pubkey) = 0;
     virtual const uint256_t &get_obj_hash() const = 0;
     virtual PartCert *clone() override = 0;
@@ -56,34 +63,84 @@ class PartCert: public Serializable, public Cloneable {
 
 class ReplicaConfig;
 
+/** Bounded set of the digests of QCs known to be valid, so a QC carried by
+ * several blocks or fetched again is only checked once. The digest covers
+ * the whole serialized QC (object hash, signer bitmap and signatures). Not
+ * thread-safe: used by the thread running the protocol. */
+class VerifiedQCCache {
+    std::unordered_set<uint256_t> verified;
+    /** insertion order, the oldest digest is evicted first */
+    std::queue<uint256_t> order;
+    /** QCs being verified, later requests wait on the same result */
+    std::unordered_map<uint256_t, veri_promise_t> pending;
+    size_t capacity;
+
+    public:
+    VerifiedQCCache(size_t capacity = 4096): capacity(capacity) {}
+
+    bool contains(const uint256_t &digest) const {
+        return verified.count(digest);
+    }
+
+    void insert(const uint256_t &digest) {
+        if (!verified.insert(digest).second) return;
+        order.push(digest);
+        if (order.size() > capacity)
+        {
+            verified.erase(order.front());
+            order.pop();
+        }
+    }
+
+    /** Verify the QC with the given digest using check() unless it is
+     * already known to be valid or being verified. */
+    template<typename Func>
+    veri_promise_t verify(const uint256_t &digest, Func &&check) {
+        if (contains(digest))
+            return lwpromise::resolved(true);
+        auto it = pending.find(digest);
+        if (it != pending.end())
+            return it->second;
+        auto pm = check();
+        pending.insert(std::make_pair(digest, pm));
+        return pm.then([this, digest](bool result) {
+            pending.erase(digest);
+            if (result) insert(digest);
+            return result;
+        });
+    }
+};
+
 class QuorumCert: public Serializable, public Cloneable {
     public:
     virtual ~QuorumCert() = default;
     virtual void add_part(ReplicaID replica, const PartCert &pc) = 0;
     virtual void compute() = 0;
-    virtual promise_t verify(const ReplicaConfig &config, VeriPool &vpool) = 0;
+    virtual veri_promise_t verify(const ReplicaConfig &config, VeriPool &vpool) = 0;
     virtual bool verify(const ReplicaConfig &config) = 0;
     virtual const uint256_t &get_obj_hash() const = 0;
+    /** Number of replicas whose partial certificates are in the QC. */
+    virtual size_t get_nparts() const = 0;
     virtual QuorumCert *clone() override = 0;
 };
 
 using part_cert_bt = BoxObj<PartCert>;
 using quorum_cert_bt = BoxObj<QuorumCert>;
 
-class PubKeyDummy: public PubKey {
+class PubKeyDummy final: public PubKey {
     PubKeyDummy *clone() override { return new PubKeyDummy(*this); }
     void serialize(DataStream &) const override {}
     void unserialize(DataStream &) override {}
 };
 
-class PrivKeyDummy: public PrivKey {
+class PrivKeyDummy final: public PrivKey {
     pubkey_bt get_pubkey() const override { return new PubKeyDummy(); }
     void serialize(DataStream &) const override {}
     void unserialize(DataStream &) override {}
     void from_rand() override {}
 };
 
-class PartCertDummy: public PartCert {
+class PartCertDummy final: public PartCert, public PoolAllocated<PartCertDummy> {
     uint256_t obj_hash;
     public:
     PartCertDummy() {}
@@ -104,14 +161,14 @@ class PartCertDummy: public PartCert {
     }
 
     bool verify(const PubKey &) override { return true; }
-    promise_t verify(const PubKey &, VeriPool &) override {
-        return promise_t([](promise_t &pm){ pm.resolve(true); });
+    veri_promise_t verify(const PubKey &, VeriPool &, const veri_token_t &) override {
+        return lwpromise::resolved(true);
     }
 
     const uint256_t &get_obj_hash() const override { return obj_hash; }
 };
 
-class QuorumCertDummy: public QuorumCert {
+class QuorumCertDummy final: public QuorumCert, public PoolAllocated<QuorumCertDummy> {
     uint256_t obj_hash;
     public:
     QuorumCertDummy() {}
@@ -134,11 +191,78 @@ class QuorumCertDummy: public QuorumCert {
     void add_part(ReplicaID, const PartCert &) override {}
     void compute() override {}
     bool verify(const ReplicaConfig &) override { return true; }
-    promise_t verify(const ReplicaConfig &, VeriPool &) override {
-        return promise_t([](promise_t &pm) { pm.resolve(true); });
+    veri_promise_t verify(const ReplicaConfig &, VeriPool &) override {
+        return lwpromise::resolved(true);
     }
 
     const uint256_t &get_obj_hash() const override { return obj_hash; }
+    /* the dummy QC does not keep track of the voters */
+    size_t get_nparts() const override { return 0; }
+};
+
+/** Layout shared by the QCs made of fixed-size signatures: the signer bitmap
+ * and the signatures packed in the order of replica ids. The packed block is
+ * shared between the clones until one of them adds a part. */
+template<size_t sig_size>
+class PackedQuorumCert: public QuorumCert {
+    using sig_block_t = ArcObj<bytearray_t>;
+
+    /** the offset of the signature of rid in sigs */
+    size_t sig_offset(ReplicaID rid) const {
+        size_t idx = 0;
+        for (size_t i = 0; i < rid; i++)
+            if (rids.get(i)) idx++;
+        return idx * sig_size;
+    }
+
+    protected:
+    uint256_t obj_hash;
+    salticidae::Bits rids;
+    sig_block_t sigs;
+
+    void add_sig(ReplicaID rid, const uint8_t *sig) {
+        if (rids.get(rid)) return;
+        /* copy on write */
+        if (sigs.get_cnt() > 1)
+            sigs = sig_block_t(new bytearray_t(*sigs));
+        sigs->insert(sigs->begin() + sig_offset(rid), sig, sig + sig_size);
+        rids.set(rid);
+    }
+
+    public:
+    PackedQuorumCert(): sigs(new bytearray_t()) {}
+    PackedQuorumCert(size_t nreplicas, const uint256_t &obj_hash):
+            QuorumCert(), obj_hash(obj_hash), rids(nreplicas),
+            sigs(new bytearray_t()) {
+        rids.clear();
+        /* the votes then go in without reallocating */
+        sigs->reserve(nreplicas * sig_size);
+    }
+
+    void compute() override {}
+
+    const uint256_t &get_obj_hash() const override { return obj_hash; }
+
+    size_t get_nparts() const override { return sigs->size() / sig_size; }
+
+    void serialize(DataStream &s) const override {
+        s << obj_hash << rids;
+        s.put_data(sigs->data(), sigs->data() + sigs->size());
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed quorum cert");
+        s >> obj_hash >> rids;
+        size_t nbytes = 0;
+        for (size_t i = 0; i < rids.size(); i++)
+            if (rids.get(i)) nbytes += sig_size;
+        try {
+            auto data = nbytes ? s.get_data_inplace(nbytes) : nullptr;
+            sigs = sig_block_t(new bytearray_t(data, data + nbytes));
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+    }
 };
 
 
@@ -168,11 +292,17 @@ using secp256k1_context_t = ArcObj<Secp256k1Context>;
 extern secp256k1_context_t secp256k1_default_sign_ctx;
 extern secp256k1_context_t secp256k1_default_verify_ctx;
 
+/** Contexts owned by the calling thread, so that worker threads signing or
+ * verifying do not share the reference counts of the default ones. */
+const secp256k1_context_t &secp256k1_thread_sign_ctx();
+const secp256k1_context_t &secp256k1_thread_verify_ctx();
+
 class PrivKeySecp256k1;
 
-class PubKeySecp256k1: public PubKey {
+class PubKeySecp256k1 final: public PubKey {
     static const auto _olen = 33;
     friend class SigSecp256k1;
+    friend class Secp256k1SigCache;
     secp256k1_pubkey data;
     secp256k1_context_t ctx;
 
@@ -191,7 +321,7 @@ class PubKeySecp256k1: public PubKey {
                                     secp256k1_default_sign_ctx);
 
     void serialize(DataStream &s) const override {
-        static uint8_t output[_olen];
+        uint8_t output[_olen];
         size_t olen = _olen;
         (void)secp256k1_ec_pubkey_serialize(
                 ctx->ctx, (unsigned char *)output,
@@ -215,7 +345,7 @@ class PubKeySecp256k1: public PubKey {
     }
 };
 
-class PrivKeySecp256k1: public PrivKey {
+class PrivKeySecp256k1 final: public PrivKey {
     static const auto nbytes = 32;
     friend class PubKeySecp256k1;
     friend class SigSecp256k1;
@@ -265,6 +395,7 @@ PubKeySecp256k1::PubKeySecp256k1(
 }
 
 class SigSecp256k1: public Serializable {
+    friend class Secp256k1SigCache;
     secp256k1_ecdsa_signature data;
     secp256k1_context_t ctx;
 
@@ -274,23 +405,24 @@ class SigSecp256k1: public Serializable {
     }
 
     public:
+    /** length of the compact form of the signature */
+    static const size_t compact_size = 64;
+
     SigSecp256k1(const secp256k1_context_t &ctx =
                         secp256k1_default_sign_ctx):
         Serializable(), ctx(ctx) {}
     SigSecp256k1(const uint256_t &digest,
                 const PrivKeySecp256k1 &priv_key,
-                secp256k1_context_t &ctx =
+                const secp256k1_context_t &ctx =
                         secp256k1_default_sign_ctx):
         Serializable(), ctx(ctx) {
         sign(digest, priv_key);
     }
 
     void serialize(DataStream &s) const override {
-        static uint8_t output[64];
-        (void)secp256k1_ecdsa_signature_serialize_compact(
-            ctx->ctx, (unsigned char *)output,
-            &data);
-        s.put_data(output, output + 64);
+        uint8_t output[compact_size];
+        to_compact(output);
+        s.put_data(output, output + compact_size);
     }
 
     void unserialize(DataStream &s) override {
@@ -304,6 +436,17 @@ class SigSecp256k1: public Serializable {
         }
     }
 
+    /** Load from the compact form, return false if it is ill-formed. */
+    bool from_compact(const uint8_t *input) {
+        return secp256k1_ecdsa_signature_parse_compact(
+                ctx->ctx, &data, input);
+    }
+
+    void to_compact(uint8_t *output) const {
+        (void)secp256k1_ecdsa_signature_serialize_compact(
+            ctx->ctx, output, &data);
+    }
+
     void sign(const bytearray_t &msg, const PrivKeySecp256k1 &priv_key) {
         check_msg_length(msg);
         if (!secp256k1_ecdsa_sign(
@@ -329,7 +472,65 @@ class SigSecp256k1: public Serializable {
     }
 };
 
-class Secp256k1VeriTask: public VeriTask {
+/** Lock-free, direct-mapped memo of the secp256k1 signatures known to be
+ * valid, so that a signature first checked as a vote (or in a QC on another
+ * fork) is not checked again when a QC carries it. (Voter key, object hash,
+ * signature) are hashed under a random per-process salt: 64 bits of the
+ * hash pick the slot and another 128 bits are the tag kept in it, so the
+ * slot index adds nothing to the tag. A slot taken by another signature is
+ * simply overwritten; a slot torn by racing writers only holds halves of
+ * two valid tags, which no other signature can be made to match without
+ * the salt. Safe to use from any thread. */
+class Secp256k1SigCache {
+    struct Slot {
+        std::atomic<uint64_t> tag[2];
+        Slot() { tag[0] = 0; tag[1] = 0; }
+    };
+
+    struct Fingerprint {
+        uint64_t index;
+        uint64_t tag[2];
+    };
+
+    std::vector<Slot> slots;
+    uint8_t salt[32];
+
+    Fingerprint fingerprint(const PubKeySecp256k1 &pub_key,
+                            const uint256_t &msg,
+                            const SigSecp256k1 &sig) const;
+
+    public:
+    Secp256k1SigCache(size_t nslots = 1 << 16);
+
+    /** Drop all entries and use nslots slots (none disables the cache).
+     * Not thread-safe: only call it while no verification is running. */
+    void reset(size_t nslots) {
+        slots = std::vector<Slot>(nslots);
+    }
+
+    bool contains(const PubKeySecp256k1 &pub_key,
+                const uint256_t &msg, const SigSecp256k1 &sig) const {
+        if (slots.empty()) return false;
+        auto fp = fingerprint(pub_key, msg, sig);
+        auto &slot = slots[fp.index % slots.size()];
+        return slot.tag[0].load(std::memory_order_relaxed) == fp.tag[0] &&
+                slot.tag[1].load(std::memory_order_relaxed) == fp.tag[1];
+    }
+
+    void insert(const PubKeySecp256k1 &pub_key,
+                const uint256_t &msg, const SigSecp256k1 &sig) {
+        if (slots.empty()) return;
+        auto fp = fingerprint(pub_key, msg, sig);
+        auto &slot = slots[fp.index % slots.size()];
+        slot.tag[0].store(fp.tag[0], std::memory_order_relaxed);
+        slot.tag[1].store(fp.tag[1], std::memory_order_relaxed);
+    }
+};
+
+extern Secp256k1SigCache secp256k1_verified_sigs;
+
+class Secp256k1VeriTask final: public VeriTask,
+                            public PoolAllocated<Secp256k1VeriTask> {
     uint256_t msg;
     PubKeySecp256k1 pubkey;
     SigSecp256k1 sig;
@@ -341,11 +542,15 @@ class Secp256k1VeriTask: public VeriTask {
     virtual ~Secp256k1VeriTask() = default;
 
     bool verify() override {
-        return sig.verify(msg, pubkey, secp256k1_default_verify_ctx);
+        if (!sig.verify(msg, pubkey, secp256k1_thread_verify_ctx()))
+            return false;
+        secp256k1_verified_sigs.insert(pubkey, msg, sig);
+        return true;
     }
 };
 
-class PartCertSecp256k1: public SigSecp256k1, public PartCert {
+class PartCertSecp256k1 final: public SigSecp256k1, public PartCert,
+                                public PoolAllocated<PartCertSecp256k1> {
     uint256_t obj_hash;
 
     public:
@@ -355,16 +560,24 @@ class PartCertSecp256k1: public SigSecp256k1, public PartCert {
         PartCert(),
         obj_hash(obj_hash) {}
 
-    bool verify(const PubKey &pub_key) override {
-        return SigSecp256k1::verify(obj_hash,
-                                    static_cast<const PubKeySecp256k1 &>(pub_key),
-                                    secp256k1_default_verify_ctx);
+    bool verify(const PubKey &_pub_key) override {
+        auto &pub_key = static_cast<const PubKeySecp256k1 &>(_pub_key);
+        if (secp256k1_verified_sigs.contains(pub_key, obj_hash, *this))
+            return true;
+        if (!SigSecp256k1::verify(obj_hash, pub_key,
+                                secp256k1_default_verify_ctx))
+            return false;
+        secp256k1_verified_sigs.insert(pub_key, obj_hash, *this);
+        return true;
     }
 
-    promise_t verify(const PubKey &pub_key, VeriPool &vpool) override {
-        return vpool.verify(new Secp256k1VeriTask(obj_hash,
-                static_cast<const PubKeySecp256k1 &>(pub_key),
-                static_cast<const SigSecp256k1 &>(*this)));
+    veri_promise_t verify(const PubKey &_pub_key, VeriPool &vpool,
+                    const veri_token_t &token) override {
+        auto &pub_key = static_cast<const PubKeySecp256k1 &>(_pub_key);
+        if (secp256k1_verified_sigs.contains(pub_key, obj_hash, *this))
+            return lwpromise::resolved(true);
+        return vpool.verify(new Secp256k1VeriTask(obj_hash, pub_key,
+                static_cast<const SigSecp256k1 &>(*this)), token);
     }
 
     const uint256_t &get_obj_hash() const override { return obj_hash; }
@@ -384,10 +597,10 @@ class PartCertSecp256k1: public SigSecp256k1, public PartCert {
     }
 };
 
-class QuorumCertSecp256k1: public QuorumCert {
-    uint256_t obj_hash;
-    salticidae::Bits rids;
-    std::unordered_map<ReplicaID, SigSecp256k1> sigs;
+class QuorumCertSecp256k1 final:
+        public PackedQuorumCert<SigSecp256k1::compact_size>,
+        public PoolAllocated<QuorumCertSecp256k1> {
+    static const size_t sig_size = SigSecp256k1::compact_size;
 
     public:
     QuorumCertSecp256k1() = default;
@@ -396,32 +609,478 @@ class QuorumCertSecp256k1: public QuorumCert {
     void add_part(ReplicaID rid, const PartCert &pc) override {
         if (pc.get_obj_hash() != obj_hash)
             throw std::invalid_argument("PartCert does match the block hash");
-        sigs.insert(std::make_pair(
-            rid, static_cast<const PartCertSecp256k1 &>(pc)));
-        rids.set(rid);
+        uint8_t sig[sig_size];
+        static_cast<const PartCertSecp256k1 &>(pc).to_compact(sig);
+        add_sig(rid, sig);
     }
 
-    void compute() override {}
+    bool verify(const ReplicaConfig &config) override;
+    veri_promise_t verify(const ReplicaConfig &config, VeriPool &vpool) override;
+
+    QuorumCertSecp256k1 *clone() override {
+        return new QuorumCertSecp256k1(*this);
+    }
+};
+
+/* BIP340 Schnorr signatures over secp256k1 with x-only public keys. The
+ * arithmetic is done with OpenSSL so that all signatures of a QC can be
+ * checked together by one multi-scalar multiplication. */
+
+class SchnorrGroup {
+    public:
+    EC_GROUP *group;
+    BIGNUM *order;  /**< the order of the group (n) */
+    BIGNUM *prime;  /**< the field size (p) */
+    SchnorrGroup();
+    SchnorrGroup(const SchnorrGroup &) = delete;
+    ~SchnorrGroup();
+};
+
+extern const SchnorrGroup schnorr_group;
+
+class PrivKeySchnorr;
+
+class PubKeySchnorr final: public PubKey {
+    static const auto nbytes = 32;
+    friend class SigSchnorr;
+    /** the x coordinate */
+    uint8_t data[nbytes];
+    /** the point with the even y coordinate, lifted once */
+    EC_POINT *point;
+
+    void lift();
+
+    public:
+    PubKeySchnorr(): PubKey(), point(nullptr) {}
+
+    PubKeySchnorr(const bytearray_t &raw_bytes):
+        PubKeySchnorr() { from_bytes(raw_bytes); }
+
+    PubKeySchnorr(const PrivKeySchnorr &priv_key);
+
+    PubKeySchnorr(const PubKeySchnorr &other);
+
+    PubKeySchnorr &operator=(const PubKeySchnorr &) = delete;
+
+    ~PubKeySchnorr() { EC_POINT_free(point); }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed public key");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+        lift();
+    }
+
+    PubKeySchnorr *clone() override {
+        return new PubKeySchnorr(*this);
+    }
+};
+
+class PrivKeySchnorr final: public PrivKey {
+    static const auto nbytes = 32;
+    friend class PubKeySchnorr;
+    friend class SigSchnorr;
+    uint8_t data[nbytes];
+
+    public:
+    PrivKeySchnorr(): PrivKey() {}
+
+    PrivKeySchnorr(const bytearray_t &raw_bytes):
+        PrivKeySchnorr() { from_bytes(raw_bytes); }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed private key");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+    }
+
+    void from_rand() override;
+
+    pubkey_bt get_pubkey() const override {
+        return new PubKeySchnorr(*this);
+    }
+};
+
+class SigSchnorr: public Serializable {
+    public:
+    static const size_t nbytes = 64;
+
+    private:
+    /** the x coordinate of R followed by s */
+    uint8_t data[nbytes];
+
+    static void check_msg_length(const bytearray_t &msg) {
+        if (msg.size() != 32)
+            throw std::invalid_argument("the message should be 32-bytes");
+    }
+
+    public:
+    SigSchnorr(): Serializable() {}
+    SigSchnorr(const uint256_t &digest,
+                const PrivKeySchnorr &priv_key):
+        Serializable() {
+        sign(digest, priv_key);
+    }
+    SigSchnorr(const uint8_t *raw): Serializable() {
+        memmove(data, raw, nbytes);
+    }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed signature");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+    }
+
+    const uint8_t *get_data() const { return data; }
+
+    /** Sign msg; aux_rand (32 bytes) is drawn from openssl when not given. */
+    void sign(const bytearray_t &msg, const PrivKeySchnorr &priv_key,
+            const uint8_t *aux_rand = nullptr);
+
+    bool verify(const bytearray_t &msg, const PubKeySchnorr &pub_key) const;
+
+    /** Verify n signatures (packed in sigs) on the same msg at once, by
+     * checking a random linear combination of their equations. */
+    static bool verify_batch(const bytearray_t &msg,
+                            const std::vector<const PubKeySchnorr *> &pub_keys,
+                            const uint8_t *sigs);
+};
+
+class SchnorrVeriTask final: public VeriTask,
+                            public PoolAllocated<SchnorrVeriTask> {
+    uint256_t msg;
+    PubKeySchnorr pubkey;
+    SigSchnorr sig;
+    public:
+    SchnorrVeriTask(const uint256_t &msg,
+                    const PubKeySchnorr &pubkey,
+                    const SigSchnorr &sig):
+        msg(msg), pubkey(pubkey), sig(sig) {}
+    virtual ~SchnorrVeriTask() = default;
+
+    bool verify() override {
+        return sig.verify(msg, pubkey);
+    }
+};
+
+/** Verifies all signatures of a QC in one batch. */
+class SchnorrBatchVeriTask final: public VeriTask,
+                            public PoolAllocated<SchnorrBatchVeriTask> {
+    uint256_t msg;
+    std::vector<PubKeySchnorr> pubkeys;
+    bytearray_t sigs;
+    public:
+    SchnorrBatchVeriTask(const uint256_t &msg,
+                        std::vector<PubKeySchnorr> &&pubkeys,
+                        const bytearray_t &sigs):
+        msg(msg), pubkeys(std::move(pubkeys)), sigs(sigs) {}
+    virtual ~SchnorrBatchVeriTask() = default;
+
+    bool verify() override {
+        std::vector<const PubKeySchnorr *> pks;
+        for (const auto &pk: pubkeys) pks.push_back(&pk);
+        return SigSchnorr::verify_batch(msg, pks, sigs.data());
+    }
+};
+
+class PartCertSchnorr final: public SigSchnorr, public PartCert,
+                            public PoolAllocated<PartCertSchnorr> {
+    uint256_t obj_hash;
+
+    public:
+    PartCertSchnorr() = default;
+    PartCertSchnorr(const PrivKeySchnorr &priv_key, const uint256_t &obj_hash):
+        SigSchnorr(obj_hash, priv_key),
+        PartCert(),
+        obj_hash(obj_hash) {}
+
+    bool verify(const PubKey &pub_key) override {
+        return SigSchnorr::verify(obj_hash,
+                                static_cast<const PubKeySchnorr &>(pub_key));
+    }
+
+    veri_promise_t verify(const PubKey &pub_key, VeriPool &vpool,
+                    const veri_token_t &token) override {
+        return vpool.verify(new SchnorrVeriTask(obj_hash,
+                static_cast<const PubKeySchnorr &>(pub_key),
+                static_cast<const SigSchnorr &>(*this)), token);
+    }
+
+    const uint256_t &get_obj_hash() const override { return obj_hash; }
+
+    PartCertSchnorr *clone() override {
+        return new PartCertSchnorr(*this);
+    }
+
+    void serialize(DataStream &s) const override {
+        s << obj_hash;
+        this->SigSchnorr::serialize(s);
+    }
+
+    void unserialize(DataStream &s) override {
+        s >> obj_hash;
+        this->SigSchnorr::unserialize(s);
+    }
+};
+
+class QuorumCertSchnorr final:
+        public PackedQuorumCert<SigSchnorr::nbytes>,
+        public PoolAllocated<QuorumCertSchnorr> {
+    public:
+    QuorumCertSchnorr() = default;
+    QuorumCertSchnorr(const ReplicaConfig &config, const uint256_t &obj_hash);
+
+    void add_part(ReplicaID rid, const PartCert &pc) override {
+        if (pc.get_obj_hash() != obj_hash)
+            throw std::invalid_argument("PartCert does match the block hash");
+        add_sig(rid, static_cast<const PartCertSchnorr &>(pc).get_data());
+    }
 
     bool verify(const ReplicaConfig &config) override;
-    promise_t verify(const ReplicaConfig &config, VeriPool &vpool) override;
+    veri_promise_t verify(const ReplicaConfig &config, VeriPool &vpool) override;
+
+    QuorumCertSchnorr *clone() override {
+        return new QuorumCertSchnorr(*this);
+    }
+};
+
+
+/* Ed25519 signatures through the OpenSSL EVP interface. */
+
+class PrivKeyEd25519;
+
+class PubKeyEd25519 final: public PubKey {
+    static const auto nbytes = 32;
+    friend class SigEd25519;
+    uint8_t data[nbytes];
+    /** the loaded key, shared by the copies */
+    EVP_PKEY *pkey;
+
+    void load();
+
+    public:
+    PubKeyEd25519(): PubKey(), pkey(nullptr) {}
+
+    PubKeyEd25519(const bytearray_t &raw_bytes):
+        PubKeyEd25519() { from_bytes(raw_bytes); }
+
+    PubKeyEd25519(const PrivKeyEd25519 &priv_key);
+
+    PubKeyEd25519(const PubKeyEd25519 &other): PubKey(), pkey(other.pkey) {
+        memmove(data, other.data, nbytes);
+        if (pkey) EVP_PKEY_up_ref(pkey);
+    }
+
+    PubKeyEd25519 &operator=(const PubKeyEd25519 &) = delete;
+
+    ~PubKeyEd25519() { EVP_PKEY_free(pkey); }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed public key");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+        load();
+    }
+
+    PubKeyEd25519 *clone() override {
+        return new PubKeyEd25519(*this);
+    }
+};
+
+class PrivKeyEd25519 final: public PrivKey {
+    static const auto nbytes = 32;
+    friend class PubKeyEd25519;
+    friend class SigEd25519;
+    uint8_t data[nbytes];
+    EVP_PKEY *pkey;
+
+    void load();
+
+    public:
+    PrivKeyEd25519(): PrivKey(), pkey(nullptr) {}
+
+    PrivKeyEd25519(const bytearray_t &raw_bytes):
+        PrivKeyEd25519() { from_bytes(raw_bytes); }
+
+    PrivKeyEd25519(const PrivKeyEd25519 &other): PrivKey(), pkey(other.pkey) {
+        memmove(data, other.data, nbytes);
+        if (pkey) EVP_PKEY_up_ref(pkey);
+    }
+
+    PrivKeyEd25519 &operator=(const PrivKeyEd25519 &) = delete;
+
+    ~PrivKeyEd25519() { EVP_PKEY_free(pkey); }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed private key");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+        load();
+    }
+
+    void from_rand() override {
+        if (!RAND_bytes(data, nbytes))
+            throw std::runtime_error("cannot get rand bytes from openssl");
+        load();
+    }
+
+    pubkey_bt get_pubkey() const override {
+        return new PubKeyEd25519(*this);
+    }
+};
+
+class SigEd25519: public Serializable {
+    public:
+    static const size_t nbytes = 64;
+
+    private:
+    uint8_t data[nbytes];
+
+    static void check_msg_length(const bytearray_t &msg) {
+        if (msg.size() != 32)
+            throw std::invalid_argument("the message should be 32-bytes");
+    }
+
+    public:
+    SigEd25519(): Serializable() {}
+    SigEd25519(const uint256_t &digest,
+                const PrivKeyEd25519 &priv_key):
+        Serializable() {
+        sign(digest, priv_key);
+    }
+    SigEd25519(const uint8_t *raw): Serializable() {
+        memmove(data, raw, nbytes);
+    }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed signature");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+    }
+
+    const uint8_t *get_data() const { return data; }
+
+    void sign(const bytearray_t &msg, const PrivKeyEd25519 &priv_key);
+    bool verify(const bytearray_t &msg, const PubKeyEd25519 &pub_key) const;
+};
+
+class Ed25519VeriTask final: public VeriTask,
+                            public PoolAllocated<Ed25519VeriTask> {
+    uint256_t msg;
+    PubKeyEd25519 pubkey;
+    SigEd25519 sig;
+    public:
+    Ed25519VeriTask(const uint256_t &msg,
+                    const PubKeyEd25519 &pubkey,
+                    const SigEd25519 &sig):
+        msg(msg), pubkey(pubkey), sig(sig) {}
+    virtual ~Ed25519VeriTask() = default;
+
+    bool verify() override {
+        return sig.verify(msg, pubkey);
+    }
+};
+
+class PartCertEd25519 final: public SigEd25519, public PartCert,
+                            public PoolAllocated<PartCertEd25519> {
+    uint256_t obj_hash;
+
+    public:
+    PartCertEd25519() = default;
+    PartCertEd25519(const PrivKeyEd25519 &priv_key, const uint256_t &obj_hash):
+        SigEd25519(obj_hash, priv_key),
+        PartCert(),
+        obj_hash(obj_hash) {}
+
+    bool verify(const PubKey &pub_key) override {
+        return SigEd25519::verify(obj_hash,
+                                static_cast<const PubKeyEd25519 &>(pub_key));
+    }
+
+    veri_promise_t verify(const PubKey &pub_key, VeriPool &vpool,
+                    const veri_token_t &token) override {
+        return vpool.verify(new Ed25519VeriTask(obj_hash,
+                static_cast<const PubKeyEd25519 &>(pub_key),
+                static_cast<const SigEd25519 &>(*this)), token);
+    }
 
     const uint256_t &get_obj_hash() const override { return obj_hash; }
 
-    QuorumCertSecp256k1 *clone() override {
-        return new QuorumCertSecp256k1(*this);
+    PartCertEd25519 *clone() override {
+        return new PartCertEd25519(*this);
     }
 
     void serialize(DataStream &s) const override {
-        s << obj_hash << rids;
-        for (size_t i = 0; i < rids.size(); i++)
-            if (rids.get(i)) s << sigs.at(i);
+        s << obj_hash;
+        this->SigEd25519::serialize(s);
     }
 
     void unserialize(DataStream &s) override {
-        s >> obj_hash >> rids;
-        for (size_t i = 0; i < rids.size(); i++)
-            if (rids.get(i)) s >> sigs[i];
+        s >> obj_hash;
+        this->SigEd25519::unserialize(s);
+    }
+};
+
+class QuorumCertEd25519 final:
+        public PackedQuorumCert<SigEd25519::nbytes>,
+        public PoolAllocated<QuorumCertEd25519> {
+    public:
+    QuorumCertEd25519() = default;
+    QuorumCertEd25519(const ReplicaConfig &config, const uint256_t &obj_hash);
+
+    void add_part(ReplicaID rid, const PartCert &pc) override {
+        if (pc.get_obj_hash() != obj_hash)
+            throw std::invalid_argument("PartCert does match the block hash");
+        add_sig(rid, static_cast<const PartCertEd25519 &>(pc).get_data());
+    }
+
+    bool verify(const ReplicaConfig &config) override;
+    veri_promise_t verify(const ReplicaConfig &config, VeriPool &vpool) override;
+
+    QuorumCertEd25519 *clone() override {
+        return new QuorumCertEd25519(*this);
     }
 };
 
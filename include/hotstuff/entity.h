@@ -19,7 +19,6 @@
 
 #include <vector>
 #include <unordered_map>
-#include <unordered_set>
 #include <string>
 #include <cstddef>
 #include <ios>
@@ -63,6 +62,8 @@ class ReplicaConfig {
     public:
     size_t nreplicas;
     size_t nmajority;
+    /** QCs already verified against this configuration */
+    mutable VerifiedQCCache verified_qcs;
 
     ReplicaConfig(): nreplicas(0), nmajority(0) {}
 
@@ -98,9 +99,14 @@ class ReplicaConfig {
 };
 
 class Block;
+class BlockWindow;
 class HotStuffCore;
 
-using block_t = salticidae::ArcObj<Block>;
+/** Blocks are only handled on the consensus thread, so their handles count
+ * the references without atomics. */
+using block_t = salticidae::RcObj<Block>;
+/** A block handed to another thread (see HotStuffCore::share_blk()). */
+using shared_block_t = salticidae::ArcObj<const Block>;
 
 class Command: public Serializable {
     friend HotStuffCore;
@@ -117,80 +123,151 @@ class Command: public Serializable {
 
 using command_t = ArcObj<Command>;
 
-template<typename Hashable>
-inline static std::vector<uint256_t>
-get_hashes(const std::vector<Hashable> &plist) {
-    std::vector<uint256_t> hashes;
+/** blocks recycled through the free list: a batch of pruned blocks fits */
+const size_t blk_pool_max = 1024;
+
+/** The lists held by a block: there is one parent and one command hash
+ * (that of the batch of commands) but for the genesis block. */
+using blk_hash_list_t = SmallVec<uint256_t, 1>;
+using blk_list_t = SmallVec<block_t, 1>;
+
+template<typename List>
+inline static blk_hash_list_t
+get_hashes(const List &plist) {
+    blk_hash_list_t hashes;
     for (const auto &p: plist)
         hashes.push_back(p->get_hash());
     return hashes;
 }
 
-class Block {
+/** The replicas that have voted for a block, as a bit per replica (their
+ * IDs are dense, below nreplicas) and a count. Up to 64 replicas fit in
+ * the block itself. */
+class VoteSet {
+    SmallVec<uint64_t, 1> words;
+    size_t cnt;
+
+    public:
+    VoteSet(): cnt(0) {}
+
+    /** Add rid, out of nreplicas replicas.
+     * @return false if rid was already there */
+    bool insert(ReplicaID rid, size_t nreplicas) {
+        size_t w = rid >> 6;
+        if (w >= words.size())
+            words.resize(std::max(w + 1, (nreplicas + 63) >> 6));
+        uint64_t bit = uint64_t(1) << (rid & 63);
+        if (words[w] & bit) return false;
+        words[w] |= bit;
+        cnt++;
+        return true;
+    }
+
+    bool contains(ReplicaID rid) const {
+        size_t w = rid >> 6;
+        return w < words.size() && (words[w] >> (rid & 63) & 1);
+    }
+
+    /** Remove rid.
+     * @return false if rid was not there */
+    bool erase(ReplicaID rid) {
+        if (!contains(rid)) return false;
+        words[rid >> 6] &= ~(uint64_t(1) << (rid & 63));
+        cnt--;
+        return true;
+    }
+
+    size_t size() const { return cnt; }
+
+    void clear() {
+        words = SmallVec<uint64_t, 1>();
+        cnt = 0;
+    }
+};
+
+/** Blocks are made and dropped at the rate of the commits, so their memory
+ * goes back to a free list and the next block takes it. */
+class Block: public PoolAllocated<Block, blk_pool_max> {
     friend HotStuffCore;
-    std::vector<uint256_t> parent_hashes;
-    std::vector<uint256_t> cmds;
+    friend BlockWindow;
+    blk_hash_list_t parent_hashes;
+    blk_hash_list_t cmds;
     quorum_cert_bt qc;
     bytearray_t extra;
+    /** proposed by a replica with fast-commit on, which only the replicas
+     * with the same setting vote for (see HotStuffCore::set_fast_commit()) */
+    bool fast_commit;
 
     /* the following fields can be derived from above */
     uint256_t hash;
-    std::vector<block_t> parents;
+    blk_list_t parents;
     block_t qc_ref;
     quorum_cert_bt self_qc;
     uint32_t height;
     bool delivered;
     int8_t decision;
+    /** ancestor at get_skip_height(height), set by the block window; not
+     * owned, so only followed where the chain keeps it alive */
+    const Block *skip;
 
-    std::unordered_set<ReplicaID> voted;
+    VoteSet voted;
 
     public:
     Block():
         qc(nullptr),
+        fast_commit(false),
         qc_ref(nullptr),
         self_qc(nullptr), height(0),
-        delivered(false), decision(0) {}
+        delivered(false), decision(0), skip(nullptr) {}
 
     Block(bool delivered, int8_t decision):
         qc(new QuorumCertDummy()),
+        fast_commit(false),
         hash(salticidae::get_hash(*this)),
         qc_ref(nullptr),
         self_qc(nullptr), height(0),
-        delivered(delivered), decision(decision) {}
+        delivered(delivered), decision(decision), skip(nullptr) {}
 
-    Block(const std::vector<block_t> &parents,
-        const std::vector<uint256_t> &cmds,
+    Block(const blk_list_t &parents,
+        const blk_hash_list_t &cmds,
         quorum_cert_bt &&qc,
         bytearray_t &&extra,
         uint32_t height,
         const block_t &qc_ref,
         quorum_cert_bt &&self_qc,
-        int8_t decision = 0):
+        int8_t decision = 0,
+        bool fast_commit = false):
             parent_hashes(get_hashes(parents)),
             cmds(cmds),
             qc(std::move(qc)),
             extra(std::move(extra)),
+            fast_commit(fast_commit),
             hash(salticidae::get_hash(*this)),
             parents(parents),
             qc_ref(qc_ref),
             self_qc(std::move(self_qc)),
             height(height),
             delivered(0),
-            decision(decision) {}
+            decision(decision),
+            skip(nullptr) {}
 
     void serialize(DataStream &s) const;
 
     void unserialize(DataStream &s, HotStuffCore *hsc);
 
-    const std::vector<uint256_t> &get_cmds() const {
+    /** A copy of the block without its links to other blocks, whose handles
+     * must stay on the consensus thread. */
+    shared_block_t detach() const;
+
+    const blk_hash_list_t &get_cmds() const {
         return cmds;
     }
 
-    const std::vector<block_t> &get_parents() const {
+    const blk_list_t &get_parents() const {
         return parents;
     }
 
-    const std::vector<uint256_t> &get_parent_hashes() const {
+    const blk_hash_list_t &get_parent_hashes() const {
         return parent_hashes;
     }
 
@@ -198,7 +275,7 @@ class Block {
 
     bool verify(const HotStuffCore *hsc) const;
 
-    promise_t verify(const HotStuffCore *hsc, VeriPool &vpool) const;
+    veri_promise_t verify(const HotStuffCore *hsc, VeriPool &vpool) const;
 
     int8_t get_decision() const { return decision; }
 
@@ -212,6 +289,8 @@ class Block {
 
     const bytearray_t &get_extra() const { return extra; }
 
+    bool is_fast_commit() const { return fast_commit; }
+
     operator std::string () const {
         DataStream s;
         s << "<block "
@@ -312,6 +391,147 @@ class EntityStorage {
     }
 };
 
+/** initial number of heights the block window spans */
+const uint32_t blk_window_cap = 64;
+/** heights searched by hash, from the highest down */
+const uint32_t blk_window_find_depth = 8;
+
+/** Height of the ancestor a block at height keeps a skip pointer to. The
+ * skip pointers of a chain form a skip list (as in Bitcoin's block index):
+ * any ancestor is reached in O(log h) steps. */
+inline uint32_t get_skip_height(uint32_t height) {
+    auto clear_lowest = [](uint32_t n) { return n & (n - 1); };
+    if (height < 2) return 0;
+    return height & 1 ? clear_lowest(clear_lowest(height - 1)) + 1 :
+                        clear_lowest(height);
+}
+
+/** The delivered blocks from the last executed one up, in a ring with a
+ * slot per height holding the blocks (forks) of that height. The blocks
+ * near the tip are found without going through the storage's hash map, and
+ * above the highest fork the chain is read straight off the slots. Lower,
+ * the ancestors are reached through the skip pointers of the blocks.
+ *
+ * Every delivered block at or above the base height is held; the ring
+ * grows when the uncommitted chain gets longer than it. The chain from a
+ * held block down to the base is never pruned, so the skip pointers within
+ * the window are safe to follow. */
+class BlockWindow {
+    std::vector<blk_list_t> slots;
+    /** lowest height held */
+    uint32_t base;
+    /** one past the highest height held */
+    uint32_t top;
+    /** one past the highest height holding more than one block */
+    uint32_t fork_end;
+
+    blk_list_t &slot(uint32_t height) {
+        return slots[height & (slots.size() - 1)];
+    }
+
+    const blk_list_t &slot(uint32_t height) const {
+        return slots[height & (slots.size() - 1)];
+    }
+
+    void grow(uint32_t height) {
+        size_t cap = slots.size();
+        while (height - base >= cap) cap <<= 1;
+        std::vector<blk_list_t> nslots(cap);
+        for (uint32_t h = base; h < top; h++)
+            nslots[h & (cap - 1)] = std::move(slot(h));
+        slots = std::move(nslots);
+    }
+
+    bool holds(const Block *blk) const {
+        if (blk->height < base || blk->height >= top) return false;
+        for (const auto &b: slot(blk->height))
+            if (b.get() == blk) return true;
+        return false;
+    }
+
+    public:
+    BlockWindow(): slots(blk_window_cap), base(0), top(0), fork_end(0) {}
+
+    uint32_t get_base() const { return base; }
+    /** One past the highest height held. */
+    uint32_t get_top() const { return top; }
+
+    /** The blocks held at height, which must be in [base, top). */
+    const blk_list_t &get_blks(uint32_t height) const { return slot(height); }
+
+    /** Hold blk, which has just been delivered (a block below the base is
+     * left out). */
+    void add(const block_t &blk) {
+        uint32_t height = blk->height;
+        if (height < base) return;
+        if (height - base >= slots.size()) grow(height);
+        auto &s = slot(height);
+        if (!s.empty()) fork_end = std::max(fork_end, height + 1);
+        s.push_back(blk);
+        top = std::max(top, height + 1);
+        /* a skip below the base would never be followed */
+        uint32_t skip_height = get_skip_height(height);
+        if (!blk->parents.empty() && skip_height >= base)
+            blk->skip = get_ancestor(blk->parents[0].get(), skip_height);
+    }
+
+    /** Drop the blocks below height. */
+    void advance(uint32_t height) {
+        if (height <= base) return;
+        for (uint32_t h = base; h < std::min(height, top); h++)
+            slot(h).clear();
+        base = height;
+        top = std::max(top, base);
+    }
+
+    /** The block of blk_hash, if it is among the few highest ones. */
+    block_t find(const uint256_t &blk_hash) const {
+        uint32_t low = top - std::min(top - base, blk_window_find_depth);
+        for (uint32_t h = top; h-- > low;)
+            for (const auto &blk: slot(h))
+                if (blk->get_hash() == blk_hash) return blk;
+        return nullptr;
+    }
+
+    /** The ancestor of blk at height (blk itself at its own height), or
+     * nullptr if it is not known. */
+    const Block *get_ancestor(const Block *blk, uint32_t height) const {
+        if (height > blk->height) return nullptr;
+        /* the skip pointers are followed down to the base at most */
+        uint32_t low = std::max(height, base);
+        if (blk->height > low && holds(blk))
+        {
+            /* all heights from fork_end up hold a single block, so they are
+             * the ancestors of the one held at the top */
+            if (low >= fork_end) blk = slot(low).front().get();
+            while (blk->height > low)
+            {
+                uint32_t hskip = get_skip_height(blk->height);
+                uint32_t hskip_prev = get_skip_height(blk->height - 1);
+                /* take the skip unless the parent's one lands closer */
+                if (blk->skip && (hskip == low || (hskip > low &&
+                        !(hskip_prev + 2 < hskip && hskip_prev >= low))))
+                    blk = blk->skip;
+                else if (!blk->parents.empty())
+                    blk = blk->parents[0].get();
+                else
+                    return nullptr;
+            }
+        }
+        while (blk->height > height)
+        {
+            if (blk->parents.empty()) return nullptr;
+            blk = blk->parents[0].get();
+        }
+        return blk;
+    }
+
+    /** Whether a is b or one of its ancestors. */
+    bool is_ancestor(const block_t &a, const block_t &b) const {
+        return get_ancestor(b.get(), a->height) == a.get();
+    }
+};
+
 }
 
 #endif
@@ -18,6 +18,11 @@
 #ifndef _HOTSTUFF_CORE_H
 #define _HOTSTUFF_CORE_H
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <optional>
 #include <queue>
 #include <unordered_map>
 #include <unordered_set>
@@ -27,6 +32,9 @@
 #include "salticidae/msg.h"
 #include "hotstuff/util.h"
 #include "hotstuff/consensus.h"
+#include "hotstuff/wal.h"
+#include "hotstuff/ledger.h"
+#include "hotstuff/checkpoint.h"
 
 namespace hotstuff {
 
@@ -37,6 +45,33 @@ using salticidae::_2;
 
 const double ent_waiting_timeout = 10;
 const double double_inf = 1e10;
+/** most blocks asked for or sent in one range fetch */
+const uint32_t blk_range_max = 128;
+/** bounds of the delay before asking a second replica for an entity, and
+ * of the time to wait for any answer before asking all of them */
+const double fetch_hedge_min = 0.005;
+const double fetch_hedge_default = 0.1;
+const double fetch_timeout_min = 0.1;
+/** committed blocks restored below b_exec after a restart, which the QCs
+ * of the blocks above may refer to */
+const uint32_t recover_depth = 8;
+/** snapshot chunks asked for at a time during a state transfer */
+const uint32_t snapshot_fetch_window = 4;
+/** checkpoints above the stable one whose votes are collected; beyond them
+ * only the latest vote of each replica is kept */
+const uint32_t ckpt_vote_window = 4;
+/** committed heights kept in memory below b_exec by default, when a ledger
+ * or checkpoints can serve the older ones */
+const uint32_t prune_retention_default = 4096;
+/** size of the safety log past which it is compacted as b_exec advances,
+ * once it has also doubled since the last compaction */
+const size_t safety_log_compact_size = 64 << 20;
+/** blocks not delivered yet for which votes are held at a time, and the
+ * commits after which the votes of such a block are dropped */
+const size_t vote_ingest_undelivered_max = 1024;
+const uint32_t vote_ingest_expiry = 16;
+/** most blocks pruned in one iteration of the event loop */
+const size_t prune_batch = 256;
 
 /** Network message format for HotStuff. */
 struct MsgPropose {
@@ -73,11 +108,79 @@ struct MsgRespBlock {
     static const opcode_t opcode = 0x3;
     DataStream serialized;
     std::vector<block_t> blks;
-    MsgRespBlock(const std::vector<block_t> &blks);
+    /** blobs are blocks already serialized, sent after blks */
+    MsgRespBlock(const std::vector<block_t> &blks,
+                const std::vector<Ledger::blob_t> &blobs = {});
     MsgRespBlock(DataStream &&s): serialized(std::move(s)) {}
     void postponed_parse(HotStuffCore *hsc);
 };
 
+/** Request for a run of blocks: a block and up to nblks - 1 of its ancestors
+ * (following the first parent), or the blocks of the committed chain whose
+ * heights are in [from_height, to_height]. */
+struct MsgReqBlockRange {
+    static const opcode_t opcode = 0x5;
+    enum RangeType: uint8_t {
+        RANGE_ANCESTORS = 0x0,
+        RANGE_HEIGHTS = 0x1
+    };
+    DataStream serialized;
+    RangeType type;
+    uint256_t blk_hash;
+    uint32_t nblks;
+    uint32_t from_height;
+    uint32_t to_height;
+    MsgReqBlockRange(const uint256_t &blk_hash, uint32_t nblks);
+    MsgReqBlockRange(uint32_t from_height, uint32_t to_height);
+    MsgReqBlockRange(DataStream &&s);
+};
+
+/** Blocks answering MsgReqBlockRange, oldest first. */
+struct MsgRespBlockRange {
+    static const opcode_t opcode = 0x6;
+    DataStream serialized;
+    std::vector<block_t> blks;
+    /** blobs are serialized blocks older than blks, so sent before them */
+    MsgRespBlockRange(const std::vector<block_t> &blks,
+                    const std::vector<Ledger::blob_t> &blobs = {});
+    MsgRespBlockRange(DataStream &&s): serialized(std::move(s)) {}
+    void postponed_parse(HotStuffCore *hsc);
+};
+
+/** Vote of a replica for the checkpoint it has made at height, with the
+ * digest of the checkpoint in place of the block hash. */
+struct MsgCheckpointVote {
+    static const opcode_t opcode = 0x7;
+    DataStream serialized;
+    uint32_t height;
+    Vote vote;
+    MsgCheckpointVote(uint32_t height, const Vote &vote);
+    MsgCheckpointVote(DataStream &&s): serialized(std::move(s)) {}
+    void postponed_parse(HotStuffCore *hsc);
+};
+
+/** Request for the manifest or a chunk of the stable checkpoint at height. */
+struct MsgReqSnapshot {
+    static const opcode_t opcode = 0x8;
+    static const uint32_t manifest = UINT32_MAX;
+    DataStream serialized;
+    uint32_t height;
+    uint32_t chunk;
+    MsgReqSnapshot(uint32_t height, uint32_t chunk);
+    MsgReqSnapshot(DataStream &&s);
+};
+
+/** The manifest of a checkpoint (block hash, snapshot size and chunk
+ * hashes) or one of its chunks, left in serialized after the header. */
+struct MsgRespSnapshot {
+    static const opcode_t opcode = 0x9;
+    DataStream serialized;
+    uint32_t height;
+    uint32_t chunk;
+    MsgRespSnapshot(const Checkpoint &ckpt, uint32_t chunk);
+    MsgRespSnapshot(DataStream &&s);
+};
+
 struct MsgSlice {
     static const opcode_t opcode = 0x4;
     DataStream serialized;
@@ -90,9 +193,162 @@ struct MsgSlice {
 
 using mypromise::promise_t;
 
+/** Votes for one block on their way to HotStuffCore::on_receive_vote(). */
+struct VoteIngestContext {
+    /** voters whose vote has been verified */
+    VoteSet verified;
+    /** voters with a vote not yet verified, by the peer it came from: a
+     * forged vote only holds back the later ones from the same peer, and
+     * only until it fails verification. The votes sent by the voters
+     * themselves, nearly all of them, are kept apart in a bitmap. */
+    VoteSet candidates_direct;
+    std::unordered_map<PeerId, VoteSet> candidates_relayed;
+    /** votes held back while enough of them are being verified */
+    std::queue<std::pair<BoxObj<Vote>, PeerId>> deferred;
+    /** number of votes being verified */
+    size_t nverifying;
+    /** set to drop the pending verifications once the QC is finished */
+    veri_token_t token;
+    /** whether the block has been delivered */
+    bool delivered;
+    VoteIngestContext(): nverifying(0), token(new std::atomic<bool>(false)),
+                        delivered(false) {}
+
+    /** the voters with a vote from peer not yet verified */
+    VoteSet &get_candidates(const PeerId &peer, bool direct) {
+        return direct ? candidates_direct : candidates_relayed[peer];
+    }
+
+    size_t get_ncandidates() const {
+        size_t n = candidates_direct.size();
+        for (const auto &c: candidates_relayed) n += c.second.size();
+        return n;
+    }
+};
+
+/** Checkpoint votes for one digest at one height. */
+struct CheckpointVotes {
+    std::unordered_set<ReplicaID> voters;
+    quorum_cert_bt qc;
+    CheckpointVotes(): qc(nullptr) {}
+};
+
+/** Checkpoint votes at one height, with one digest per voter. */
+struct CheckpointHeightVotes {
+    std::unordered_set<ReplicaID> voters;
+    std::unordered_map<const uint256_t, CheckpointVotes> digests;
+};
+
+/** Fetching of a certified checkpoint from the replicas that made it. */
+struct SnapshotTransfer {
+    uint32_t height;
+    uint256_t digest;
+    quorum_cert_bt qc;
+    std::vector<PeerId> replicas;
+    /** the replica asked now */
+    size_t replica_idx;
+    bool has_manifest;
+    uint256_t blk_hash;
+    bytearray_t data;
+    std::vector<uint256_t> chunk_hashes;
+    std::vector<bool> received;
+    uint32_t nreceived;
+    /** chunks below it have been asked for */
+    uint32_t next_chunk;
+    /** whether the snapshot is complete and its block is being fetched */
+    bool fetching_blk;
+    /** replicas asked for the block so far */
+    size_t nblk_asked;
+    TimerEvent timeout;
+    ElapsedTime elapsed;
+
+    SnapshotTransfer(uint32_t height, const uint256_t &digest,
+                    quorum_cert_bt &&qc, std::vector<PeerId> &&replicas):
+            height(height), digest(digest), qc(std::move(qc)),
+            replicas(std::move(replicas)), replica_idx(0),
+            has_manifest(false), nreceived(0), next_chunk(0),
+            fetching_blk(false), nblk_asked(0) {
+        elapsed.start();
+    }
+};
+
 class HotStuffBase;
 using pacemaker_bt = BoxObj<class PaceMaker>;
 
+/** Monotonic time in seconds, for measuring fetch round trips. */
+inline double fetch_clock() {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Round trips of the fetches answered by a replica. */
+struct PeerFetchStat {
+    /** smoothed round-trip time and its mean deviation, as in TCP */
+    double srtt;
+    double rttvar;
+    /** fetches it was asked for and did not answer in time, since its last
+     * answer */
+    uint32_t nmissed;
+
+    PeerFetchStat(): srtt(0), rttvar(0), nmissed(0) {}
+
+    void add_sample(double rtt) {
+        if (srtt == 0)
+        {
+            srtt = rtt;
+            rttvar = rtt / 2;
+        }
+        else
+        {
+            rttvar = 0.75 * rttvar + 0.25 * std::fabs(srtt - rtt);
+            srtt = 0.875 * srtt + 0.125 * rtt;
+        }
+        nmissed = 0;
+    }
+
+    /** Expected time to answer (lower is better), doubled for each recent
+     * miss. */
+    double get_score(double unknown) const {
+        double t = srtt == 0 ? unknown : srtt + 4 * rttvar;
+        return t * (1 << std::min(nmissed, (uint32_t)10));
+    }
+};
+
+/** Recent fetch round trips over all replicas, which set how long to wait
+ * before hedging a fetch to a second replica (about the 90th percentile)
+ * and before giving up on the asked ones (a multiple of the 99th). */
+class FetchLatency {
+    static constexpr size_t nsamples = 128;
+    /* percentiles are not trusted with fewer samples */
+    static constexpr size_t nsamples_min = 16;
+    double samples[nsamples];
+    size_t nadded;
+    double hedge_delay;
+    double timeout;
+
+    public:
+    FetchLatency(): nadded(0),
+        hedge_delay(fetch_hedge_default), timeout(ent_waiting_timeout) {}
+
+    void add(double rtt) {
+        samples[nadded++ % nsamples] = rtt;
+        size_t n = std::min(nadded, nsamples);
+        if (n < nsamples_min) return;
+        double sorted[nsamples];
+        std::copy(samples, samples + n, sorted);
+        auto p90 = sorted + n * 9 / 10;
+        auto p99 = sorted + n * 99 / 100;
+        std::nth_element(sorted, p99, sorted + n);
+        std::nth_element(sorted, p90, p99);
+        timeout = std::min(std::max(4 * *p99, fetch_timeout_min),
+                            ent_waiting_timeout);
+        hedge_delay = std::min(std::max(*p90, fetch_hedge_min), timeout);
+    }
+
+    double get_hedge_delay() const { return hedge_delay; }
+    double get_timeout() const { return timeout; }
+};
+
 template<EntityType ent_type>
 class FetchContext: public promise_t {
     TimerEvent timeout;
@@ -100,7 +356,13 @@ class FetchContext: public promise_t {
     MsgReqBlock fetch_msg;
     const uint256_t ent_hash;
     std::unordered_set<PeerId> replicas;
+    /** replicas asked so far, with the time of the first request */
+    std::unordered_map<PeerId, double> asked;
+    /** whether a second replica has been asked */
+    bool hedged;
     inline void timeout_cb(TimerEvent &);
+    /** the best-ranked replica not asked yet */
+    inline const PeerId *pick_replica() const;
     public:
     FetchContext(const FetchContext &) = delete;
     FetchContext &operator=(const FetchContext &) = delete;
@@ -112,20 +374,34 @@ class FetchContext: public promise_t {
     inline void send(const PeerId &replica);
     inline void reset_timeout();
     inline void add_replica(const PeerId &replica, bool fetch_now = true);
+    /** Record the round trip of the request answered by replica. */
+    inline void on_response(const PeerId &replica);
 };
 
-class BlockDeliveryContext: public promise_t {
+/** Promise of a block, resolved once it is delivered. */
+using deliver_promise_t = lwpromise::promise<block_t>;
+
+/** A delivery under way; dropping it leaves its continuations pending,
+ * which are then never run. */
+class BlockDeliveryContext: public deliver_promise_t {
     public:
     ElapsedTime elapsed;
+    /** the block, once fetched */
+    block_t blk;
+    /** the replica asked for the block and its missing ancestors */
+    PeerId replica;
+    /** number of parents, QC block fetch and QC check still awaited */
+    size_t nwaiting;
+    /** result of the QC check */
+    bool valid;
+    /** blocks waiting for this one to be delivered */
+    std::vector<uint256_t> dependents;
+
     BlockDeliveryContext &operator=(const BlockDeliveryContext &) = delete;
-    BlockDeliveryContext(const BlockDeliveryContext &other):
-        promise_t(static_cast<const promise_t &>(other)),
-        elapsed(other.elapsed) {}
-    BlockDeliveryContext(BlockDeliveryContext &&other):
-        promise_t(static_cast<const promise_t &>(other)),
-        elapsed(std::move(other.elapsed)) {}
-    template<typename Func>
-    BlockDeliveryContext(Func callback): promise_t(callback) {
+    BlockDeliveryContext(const BlockDeliveryContext &) = default;
+    BlockDeliveryContext(BlockDeliveryContext &&) = default;
+    BlockDeliveryContext(const PeerId &replica):
+            replica(replica), nwaiting(0), valid(true) {
         elapsed.start();
     }
 };
@@ -153,6 +429,22 @@ class HotStuffBase: public HotStuffCore {
     salticidae::ThreadCall tcall;
     VeriPool vpool;
     std::vector<PeerId> peers;
+    /** durable safety state, if enabled */
+    BoxObj<SafetyLog> safety_log;
+    std::string safety_log_path;
+    /** hash and height of the block last voted for, as logged */
+    std::optional<std::pair<uint256_t, uint32_t>> voted;
+    /** committed chain on disk, if enabled */
+    BoxObj<Ledger> ledger;
+    /** commits between two checkpoints, 0 if disabled */
+    uint32_t ckpt_interval;
+    /** the latest checkpoint made, until it is certified */
+    BoxObj<Checkpoint> pending_ckpt;
+    /** the latest certified checkpoint, served to the other replicas */
+    BoxObj<Checkpoint> stable_ckpt;
+    /** whether the commands of some committed blocks were lost in a crash:
+     * nothing is executed until a state transfer replaces the state */
+    bool state_lost;
 
     private:
     /** whether libevent handle is owned by itself */
@@ -167,12 +459,54 @@ class HotStuffBase: public HotStuffCore {
     /* queues for async tasks */
     std::unordered_map<const uint256_t, BlockFetchContext> blk_fetch_waiting;
     std::unordered_map<const uint256_t, BlockDeliveryContext> blk_delivery_waiting;
+    /** Steps of block delivery not yet taken: the block has been fetched
+     * (true) or one more thing it waits for is done (false). They are run
+     * by a loop, so delivering a long chain of ancestors takes constant
+     * stack rather than a nested promise resolution per block. */
+    std::queue<std::pair<uint256_t, bool>> delivery_steps;
+    bool delivery_running;
     std::unordered_map<const uint256_t, commit_cb_t> decision_waiting;
+    std::unordered_map<const uint256_t, VoteIngestContext> vote_ingest;
+    /** blocks whose votes came before them, with the height of b_exec then */
+    std::queue<std::pair<uint32_t, uint256_t>> vote_ingest_undelivered;
+    /** blocks pruned lately, with the height of b_exec then: late votes for
+     * them are dropped rather than waiting for a delivery that would have
+     * to fetch the pruned history again */
+    std::unordered_set<uint256_t> vote_ingest_pruned;
+    std::queue<std::pair<uint32_t, uint256_t>> vote_ingest_pruned_queue;
+    std::unordered_map<const uint256_t, TimerEvent> fast_qc_timers;
+    /** proposing time of the blocks proposed by itself */
+    std::unordered_map<const uint256_t, ElapsedTime> commit_timers;
+    /** hashes of the committed blocks in memory, by height */
+    std::unordered_map<uint32_t, uint256_t> exec_hashes;
+    /** time to wait for the rest of the votes in the fast path */
+    double fast_qc_timeout;
+    /** committed heights kept below b_exec, 0 to keep all */
+    uint32_t prune_retention;
+    /** whether set_prune() was called, or prune_retention is the default */
+    bool prune_set;
+    /** blocks kept in memory beyond which only recover_depth heights are
+     * kept below b_exec, 0 for no limit */
+    size_t prune_blk_max;
+    TimerEvent prune_timer;
+    bool prune_scheduled;
     using cmd_queue_t = salticidae::MPSCQueueEventDriven<std::pair<uint256_t, commit_cb_t>>;
     cmd_queue_t cmd_pending;
     std::queue<uint256_t> cmd_pending_buffer;
+    /** checkpoint votes received, by height and digest */
+    std::map<uint32_t, CheckpointHeightVotes> ckpt_votes;
+    /** the latest checkpoint vote of each replica beyond ckpt_vote_window,
+     * by which a replica far behind learns of a certified checkpoint */
+    std::unordered_map<ReplicaID, std::pair<uint32_t, Vote>> ckpt_votes_ahead;
+    /** the state transfer under way, if any */
+    BoxObj<SnapshotTransfer> transfer;
 
     /* statistics */
+    /** when start() was called, to time the first vote after a restart */
+    double start_time;
+    bool first_vote_sent;
+    /** time from start() to the first vote sent */
+    double first_vote_delay;
     uint64_t fetched;
     uint64_t delivered;
     mutable uint64_t nsent;
@@ -186,11 +520,72 @@ class HotStuffBase: public HotStuffCore {
     mutable double part_delivery_time;
     mutable double part_delivery_time_min;
     mutable double part_delivery_time_max;
+    mutable uint32_t part_committed;
+    mutable double part_commit_time;
+    mutable double part_commit_time_min;
+    mutable double part_commit_time_max;
+    mutable uint32_t part_vote_verified;
+    mutable uint32_t part_vote_dropped;
+    mutable uint32_t part_pruned;
     mutable std::unordered_map<const PeerId, uint32_t> part_fetched_replica;
+    /** responsiveness of each replica to fetches, to rank them */
+    std::unordered_map<const PeerId, PeerFetchStat> fetch_stats;
+    FetchLatency fetch_latency;
+
+    double get_fetch_score(const PeerId &replica) const {
+        auto it = fetch_stats.find(replica);
+        /* a replica not heard from yet is taken as a typical one */
+        double unknown = fetch_latency.get_hedge_delay();
+        return it == fetch_stats.end() ? unknown : it->second.get_score(unknown);
+    }
 
     void on_fetch_cmd(const command_t &cmd);
-    void on_fetch_blk(const block_t &blk);
+    /** replica is the one that sent the block, if known */
+    void on_fetch_blk(const block_t &blk, const PeerId *replica = nullptr);
     bool on_deliver_blk(const block_t &blk);
+    /** verify only as many votes as the QC of blk still needs */
+    void ingest_vote(const block_t &blk, BoxObj<Vote> &&v, const PeerId &peer);
+    void verify_vote(const block_t &blk, VoteIngestContext &ctx,
+                    BoxObj<Vote> &&v, const PeerId &peer);
+    /** Whether the votes for a block not delivered are of no use: the
+     * block has been pruned lately, or is committed in the ledger. */
+    bool is_vote_stale(const uint256_t &blk_hash) const;
+    /** Drop the votes of the blocks that have not been delivered for
+     * vote_ingest_expiry commits, and forget the blocks pruned as long
+     * ago. */
+    void expire_vote_ingest();
+    void drain_votes(const block_t &blk);
+    /** Take delivery steps until there are none left (reentrant calls
+     * leave the new steps to the running loop). */
+    void run_delivery();
+    void expand_delivery(BlockDeliveryContext &ctx);
+    /** Prune some stale blocks in the next iteration of the event loop. */
+    void schedule_prune();
+    /** Resume from the safety log and the ledger, if any, and start a new
+     * safety log holding only what is needed to resume again. */
+    void recover();
+    /** Records of the safety state as it is now, from which recover()
+     * restores the same state. */
+    std::vector<SafetyLog::record_t> get_safety_records();
+    /** Take a snapshot after blk and vote for it. */
+    void make_checkpoint(const block_t &blk);
+    void on_checkpoint_vote(uint32_t height, const Vote &vote);
+    /** Keep a vote for a checkpoint beyond ckpt_vote_window, in place of
+     * the older one of the voter. */
+    void on_checkpoint_vote_ahead(uint32_t height, const Vote &vote);
+    /** Act on the QC of the checkpoint at height with digest: make ours
+     * stable or, if far behind, fetch it. */
+    void on_checkpoint_certified(uint32_t height, const uint256_t &digest);
+    void set_stable_checkpoint(BoxObj<Checkpoint> &&ckpt);
+    void start_transfer(uint32_t height, const uint256_t &digest);
+    /** Ask the current replica for what is still missing. */
+    void request_snapshot();
+    void finish_transfer();
+    /** Settle the deliveries under way of blk, restored at height, and drop
+     * those of the blocks below it, which are no longer needed. */
+    void settle_deliveries(const block_t &blk, uint32_t height);
+    bytearray_t encode_checkpoint(const Checkpoint &ckpt) const;
+    BoxObj<Checkpoint> decode_checkpoint(const bytearray_t &data);
 
     /** deliver consensus message: <propose> */
     inline void propose_handler(MsgPropose &&, const Net::conn_t &);
@@ -200,6 +595,16 @@ class HotStuffBase: public HotStuffCore {
     inline void req_blk_handler(MsgReqBlock &&, const Net::conn_t &);
     /** receives a block */
     inline void resp_blk_handler(MsgRespBlock &&, const Net::conn_t &);
+    /** sends a run of ancestors or committed blocks */
+    inline void req_blk_range_handler(MsgReqBlockRange &&, const Net::conn_t &);
+    /** receives a run of blocks */
+    inline void resp_blk_range_handler(MsgRespBlockRange &&, const Net::conn_t &);
+    /** collects the votes for a checkpoint */
+    inline void ckpt_vote_handler(MsgCheckpointVote &&, const Net::conn_t &);
+    /** sends a piece of the stable checkpoint */
+    inline void req_snapshot_handler(MsgReqSnapshot &&, const Net::conn_t &);
+    /** receives a piece of the checkpoint being fetched */
+    inline void resp_snapshot_handler(MsgRespSnapshot &&, const Net::conn_t &);
     /**  deliver consensus message: <slice>*/
     inline void slice_handler(MsgSlice &&, const Net::conn_t &);
 
@@ -209,14 +614,33 @@ class HotStuffBase: public HotStuffCore {
     void do_broadcast_proposal(const Proposal &) override;
     void do_broadcast_proposal_with_slice(const std::vector<Proposal> &) override;
     void do_vote(ReplicaID, const Vote &) override;
+    void do_fast_qc_wait(const block_t &blk) override;
     void do_decide(Finality &&) override;
     void do_consensus(const block_t &blk) override;
+    void do_prune(const block_t &blk) override;
+    void do_persist_blk(const block_t &blk) override;
+    void do_persist_vote(const block_t &blk) override;
+    void do_persist_b_lock(const block_t &blk) override;
+    void do_persist_b_exec(const block_t &blk) override;
+    void do_persist_hqc(const block_t &blk, const QuorumCert &qc) override;
+    void do_persist_commit(const block_t &blk, const std::vector<uint256_t> &cmds) override;
 
     protected:
 
     /** Called to replicate the execution of a command, the application should
      * implement this to make transition for the application state. */
     virtual void state_machine_execute(const Finality &) = 0;
+    /** Called once the commands of the committed block at height (every
+     * checkpoint interval) have been executed. The application puts a
+     * snapshot of its state in snapshot, or returns false if it cannot. */
+    virtual bool state_machine_snapshot(uint32_t /*height*/, bytearray_t &/*snapshot*/) {
+        return false;
+    }
+    /** Called to replace the application state by the snapshot taken at
+     * height, after a state transfer or a restart; the commands committed
+     * after height are executed next. */
+    virtual void state_machine_restore(uint32_t /*height*/,
+                                    const bytearray_t &/*snapshot*/) {}
 
     public:
     HotStuffBase(uint32_t blk_size,
@@ -226,7 +650,8 @@ class HotStuffBase: public HotStuffCore {
             pacemaker_bt pmaker,
             EventContext ec,
             size_t nworker,
-            const Net::Config &netconfig);
+            const Net::Config &netconfig,
+            uint8_t nchain = 3);
 
     ~HotStuffBase();
 
@@ -237,6 +662,42 @@ class HotStuffBase: public HotStuffCore {
     void start(std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> &&replicas,
                 bool ec_loop = false);
 
+    /** Set the time to wait for all votes when the fast commit is enabled. */
+    void set_fast_qc_timeout(double t) { fast_qc_timeout = t; }
+    /** Keep the blocks of the last retention committed heights below
+     * b_exec in memory (0 to keep them all), or only the last
+     * recover_depth ones while more than blk_max blocks are held (0 for no
+     * limit). Older blocks are released a few at a time as the chain is
+     * committed; from then on they are served from the ledger only.
+     * Without a call, prune_retention_default heights are kept if a ledger
+     * or checkpoints are set up by start(), and all of them otherwise. */
+    void set_prune(uint32_t retention, size_t blk_max = 0) {
+        prune_retention = retention;
+        prune_blk_max = blk_max;
+        prune_set = true;
+    }
+    /** Log the safety state to the file at path and only send a vote once
+     * what it depends on is on disk (see SafetyLog). The replica resumes
+     * from the log, if it exists, in start(). Call before start(). */
+    void open_safety_log(const std::string &path) { safety_log_path = path; }
+    /** Store the committed blocks in the directory dir, from which they
+     * are also served once dropped from memory and restored after a
+     * restart (see Ledger). Call before start(). */
+    void open_ledger(const std::string &dir) { ledger = new Ledger(dir); }
+    const Ledger *get_ledger() const { return ledger.get(); }
+    /** Checkpoint every n commits, so that a replica far behind fetches
+     * the state rather than the blocks, and the ledger keeps only the
+     * blocks since the last stable checkpoint (0 to disable). The
+     * application must implement state_machine_snapshot() and
+     * state_machine_restore(). */
+    void set_checkpoint_interval(uint32_t n) { ckpt_interval = n; }
+    const Checkpoint *get_stable_checkpoint() const { return stable_ckpt.get(); }
+    /** Whether a vote has been sent since start(), and how long after it. */
+    bool get_first_vote_delay(double &delay) const {
+        delay = first_vote_delay;
+        return first_vote_sent;
+    }
+
     size_t size() const { return peers.size(); }
     const auto &get_decision_waiting() const { return decision_waiting; }
     ThreadCall &get_tcall() { return tcall; }
@@ -252,8 +713,13 @@ class HotStuffBase: public HotStuffCore {
     promise_t async_fetch_cmd(const uint256_t &cmd_hash, const PeerId *replica, bool fetch_now = true);
     /** Returns a promise resolved (with block_t blk) when Block is fetched. */
     promise_t async_fetch_blk(const uint256_t &blk_hash, const PeerId *replica, bool fetch_now = true);
-    /** Returns a promise resolved (with block_t blk) when Block is delivered (i.e. prefix is fetched). */
-    promise_t async_deliver_blk(const uint256_t &blk_hash,  const PeerId &replica);
+    /** Returns a promise resolved with the block when it is delivered (i.e.
+     * prefix is fetched); it stays pending if the delivery fails. */
+    deliver_promise_t async_deliver_blk(const uint256_t &blk_hash,  const PeerId &replica,
+                                bool fetch_now = true);
+    /** Ask replica for the committed blocks with heights in [from_height,
+     * to_height]; they are fetched as they arrive (see async_fetch_blk). */
+    void fetch_blk_range(uint32_t from_height, uint32_t to_height, const PeerId &replica);
 };
 
 /** HotStuff protocol (templated by cryptographic implementation). */
@@ -273,9 +739,10 @@ class HotStuff: public HotStuffBase {
                     blk_hash);
     }
 
+    /* the concrete types are final, so the calls below are direct */
     part_cert_bt parse_part_cert(DataStream &s) override {
-        PartCert *pc = new PartCertType();
-        s >> *pc;
+        auto pc = new PartCertType();
+        pc->unserialize(s);
         return pc;
     }
 
@@ -284,8 +751,8 @@ class HotStuff: public HotStuffBase {
     }
 
     quorum_cert_bt parse_quorum_cert(DataStream &s) override {
-        QuorumCert *qc = new QuorumCertType();
-        s >> *qc;
+        auto qc = new QuorumCertType();
+        qc->unserialize(s);
         return qc;
     }
 
@@ -297,7 +764,8 @@ class HotStuff: public HotStuffBase {
             pacemaker_bt pmaker,
             EventContext ec = EventContext(),
             size_t nworker = 4,
-            const Net::Config &netconfig = Net::Config()):
+            const Net::Config &netconfig = Net::Config(),
+            uint8_t nchain = 3):
         HotStuffBase(blk_size,
                     rid,
                     new PrivKeyType(raw_privkey),
@@ -305,7 +773,8 @@ class HotStuff: public HotStuffBase {
                     std::move(pmaker),
                     ec,
                     nworker,
-                    netconfig) {}
+                    netconfig,
+                    nchain) {}
 
     void start(const std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> &replicas, bool ec_loop = false) {
         std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> reps;
@@ -323,6 +792,10 @@ class HotStuff: public HotStuffBase {
 using HotStuffNoSig = HotStuff<>;
 using HotStuffSecp256k1 = HotStuff<PrivKeySecp256k1, PubKeySecp256k1,
                                     PartCertSecp256k1, QuorumCertSecp256k1>;
+using HotStuffSchnorr = HotStuff<PrivKeySchnorr, PubKeySchnorr,
+                                PartCertSchnorr, QuorumCertSchnorr>;
+using HotStuffEd25519 = HotStuff<PrivKeyEd25519, PubKeyEd25519,
+                                PartCertEd25519, QuorumCertEd25519>;
 
 template<EntityType ent_type>
 FetchContext<ent_type>::FetchContext(FetchContext && other):
@@ -330,24 +803,31 @@ FetchContext<ent_type>::FetchContext(FetchContext && other):
         hs(other.hs),
         fetch_msg(std::move(other.fetch_msg)),
         ent_hash(other.ent_hash),
-        replicas(std::move(other.replicas)) {
+        replicas(std::move(other.replicas)),
+        asked(std::move(other.asked)),
+        hedged(other.hedged) {
     other.timeout.del();
     timeout = TimerEvent(hs->ec,
             std::bind(&FetchContext::timeout_cb, this, _1));
     reset_timeout();
 }
 
-template<>
-inline void FetchContext<ENT_TYPE_CMD>::timeout_cb(TimerEvent &) {
-    HOTSTUFF_LOG_WARN("cmd fetching %.10s timeout", get_hex(ent_hash).c_str());
-    for (const auto &replica: replicas)
-        send(replica);
-    reset_timeout();
-}
-
-template<>
-inline void FetchContext<ENT_TYPE_BLK>::timeout_cb(TimerEvent &) {
-    HOTSTUFF_LOG_WARN("block fetching %.10s timeout", get_hex(ent_hash).c_str());
+template<EntityType ent_type>
+void FetchContext<ent_type>::timeout_cb(TimerEvent &) {
+    if (!hedged && asked.size() == 1)
+    {
+        /* the first replica is slow: ask the next best one as well */
+        hedged = true;
+        auto replica = pick_replica();
+        if (replica) send(*replica);
+        reset_timeout();
+        return;
+    }
+    HOTSTUFF_LOG_WARN("%s fetching %.10s timeout",
+                    ent_type == ENT_TYPE_BLK ? "block" : "cmd",
+                    get_hex(ent_hash).c_str());
+    for (const auto &a: asked)
+        hs->fetch_stats[a.first].nmissed++;
     for (const auto &replica: replicas)
         send(replica);
     reset_timeout();
@@ -357,7 +837,7 @@ template<EntityType ent_type>
 FetchContext<ent_type>::FetchContext(
                                 const uint256_t &ent_hash, HotStuffBase *hs):
             promise_t([](promise_t){}),
-            hs(hs), ent_hash(ent_hash) {
+            hs(hs), ent_hash(ent_hash), hedged(false) {
     fetch_msg = std::vector<uint256_t>{ent_hash};
 
     timeout = TimerEvent(hs->ec,
@@ -368,19 +848,53 @@ FetchContext<ent_type>::FetchContext(
 template<EntityType ent_type>
 void FetchContext<ent_type>::send(const PeerId &replica) {
     hs->part_fetched_replica[replica]++;
+    asked.insert(std::make_pair(replica, fetch_clock()));
     hs->pn.send_msg(fetch_msg, replica);
 }
 
+template<EntityType ent_type>
+const PeerId *FetchContext<ent_type>::pick_replica() const {
+    const PeerId *best = nullptr;
+    double best_score = 0;
+    for (const auto &replica: replicas)
+    {
+        if (asked.count(replica)) continue;
+        double score = hs->get_fetch_score(replica);
+        if (best == nullptr || score < best_score)
+        {
+            best = &replica;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
 template<EntityType ent_type>
 void FetchContext<ent_type>::reset_timeout() {
-    timeout.add(salticidae::gen_rand_timeout(ent_waiting_timeout));
+    timeout.del();
+    if (!hedged && asked.size() == 1)
+        timeout.add(hs->fetch_latency.get_hedge_delay());
+    else
+        timeout.add(hs->fetch_latency.get_timeout());
 }
 
 template<EntityType ent_type>
 void FetchContext<ent_type>::add_replica(const PeerId &replica, bool fetch_now) {
-    if (replicas.empty() && fetch_now)
-        send(replica);
     replicas.insert(replica);
+    if (asked.empty() && fetch_now)
+    {
+        send(*pick_replica());
+        reset_timeout();
+    }
+}
+
+template<EntityType ent_type>
+void FetchContext<ent_type>::on_response(const PeerId &replica) {
+    auto it = asked.find(replica);
+    if (it == asked.end()) return;
+    double rtt = fetch_clock() - it->second;
+    hs->fetch_stats[replica].add_sample(rtt);
+    hs->fetch_latency.add(rtt);
 }
 
 }
@@ -0,0 +1,151 @@
+/**
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_LEDGER_H
+#define _HOTSTUFF_LEDGER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hotstuff/type.h"
+#include "hotstuff/entity.h"
+
+namespace hotstuff {
+
+/** default size of a ledger segment file */
+const size_t ledger_seg_size_default = 64 << 20;
+
+/** Append-only store of the committed chain, one block per height, from the
+ * last checkpoint on.
+ *
+ * The blocks go, in their wire format and followed by their decoded
+ * commands, into segment files (seg-<n>) that are preallocated and mapped
+ * into memory, so a stored block can be sent out by copying its bytes from
+ * the mapping without being parsed or kept in the block cache. This is a
+ * single copy into the outgoing message rather than zero-copy: the network
+ * layer takes its messages as owned buffers. The file index is a mapped
+ * array of fixed-size entries, one for each height from the first stored
+ * one, giving where the block is and its hash.
+ *
+ * Finding a block by its hash goes through an in-memory table built when
+ * the ledger is opened, of a few bytes for each stored block. It grows with
+ * the ledger and is only bounded by truncate(), i.e. by checkpointing.
+ *
+ * Writes go to the page cache only: a machine crash may lose the latest
+ * blocks, which the entry checksums reveal when the ledger is opened; they
+ * can be fetched again from the other replicas.
+ *
+ * The latest stable checkpoint is kept next to the blocks, in the file
+ * checkpoint, and the blocks below it are dropped with truncate(). */
+class Ledger {
+    public:
+    /** A stored block in its serialized form, valid while the ledger is. */
+    struct blob_t {
+        const uint8_t *data;
+        size_t size;
+    };
+
+    private:
+    struct Header {
+        uint64_t magic;
+        /** height of the first entry */
+        uint32_t base_height;
+        /** number of entries */
+        uint32_t nblks;
+    };
+
+    struct Entry {
+        /** where the record starts in its segment */
+        uint64_t offset;
+        uint32_t seg;
+        /** the serialized block, then the commands up to rec_len */
+        uint32_t blk_len;
+        uint32_t rec_len;
+        /** crc32 of the record */
+        uint32_t crc;
+        uint8_t blk_hash[32];
+    };
+
+    struct Segment {
+        int fd;
+        uint8_t *base;
+        size_t size;
+        size_t used;
+    };
+
+    static const uint64_t magic = 0x31726764656c7368; /* "hsledgr1" */
+
+    std::string dir;
+    size_t seg_size;
+    std::vector<Segment> segs;
+    int index_fd;
+    Header *header;
+    size_t index_cap;
+    /** heights by the hash value of their block hash, checked against the
+     * entries on lookup */
+    std::unordered_multimap<size_t, uint32_t> heights;
+
+    Entry *entries() const {
+        return reinterpret_cast<Entry *>(header + 1);
+    }
+    std::string seg_path(uint32_t seg) const;
+    void map_index(size_t cap);
+    void close_segment(uint32_t seg);
+    void open_segment(uint32_t seg, size_t size);
+    const Entry *find_entry(uint32_t height) const;
+    void erase_height(const uint256_t &blk_hash, uint32_t height);
+
+    public:
+    /** Open the ledger kept in the directory dir (created if missing). */
+    Ledger(const std::string &dir, size_t seg_size = ledger_seg_size_default);
+    ~Ledger();
+
+    Ledger(const Ledger &) = delete;
+    Ledger &operator=(const Ledger &) = delete;
+
+    /** Store the committed block blk, decided with the commands cmds. The
+     * heights must come in order; those already stored are skipped. */
+    void append(const block_t &blk, const std::vector<uint256_t> &cmds);
+    /** Drop the blocks below height, removing the segments left without
+     * any block. If no block is left, the next one appended may have any
+     * height. */
+    void truncate(uint32_t height);
+
+    /** Durably replace the stored checkpoint by data. */
+    void put_checkpoint(const bytearray_t &data);
+    /** The stored checkpoint, if any. */
+    bool get_checkpoint(bytearray_t &data) const;
+
+    /** Height of the first stored block and of the one after the last, so
+     * nothing is stored if they are equal. */
+    uint32_t get_base_height() const { return header->base_height; }
+    uint32_t get_end_height() const { return header->base_height + header->nblks; }
+    size_t get_size() const { return header->nblks; }
+
+    /** Height of the stored block with the hash blk_hash, if any. */
+    bool find_height(const uint256_t &blk_hash, uint32_t &height) const;
+    /** The serialized block at height, if stored. */
+    bool get_blk(uint32_t height, blob_t &blob) const;
+    /** Hash of the block at height, which must be stored. */
+    uint256_t get_blk_hash(uint32_t height) const;
+    /** The commands decided by the block at height, which must be stored. */
+    std::vector<uint256_t> get_cmds(uint32_t height) const;
+};
+
+}
+
+#endif
@@ -64,11 +64,7 @@ class PMHighTail: public virtual PaceMaker {
     const int32_t parent_limit;         /**< maximum number of parents */
 
     bool check_ancestry(const block_t &_a, const block_t &_b) {
-        block_t b;
-        for (b = _b;
-            b->get_height() > _a->get_height();
-            b = b->get_parents()[0]);
-        return b == _a;
+        return hsc->is_ancestor(_a, _b);
     }
     
     void reg_hqc_update() {
@@ -101,16 +97,17 @@ class PMHighTail: public virtual PaceMaker {
     public:
     PMHighTail(int32_t parent_limit): parent_limit(parent_limit) {}
     void init() {
-        hqc_tail = hsc->get_genesis();
+        /* the genesis block, unless the replica has been restored */
+        hqc_tail = hsc->get_hqc();
         reg_hqc_update();
         reg_proposal();
         reg_receive_proposal();
     }
 
     std::vector<block_t> get_parents() override {
-        const auto &tails = hsc->get_tails();
         std::vector<block_t> parents{hqc_tail};
         // TODO: inclusive block chain
+        // const auto &tails = hsc->get_tails();
         // auto nparents = tails.size();
         // if (parent_limit > 0)
         //     nparents = std::min(nparents, (size_t)parent_limit);
@@ -295,11 +292,7 @@ class PMRoundRobinProposer: virtual public PaceMaker {
         (pm_qc_manual = hsc->async_qc_finish(blk))
             .then([this, x]() {
                 HOTSTUFF_LOG_PROTO("Pacemaker: got QC for block %d", x);
-#ifdef HOTSTUFF_TWO_STEP
-                if (x >= 2) return;
-#else
-                if (x >= 3) return;
-#endif
+                if (x >= hsc->get_nchain()) return;
                 do_new_consensus(x + 1, std::vector<uint256_t>{});
             });
     }
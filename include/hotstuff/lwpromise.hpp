@@ -0,0 +1,316 @@
+/**
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_LWPROMISE_H
+#define _HOTSTUFF_LWPROMISE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hotstuff/util.h"
+
+/**
+ * Lightweight promises for the hot paths (vote and block verification).
+ * Unlike mypromise, the value type is fixed at compile time (no any), the
+ * shared state has a non-atomic intrusive reference count and comes from a
+ * per-thread pool, and the first continuation (plus any small one) is kept
+ * in place instead of in a std::function. There is no rejection: a
+ * promise is either pending or resolved with a value. A promise and all of
+ * its copies must be used by a single thread.
+ */
+namespace lwpromise {
+
+/** The value of a promise returned by a continuation that returns nothing. */
+struct none_t {};
+
+template<typename T> class promise;
+
+/** Move-only callable taking a const T &, kept in place when small. */
+template<typename T>
+class callback {
+    /* room for the continuation of a vote verification (the block, the
+     * vote, the peer and the token) along with the promise of its result */
+    static const size_t inline_size = 96;
+
+    struct ops_t {
+        void (*invoke)(void *, const T &);
+        /* move-construct into the first buffer from the second, which is
+         * then destructed */
+        void (*move)(void *, void *);
+        void (*destroy)(void *);
+    };
+
+    /* the captured handles (block_t, BoxObj, ...) do not declare their
+     * moves noexcept but never throw in them, so only movability is
+     * required; a throwing move would end the program */
+    template<typename F>
+    static constexpr bool fits_inline =
+        sizeof(F) <= inline_size &&
+        alignof(std::max_align_t) % alignof(F) == 0 &&
+        std::is_move_constructible<F>::value;
+
+    template<typename F>
+    static const ops_t *get_inline_ops() {
+        static const ops_t ops = {
+            [](void *p, const T &v) { (*static_cast<F *>(p))(v); },
+            [](void *dst, void *src) {
+                new (dst) F(std::move(*static_cast<F *>(src)));
+                static_cast<F *>(src)->~F();
+            },
+            [](void *p) { static_cast<F *>(p)->~F(); }
+        };
+        return &ops;
+    }
+
+    template<typename F>
+    static const ops_t *get_heap_ops() {
+        static const ops_t ops = {
+            [](void *p, const T &v) { (**static_cast<F **>(p))(v); },
+            [](void *dst, void *src) {
+                *static_cast<F **>(dst) = *static_cast<F **>(src);
+            },
+            [](void *p) { delete *static_cast<F **>(p); }
+        };
+        return &ops;
+    }
+
+    alignas(std::max_align_t) unsigned char buff[inline_size];
+    const ops_t *ops;
+
+    public:
+    template<typename Func,
+            typename F = std::decay_t<Func>,
+            typename = std::enable_if_t<!std::is_same<F, callback>::value>>
+    callback(Func &&f) {
+        if constexpr (fits_inline<F>)
+        {
+            new (buff) F(std::forward<Func>(f));
+            ops = get_inline_ops<F>();
+        }
+        else
+        {
+            *reinterpret_cast<F **>(buff) = new F(std::forward<Func>(f));
+            ops = get_heap_ops<F>();
+        }
+    }
+
+    callback(callback &&other) noexcept: ops(other.ops) {
+        ops->move(buff, other.buff);
+        other.ops = nullptr;
+    }
+
+    callback(const callback &) = delete;
+    callback &operator=(const callback &) = delete;
+    callback &operator=(callback &&) = delete;
+
+    ~callback() { if (ops) ops->destroy(buff); }
+
+    void operator()(const T &v) { ops->invoke(buff, v); }
+};
+
+template<typename T>
+class state: public hotstuff::PoolAllocated<state<T>> {
+    friend class promise<T>;
+    uint32_t refcnt;
+    std::optional<T> value;
+    /* most promises have exactly one continuation */
+    std::optional<callback<T>> first;
+    std::vector<callback<T>> rest;
+
+    state(): refcnt(1) {}
+
+    /* kept out of line: inlined into the many handle copies made by
+     * continuations, gcc cannot see the count and warns of a use after
+     * free */
+    [[gnu::noinline]] static void destroy(state *st) { delete st; }
+
+    void add_callback(callback<T> &&cb) {
+        if (value)
+            cb(*value);
+        else if (!first)
+            first.emplace(std::move(cb));
+        else
+            rest.push_back(std::move(cb));
+    }
+
+    void resolve(T &&v) {
+        if (value) return;
+        value.emplace(std::move(v));
+        if (!first) return;
+        auto cb = std::move(*first);
+        first.reset();
+        auto cbs = std::move(rest);
+        cb(*value);
+        for (auto &c: cbs) c(*value);
+    }
+};
+
+template<typename R> struct then_value { using type = R; };
+template<> struct then_value<void> { using type = none_t; };
+template<typename U> struct then_value<promise<U>> { using type = U; };
+
+/** Handle to the shared state of a promise; copies refer to the same one. */
+template<typename T>
+class promise {
+    state<T> *st;
+
+    void release() {
+        if (st && !--st->refcnt) state<T>::destroy(st);
+    }
+
+    public:
+    using value_type = T;
+
+    promise(): st(new state<T>()) {}
+    /** A handle to no promise, only good for being assigned to. */
+    explicit promise(std::nullptr_t): st(nullptr) {}
+    promise(const promise &other): st(other.st) { if (st) st->refcnt++; }
+    promise(promise &&other) noexcept: st(other.st) { other.st = nullptr; }
+
+    promise &operator=(const promise &other) {
+        if (other.st) other.st->refcnt++;
+        release();
+        st = other.st;
+        return *this;
+    }
+
+    promise &operator=(promise &&other) noexcept {
+        if (this != &other)
+        {
+            release();
+            st = other.st;
+            other.st = nullptr;
+        }
+        return *this;
+    }
+
+    ~promise() { release(); }
+
+    /** Resolve with v; later resolutions are ignored. */
+    void resolve(T v) const { st->resolve(std::move(v)); }
+
+    bool is_resolved() const { return st->value.has_value(); }
+
+    /** Run f with the value once resolved and return a promise of its
+     * result: f may take the value or nothing, and may return a value, a
+     * promise (which is chained) or nothing. */
+    template<typename Func>
+    auto then(Func &&f) const {
+        using F = std::decay_t<Func>;
+        constexpr bool takes_value = std::is_invocable<F &, const T &>::value;
+        using R = typename std::conditional_t<takes_value,
+            std::invoke_result<F &, const T &>,
+            std::invoke_result<F &>>::type;
+        using V = typename then_value<R>::type;
+        promise<V> ret;
+        st->add_callback([f = F(std::forward<Func>(f)), ret](const T &v) mutable {
+            auto call = [&]() -> decltype(auto) {
+                if constexpr (takes_value) return f(v);
+                else return f();
+            };
+            if constexpr (std::is_void<R>::value)
+            {
+                call();
+                ret.resolve(none_t());
+            }
+            else if constexpr (std::is_same<R, promise<V>>::value)
+                call().then([ret](const V &u) { ret.resolve(u); });
+            else
+                ret.resolve(call());
+        });
+        return ret;
+    }
+};
+
+/** A promise already resolved with v. */
+template<typename T>
+promise<std::decay_t<T>> resolved(T &&v) {
+    promise<std::decay_t<T>> pm;
+    pm.resolve(std::forward<T>(v));
+    return pm;
+}
+
+/** Non-atomic reference-counted object shared by the continuations of a
+ * join. */
+template<typename S>
+class shared {
+    struct box: public hotstuff::PoolAllocated<box> {
+        uint32_t refcnt;
+        S obj;
+        template<typename... Args>
+        box(Args &&...args): refcnt(1), obj(std::forward<Args>(args)...) {}
+    };
+    box *b;
+
+    public:
+    template<typename... Args>
+    shared(std::in_place_t, Args &&...args):
+        b(new box(std::forward<Args>(args)...)) {}
+    shared(const shared &other): b(other.b) { b->refcnt++; }
+    shared(shared &&other) noexcept: b(other.b) { other.b = nullptr; }
+    shared &operator=(const shared &) = delete;
+    shared &operator=(shared &&) = delete;
+    ~shared() { if (b && !--b->refcnt) delete b; }
+
+    S &operator*() const { return b->obj; }
+    S *operator->() const { return &b->obj; }
+};
+
+template<typename T>
+struct join_t {
+    size_t remaining;
+    std::vector<T> values;
+    promise<std::vector<T>> ret;
+    join_t(size_t n): remaining(n), values(n) {}
+};
+
+/** A promise of the values of all promises in pms, in order. */
+template<typename T>
+promise<std::vector<T>> all(const std::vector<promise<T>> &pms) {
+    if (pms.empty()) return resolved(std::vector<T>());
+    shared<join_t<T>> js(std::in_place, pms.size());
+    for (size_t i = 0; i < pms.size(); i++)
+        pms[i].then([js, i](const T &v) {
+            js->values[i] = v;
+            if (!--js->remaining)
+                js->ret.resolve(std::move(js->values));
+        });
+    return js->ret;
+}
+
+/** A promise of whether all promises in pms resolve true; it resolves
+ * false as soon as one of them does. */
+inline promise<bool> all_of(const std::vector<promise<bool>> &pms) {
+    if (pms.empty()) return resolved(true);
+    if (pms.size() == 1) return pms[0];
+    promise<bool> ret;
+    shared<size_t> remaining(std::in_place, pms.size());
+    for (const auto &pm: pms)
+        pm.then([ret, remaining](bool v) {
+            if (!v) ret.resolve(false);
+            else if (!--*remaining) ret.resolve(true);
+        });
+    return ret;
+}
+
+}
+
+#endif
@@ -17,18 +17,35 @@
 #ifndef _HOTSTUFF_WORKER_H
 #define _HOTSTUFF_WORKER_H
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
-#include <unordered_map>
+#include <vector>
 #include <unistd.h>
 
 #include "salticidae/event.h"
 #include "hotstuff/util.h"
+#include "hotstuff/lwpromise.hpp"
 
 namespace hotstuff {
 
+/** Shared flag set by the requester when the result of its pending
+ * verifications is no longer needed. */
+using veri_token_t = salticidae::ArcObj<std::atomic<bool>>;
+
+/** Result of a verification, resolved on the requester's thread. */
+using veri_promise_t = lwpromise::promise<bool>;
+
 class VeriTask {
     friend class VeriPool;
     bool result;
+    veri_token_t token;
+    /* resolved by the pool on the requester's thread */
+    veri_promise_t pm{nullptr};
+    std::chrono::steady_clock::time_point submitted;
     public:
     virtual bool verify() = 0;
     virtual ~VeriTask() = default;
@@ -36,77 +53,219 @@ class VeriTask {
 
 using salticidae::ThreadCall;
 using veritask_ut = BoxObj<VeriTask>;
-using mpmc_queue_t = salticidae::MPMCQueueEventDriven<VeriTask *>;
+
+/** A group of checks run as a single job, which holds if all of them hold. */
+class VeriBatchTask final: public VeriTask,
+                            public PoolAllocated<VeriBatchTask> {
+    std::vector<veritask_ut> tasks;
+    public:
+    VeriBatchTask(std::vector<veritask_ut> &&tasks): tasks(std::move(tasks)) {}
+    bool verify() override {
+        for (auto &t: tasks)
+            if (!t->verify()) return false;
+        return true;
+    }
+};
+
 using mpsc_queue_t = salticidae::MPSCQueueEventDriven<VeriTask *>;
 
-class VeriPool {
-    mpmc_queue_t in_queue;
-    mpsc_queue_t out_queue;
+/** Double-ended queue of tasks over a ring that only grows: a steady flow
+ * of tasks does not allocate, where std::deque allocates and frees a chunk
+ * every few of them. */
+class TaskRing {
+    std::vector<VeriTask *> ring;
+    size_t head;
+    size_t n;
+
+    void grow() {
+        std::vector<VeriTask *> nring(std::max((size_t)16, ring.size() * 2));
+        for (size_t i = 0; i < n; i++)
+            nring[i] = ring[(head + i) % ring.size()];
+        ring = std::move(nring);
+        head = 0;
+    }
+
+    public:
+    TaskRing(): head(0), n(0) {}
 
+    bool empty() const { return n == 0; }
+
+    void push_back(VeriTask *task) {
+        if (n == ring.size()) grow();
+        ring[(head + n++) % ring.size()] = task;
+    }
+
+    VeriTask *pop_front() {
+        VeriTask *task = ring[head];
+        head = (head + 1) % ring.size();
+        n--;
+        return task;
+    }
+
+    VeriTask *pop_back() { return ring[(head + --n) % ring.size()]; }
+};
+
+/** Verification thread pool. Each worker owns a deque fed round-robin by
+ * the requester and steals from the tail of the others when its own runs
+ * dry; finished tasks come back through a single queue that resolves their
+ * promises on the requester's event loop. */
+class VeriPool {
     struct Worker {
         std::thread handle;
-        EventContext ec;
-        BoxObj<ThreadCall> tcall;
+        std::mutex mlock;
+        TaskRing tasks;
     };
 
-    std::vector<Worker> workers;
-    std::unordered_map<VeriTask *, std::pair<veritask_ut, promise_t>> pms;
+    mpsc_queue_t out_queue;
+    std::vector<BoxObj<Worker>> workers;
+    size_t next_worker;
+    /* tasks queued but not yet picked up by any worker */
+    std::atomic<size_t> npending;
+    std::mutex sleep_lock;
+    std::condition_variable sleep_cv;
+    bool stopped;
+
+    /* smallest number of checks worth a job of its own */
+    static const size_t batch_min = 8;
+
+    mutable uint64_t part_done;
+    mutable double part_latency;
+    mutable double part_latency_max;
+
+    VeriTask *take(size_t i) {
+        /* own work in submission order, others' from the back */
+        for (size_t j = 0; j < workers.size(); j++)
+        {
+            auto &w = *workers[(i + j) % workers.size()];
+            std::lock_guard<std::mutex> _(w.mlock);
+            if (w.tasks.empty()) continue;
+            VeriTask *task = j == 0 ? w.tasks.pop_front() : w.tasks.pop_back();
+            npending.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+        return nullptr;
+    }
+
+    void run(size_t i) {
+        for (;;)
+        {
+            VeriTask *task = take(i);
+            if (task == nullptr)
+            {
+                std::unique_lock<std::mutex> lk(sleep_lock);
+                sleep_cv.wait(lk, [this]() {
+                    return stopped || npending.load(std::memory_order_relaxed);
+                });
+                if (stopped) return;
+                continue;
+            }
+            HOTSTUFF_LOG_DEBUG("%lx working on %u",
+                                std::this_thread::get_id(), (uintptr_t)task);
+            /* skip the work if the requester has given up */
+            auto &token = task->token;
+            task->result = !(token.get() && token->load(std::memory_order_relaxed)) &&
+                            task->verify();
+            out_queue.enqueue(task);
+        }
+    }
 
     public:
-    VeriPool(EventContext ec, size_t nworker, size_t burst_size = 128) {
+    VeriPool(EventContext ec, size_t nworker, size_t burst_size = 128):
+            next_worker(0), npending(0), stopped(false),
+            part_done(0), part_latency(0), part_latency_max(0) {
         out_queue.reg_handler(ec, [this, burst_size](mpsc_queue_t &q) {
             size_t cnt = burst_size;
             VeriTask *task;
+            auto now = std::chrono::steady_clock::now();
             while (q.try_dequeue(task))
             {
-                auto it = pms.find(task);
-                it->second.second.resolve(task->result);
-                pms.erase(it);
+                double t = std::chrono::duration<double>(now - task->submitted).count();
+                part_done++;
+                part_latency += t;
+                if (t > part_latency_max) part_latency_max = t;
+                task->pm.resolve(task->result);
+                delete task;
                 if (!--cnt) return true;
             }
             return false;
         });
 
-        workers.resize(nworker);
+        if (nworker == 0) nworker = 1;
+        for (size_t i = 0; i < nworker; i++)
+            workers.push_back(new Worker());
         for (size_t i = 0; i < nworker; i++)
+            workers[i]->handle = std::thread([this, i]() { run(i); });
+    }
+
+    ~VeriPool() {
         {
-            in_queue.reg_handler(workers[i].ec, [this, burst_size](mpmc_queue_t &q) {
-                size_t cnt = burst_size;
-                VeriTask *task;
-                while (q.try_dequeue(task))
-                {
-                    HOTSTUFF_LOG_DEBUG("%lx working on %u",
-                                        std::this_thread::get_id(), (uintptr_t)task);
-                    task->result = task->verify();
-                    out_queue.enqueue(task);
-                    if (!--cnt) return true;
-                }
-                return false;
-            });
+            std::lock_guard<std::mutex> _(sleep_lock);
+            stopped = true;
         }
+        sleep_cv.notify_all();
         for (auto &w: workers)
         {
-            w.tcall = new ThreadCall(w.ec);
-            w.handle = std::thread([ec=w.ec]() { ec.dispatch(); });
+            w->handle.join();
+            while (!w->tasks.empty()) delete w->tasks.pop_front();
         }
+        VeriTask *task;
+        while (out_queue.try_dequeue(task)) delete task;
     }
 
-    ~VeriPool() {
-        for (auto &w: workers)
-            w.tcall->async_call([ec=w.ec](ThreadCall::Handle &) {
-                ec.stop();
-            });
-        for (auto &w: workers)
-            w.handle.join();
+    veri_promise_t verify(veritask_ut &&task, const veri_token_t &token = veri_token_t()) {
+        auto ptr = task.unwrap();
+        ptr->token = token;
+        ptr->pm = veri_promise_t();
+        ptr->submitted = std::chrono::steady_clock::now();
+        auto &w = *workers[next_worker];
+        if (++next_worker == workers.size()) next_worker = 0;
+        npending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> _(w.mlock);
+            w.tasks.push_back(ptr);
+        }
+        {
+            /* pairs with the predicate check so the wake-up cannot be lost */
+            std::lock_guard<std::mutex> _(sleep_lock);
+        }
+        sleep_cv.notify_one();
+        return ptr->pm;
     }
 
-    promise_t verify(veritask_ut &&task) {
-        auto ptr = task.get();
-        auto ret = pms.insert(std::make_pair(ptr,
-                std::make_pair(std::move(task), promise_t([](promise_t &){}))));
-        assert(ret.second);
-        in_queue.enqueue(ptr);
-        return ret.first->second.second;
+    /** Verify a group of checks (e.g. all signatures of a QC) that only
+     * matter together. They are cut into at most one job per worker, so a
+     * large group still spreads over the pool while each signature no
+     * longer pays for its own queueing and promise. */
+    veri_promise_t verify_all(std::vector<veritask_ut> &&tasks,
+                        const veri_token_t &token = veri_token_t()) {
+        size_t n = tasks.size();
+        if (n == 0)
+            return lwpromise::resolved(true);
+        size_t njobs = std::min(workers.size(), (n + batch_min - 1) / batch_min);
+        std::vector<veri_promise_t> pms;
+        for (size_t i = 0, b = 0; i < njobs; i++)
+        {
+            size_t e = n * (i + 1) / njobs;
+            std::vector<veritask_ut> chunk;
+            for (; b < e; b++) chunk.push_back(std::move(tasks[b]));
+            pms.push_back(verify(new VeriBatchTask(std::move(chunk)), token));
+        }
+        return lwpromise::all_of(pms);
+    }
+
+    /** Number of tasks waiting for a worker. */
+    size_t get_depth() const { return npending.load(std::memory_order_relaxed); }
+
+    /** Tasks finished since the last clear_stat(). */
+    uint64_t get_ndone() const { return part_done; }
+    /** Average and maximum seconds from submission to resolution. */
+    double get_latency_avg() const { return part_done ? part_latency / part_done : 0; }
+    double get_latency_max() const { return part_latency_max; }
+
+    void clear_stat() const {
+        part_done = 0;
+        part_latency = 0;
+        part_latency_max = 0;
     }
 };
 
@@ -17,6 +17,13 @@
 #ifndef _HOTSTUFF_UTIL_H
 #define _HOTSTUFF_UTIL_H
 
+#include <algorithm>
+#include <initializer_list>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "hotstuff/config.h"
 #include "salticidae/util.h"
 
@@ -77,6 +84,208 @@ extern Logger logger;
 
 #define HOTSTUFF_LOG_ERROR(...) hotstuff::logger.error(__VA_ARGS__)
 
+/** CRC-32 (IEEE 802.3) of len bytes at data, continuing from crc; guards
+ * the records kept on disk. */
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+/** Write all of the len bytes at data to fd.
+ * @return 0 or an errno */
+int write_all(int fd, const uint8_t *data, size_t len);
+
+/** Durably replace the file at path by the len bytes at data: they are
+ * written aside, synced and renamed in place, then the directory is synced
+ * for the rename to last. A crash leaves either version.
+ * @return 0 or an errno */
+int replace_file(const std::string &path, const uint8_t *data, size_t len);
+
+/** Base for the types allocated for every message on the hot path (votes,
+ * certificates, verification tasks): their memory is recycled through a
+ * small per-thread free list instead of going back to the heap. An object
+ * may be freed by a thread other than the one allocating it, in which case
+ * its memory joins the free list of the freeing thread: memory handed
+ * from a producer thread to a consumer one piles up on the consumer side
+ * (up to max_free blocks) while the producer goes back to the heap. The
+ * types of the vote path are allocated and freed by the consensus thread,
+ * verification tasks included (they come back through the pool's queue).
+ * The free list is never destructed, so at most max_free blocks stay
+ * cached per thread. */
+template<typename T, size_t max_free = 256>
+class PoolAllocated {
+    struct FreeList {
+        void *blocks[max_free];
+        size_t nfree;
+    };
+
+    static FreeList &get_free_list() {
+        static thread_local FreeList free_list;
+        return free_list;
+    }
+
+    public:
+    static void *operator new(size_t size) {
+        auto &fl = get_free_list();
+        /* objects of a larger derived type are not pooled */
+        if (size == sizeof(T) && fl.nfree)
+            return fl.blocks[--fl.nfree];
+        return ::operator new(size);
+    }
+
+    static void operator delete(void *ptr, size_t size) {
+        auto &fl = get_free_list();
+        if (size == sizeof(T) && fl.nfree < max_free)
+            fl.blocks[fl.nfree++] = ptr;
+        else
+            ::operator delete(ptr);
+    }
+};
+
+/** A vector that keeps up to N elements within itself, and only goes to the
+ * heap past N. Meant for the lists of a block that almost always hold a
+ * single entry (parents, command hashes). */
+template<typename T, size_t N>
+class SmallVec {
+    T *elems;
+    size_t n;
+    size_t cap;
+    alignas(T) uint8_t buff[N * sizeof(T)];
+
+    T *get_buff() { return reinterpret_cast<T *>(buff); }
+    bool is_inline() const { return elems == reinterpret_cast<const T *>(buff); }
+
+    void grow(size_t ncap) {
+        T *nelems = static_cast<T *>(::operator new(ncap * sizeof(T)));
+        for (size_t i = 0; i < n; i++)
+        {
+            new (nelems + i) T(std::move(elems[i]));
+            elems[i].~T();
+        }
+        if (!is_inline()) ::operator delete(elems);
+        elems = nelems;
+        cap = ncap;
+    }
+
+    /* take the elements of other, which is left empty */
+    void take(SmallVec &&other) {
+        if (other.is_inline())
+        {
+            for (size_t i = 0; i < other.n; i++)
+            {
+                new (elems + i) T(std::move(other.elems[i]));
+                other.elems[i].~T();
+            }
+            n = other.n;
+        }
+        else
+        {
+            elems = other.elems;
+            n = other.n;
+            cap = other.cap;
+            other.elems = other.get_buff();
+            other.cap = N;
+        }
+        other.n = 0;
+    }
+
+    void release() {
+        clear();
+        if (!is_inline()) ::operator delete(elems);
+        elems = get_buff();
+        cap = N;
+    }
+
+    public:
+    using value_type = T;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    SmallVec(): elems(get_buff()), n(0), cap(N) {}
+
+    template<typename It>
+    SmallVec(It first, It last): SmallVec() {
+        for (; first != last; first++) push_back(*first);
+    }
+
+    SmallVec(const std::vector<T> &other): SmallVec(other.begin(), other.end()) {}
+    SmallVec(std::initializer_list<T> init): SmallVec(init.begin(), init.end()) {}
+    SmallVec(const SmallVec &other): SmallVec(other.begin(), other.end()) {}
+    SmallVec(SmallVec &&other): SmallVec() { take(std::move(other)); }
+
+    ~SmallVec() { release(); }
+
+    SmallVec &operator=(const SmallVec &other) {
+        if (this != &other)
+        {
+            clear();
+            reserve(other.n);
+            for (const auto &e: other) push_back(e);
+        }
+        return *this;
+    }
+
+    SmallVec &operator=(SmallVec &&other) {
+        if (this != &other)
+        {
+            release();
+            take(std::move(other));
+        }
+        return *this;
+    }
+
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+
+    T &operator[](size_t i) { return elems[i]; }
+    const T &operator[](size_t i) const { return elems[i]; }
+    T &front() { return elems[0]; }
+    const T &front() const { return elems[0]; }
+    T &back() { return elems[n - 1]; }
+    const T &back() const { return elems[n - 1]; }
+
+    iterator begin() { return elems; }
+    iterator end() { return elems + n; }
+    const_iterator begin() const { return elems; }
+    const_iterator end() const { return elems + n; }
+
+    void reserve(size_t ncap) {
+        if (ncap > cap) grow(ncap);
+    }
+
+    template<typename... Args>
+    T &emplace_back(Args &&...args) {
+        if (n == cap) grow(cap * 2);
+        return *new (elems + n++) T(std::forward<Args>(args)...);
+    }
+
+    void push_back(const T &e) { emplace_back(e); }
+    void push_back(T &&e) { emplace_back(std::move(e)); }
+
+    void pop_back() { elems[--n].~T(); }
+
+    void resize(size_t nsize) {
+        reserve(nsize);
+        while (n > nsize) pop_back();
+        while (n < nsize) emplace_back();
+    }
+
+    void clear() {
+        while (n) pop_back();
+    }
+
+    void swap(SmallVec &other) {
+        SmallVec tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    bool operator==(const SmallVec &other) const {
+        return n == other.n && std::equal(begin(), end(), other.begin());
+    }
+
+    bool operator!=(const SmallVec &other) const { return !(*this == other); }
+
+    operator std::vector<T>() const { return std::vector<T>(begin(), end()); }
+};
+
 #ifdef HOTSTUFF_BLK_PROFILE
 class BlockProfiler {
     enum BlockState {
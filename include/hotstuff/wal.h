@@ -0,0 +1,177 @@
+/**
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_WAL_H
+#define _HOTSTUFF_WAL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "salticidae/event.h"
+#include "hotstuff/type.h"
+#include "hotstuff/util.h"
+
+namespace hotstuff {
+
+/** Append-only write-ahead log of the safety state of a replica (vheight,
+ * b_lock, b_exec, hqc) and of the blocks it has delivered, from which the
+ * replica resumes after a restart.
+ *
+ * Records appended during one iteration of the event loop form a batch
+ * that is written and fdatasync'ed once by a dedicated thread (group
+ * commit). A vote must only leave the replica after the records it depends
+ * on are durable, which after_flush() provides. While a batch is being
+ * flushed, the next one keeps growing.
+ *
+ * Each record is laid out as <length, crc32, type, payload>, where the
+ * length counts the payload and the crc32 covers the type and the payload,
+ * so a torn write at the tail can be told from a complete record. */
+class SafetyLog {
+    public:
+    enum RecordType: uint8_t {
+        /** height of a delivered block, then the block */
+        REC_BLOCK = 0x0,
+        /** hash and height of the block voted for (vheight) */
+        REC_VOTE = 0x1,
+        /** hash and height of the locked block */
+        REC_B_LOCK = 0x2,
+        /** hash and height of the last executed block */
+        REC_B_EXEC = 0x3,
+        /** hash and height of the block with the highest QC, then the QC */
+        REC_HQC = 0x4
+    };
+
+    using flush_cb_t = std::function<void()>;
+    using replay_cb_t = std::function<void(RecordType, DataStream &)>;
+    using record_t = std::pair<RecordType, bytearray_t>;
+
+    private:
+    struct Batch {
+        bytearray_t data;
+        size_t nrecords;
+        /* the batch replaces the log instead of extending it */
+        bool rewrite;
+        /* filled in by the writer thread */
+        double fsync_time;
+        int err;
+        Batch(): nrecords(0), rewrite(false), fsync_time(0), err(0) {}
+    };
+    using batch_queue_t = salticidae::MPSCQueueEventDriven<Batch *>;
+
+    int fd;
+    std::string path;
+    /* bytes in the log once the records appended so far are written, and
+     * right after it was last opened or compacted */
+    size_t size;
+    size_t base_size;
+
+    /* records of the current event loop iteration, on the loop's thread */
+    Batch *pending;
+    std::vector<flush_cb_t> pending_cbs;
+    /* callbacks of the batch handed to the writer */
+    std::vector<flush_cb_t> flushing_cbs;
+    bool flushing;
+    TimerEvent flush_timer;
+
+    /* hand-off to the writer thread */
+    std::thread writer;
+    std::mutex mlock;
+    std::condition_variable cv;
+    Batch *to_write;
+    bool stopped;
+    batch_queue_t done_queue;
+
+    mutable uint64_t part_nbatches;
+    mutable uint64_t part_nrecords;
+    mutable uint64_t part_nbytes;
+    mutable double part_fsync_time;
+    mutable double part_fsync_time_max;
+
+    static void encode(bytearray_t &data, RecordType type, const bytearray_t &payload);
+    void schedule_flush();
+    void start_flush();
+    void on_flushed(Batch *batch);
+    void run_writer();
+
+    public:
+    /** Open (or create) the log at path, appending to what it already has.
+     * Completion callbacks run on the thread of ec. */
+    SafetyLog(const EventContext &ec, const std::string &path);
+    /** Stop after the batch being flushed, if any; the records not yet
+     * handed to the writer are dropped, and so are the votes waiting for
+     * them. */
+    ~SafetyLog();
+
+    SafetyLog(const SafetyLog &) = delete;
+    SafetyLog &operator=(const SafetyLog &) = delete;
+
+    /** Add a record to the batch of this event loop iteration. */
+    void append(RecordType type, const bytearray_t &payload);
+
+    /** Replace the log by records, which must stand for everything
+     * appended so far. The records appended next follow them in the new
+     * log, and after_flush() waits for the new log to be in place. */
+    void compact(const std::vector<record_t> &records);
+
+    /** Run cb once all records appended so far are durable (right away if
+     * they already are). */
+    void after_flush(flush_cb_t cb);
+
+    const std::string &get_path() const { return path; }
+    /** Bytes in the log once the records appended so far are written. */
+    size_t get_size() const { return size; }
+    /** Bytes the log had when opened or last compacted. */
+    size_t get_base_size() const { return base_size; }
+
+    /** Pass the records of the log at path to cb in order, and return
+     * their number (0 if there is no log). The log is read a piece at a
+     * time. A damaged tail, left by a crash in the middle of a write, is
+     * cut off. */
+    static size_t replay(const std::string &path, const replay_cb_t &cb);
+    /** Durably replace the log at path by one holding only records. */
+    static void rewrite(const std::string &path, const std::vector<record_t> &records);
+
+    /** Batches flushed since the last clear_stat(). */
+    uint64_t get_nbatches() const { return part_nbatches; }
+    /** Average number of records and bytes per batch. */
+    double get_batch_records_avg() const {
+        return part_nbatches ? part_nrecords / double(part_nbatches) : 0;
+    }
+    double get_batch_bytes_avg() const {
+        return part_nbatches ? part_nbytes / double(part_nbatches) : 0;
+    }
+    /** Average and maximum seconds spent in write+fdatasync per batch. */
+    double get_fsync_time_avg() const {
+        return part_nbatches ? part_fsync_time / part_nbatches : 0;
+    }
+    double get_fsync_time_max() const { return part_fsync_time_max; }
+
+    void clear_stat() const {
+        part_nbatches = 0;
+        part_nrecords = 0;
+        part_nbytes = 0;
+        part_fsync_time = 0;
+        part_fsync_time_max = 0;
+    }
+};
+
+}
+
+#endif
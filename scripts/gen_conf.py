@@ -20,6 +20,7 @@ if __name__ == "__main__":
     parser.add_argument('--clinworker', type=int, default=4)
     parser.add_argument('--repburst', type=int, default=1000)
     parser.add_argument('--cliburst', type=int, default=1000)
+    parser.add_argument('--algo', type=str, default='secp256k1')
     args = parser.parse_args()
 
 
@@ -42,7 +43,7 @@ if __name__ == "__main__":
         i = port_count.setdefault(ip, 0)
         port_count[ip] += 1
         replicas.append("{}:{};{}".format(ip, base_pport + i, base_cport + i))
-    p = subprocess.Popen([keygen_bin, '--num', str(len(replicas))],
+    p = subprocess.Popen([keygen_bin, '--num', str(len(replicas)), '--algo', args.algo],
                         stdout=subprocess.PIPE, stderr=open(os.devnull, 'w'))
     keys = [[t[4:] for t in l.decode('ascii').split()] for l in p.stdout]
     tls_p = subprocess.Popen([tls_keygen_bin, '--num', str(len(replicas))],
@@ -60,6 +61,7 @@ if __name__ == "__main__":
         main_conf.write("repburst = {}\n".format(args.repburst))
     if args.cliburst is not None:
         main_conf.write("cliburst = {}\n".format(args.cliburst))
+    main_conf.write("algo = {}\n".format(args.algo))
     if not (args.pace_maker is None):
         main_conf.write("pace-maker = {}\n".format(args.pace_maker))
     for r in zip(replicas, keys, tls_keys, itertools.count(0)):
@@ -4,10 +4,6 @@ if [[ $# -gt 0 ]]; then
     rep=($@)
 fi
 
-# avoid stack overflow as in our simple demo the bootstrapping replica will
-# potentially have a long chain of promise resolution
-ulimit -s unlimited
-
 for i in "${rep[@]}"; do
     echo "starting replica $i"
     #valgrind --leak-check=full ./examples/hotstuff-app --conf hotstuff-sec${i}.conf > log${i} 2>&1 &
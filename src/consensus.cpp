@@ -16,7 +16,6 @@
  */
 
 #include <cassert>
-#include <stack>
 
 #include "hotstuff/util.h"
 #include "hotstuff/consensus.h"
@@ -51,22 +50,36 @@ struct Commands {
 /* The core logic of HotStuff, is fairly simple :). */
 /*** begin HotStuff protocol logic ***/
 HotStuffCore::HotStuffCore(ReplicaID id,
-                            privkey_bt &&priv_key):
+                            privkey_bt &&priv_key,
+                            uint8_t nchain):
         b0(new Block(true, 1)),
         b_lock(b0),
         b_exec(b0),
         vheight(0),
+        root_height(0),
         priv_key(std::move(priv_key)),
         tails{b0},
+        consensus_thread(std::this_thread::get_id()),
+        nchain(nchain),
         vote_disabled(false),
+        fast_commit(false),
         id(id),
         storage(new EntityStorage()) {
-                    
+    /* both commit rules are instantiated, the chosen one is called directly
+     * through update_fn without checking the rule on every update */
+    switch (nchain)
+    {
+        case 2: update_fn = &HotStuffCore::update_chain<2>; break;
+        case 3: update_fn = &HotStuffCore::update_chain<3>; break;
+        default: throw HotStuffError("unsupported commit chain length %d", nchain);
+    }
+
             if (RSE::init() != 0) {
                 throw std::runtime_error("leo_init failed.");
             }
             LOG_INFO("leo_init success.");
     storage->add_blk(b0);
+    window.add(b0);
 }
 
 void HotStuffCore::sanity_check_delivered(const block_t &blk) {
@@ -74,9 +87,40 @@ void HotStuffCore::sanity_check_delivered(const block_t &blk) {
         throw std::runtime_error("block not delivered");
 }
 
+block_t HotStuffCore::find_delivered_blk(const uint256_t &blk_hash) {
+    /* almost always one of the last few blocks */
+    block_t blk = window.find(blk_hash);
+    if (blk != nullptr) return blk;
+    blk = storage->find_blk(blk_hash);
+    return blk != nullptr && blk->delivered ? blk : nullptr;
+}
+
+std::vector<block_t> HotStuffCore::get_delivered_blks(uint32_t height) const {
+    std::vector<block_t> blks;
+    /* the committed chain below the window, down to a pruned block */
+    for (block_t b = b_exec; b->height >= height;)
+    {
+        if (b->height < window.get_base()) blks.push_back(b);
+        if (b->parents.empty()) break;
+        b = b->parents[0];
+    }
+    std::reverse(blks.begin(), blks.end());
+    for (uint32_t h = window.get_base(); h < window.get_top(); h++)
+        for (const auto &b: window.get_blks(h))
+            blks.push_back(b);
+    return blks;
+}
+
+shared_block_t HotStuffCore::share_blk(const block_t &blk) const {
+    if (std::this_thread::get_id() != consensus_thread)
+        throw HotStuffError("block %s shared off the consensus thread",
+                            get_hex10(blk->get_hash()).c_str());
+    return blk->detach();
+}
+
 block_t HotStuffCore::get_delivered_blk(const uint256_t &blk_hash) {
-    block_t blk = storage->find_blk(blk_hash);
-    if (blk == nullptr || !blk->delivered)
+    block_t blk = find_delivered_blk(blk_hash);
+    if (blk == nullptr)
         throw std::runtime_error("block not delivered");
     return blk;
 }
@@ -102,16 +146,72 @@ bool HotStuffCore::on_deliver_blk(const block_t &blk) {
 
     for (auto pblk: blk->parents) tails.erase(pblk);
     tails.insert(blk);
+    prune_queue.push(std::make_pair(blk->height, blk->get_hash()));
+    window.add(blk);
 
     blk->delivered = true;
+    do_persist_blk(blk);
     LOG_DEBUG("deliver %s", std::string(*blk).c_str());
     return true;
 }
 
+bool HotStuffCore::on_restore_blk(const block_t &blk, uint32_t height, bool root) {
+    if (blk->delivered) return true;
+    blk_list_t parents;
+    for (const auto &hash: blk->parent_hashes)
+    {
+        block_t pblk = storage->find_blk(hash);
+        if (pblk == nullptr || !pblk->delivered)
+        {
+            if (!root) return false;
+            parents.clear();
+            root_height = std::max(root_height, height);
+            /* nothing below is linked to it */
+            window.advance(height);
+            break;
+        }
+        parents.push_back(std::move(pblk));
+    }
+    blk->parents = std::move(parents);
+    blk->height = height;
+    /* the block of the QC may be older than the restored blocks */
+    if (blk->qc)
+        blk->qc_ref = storage->find_blk(blk->qc->get_obj_hash());
+    for (auto pblk: blk->parents) tails.erase(pblk);
+    tails.insert(blk);
+    prune_queue.push(std::make_pair(height, blk->get_hash()));
+    window.add(blk);
+    blk->delivered = true;
+    return true;
+}
+
+void HotStuffCore::on_restore_state(uint32_t _vheight, const block_t &_b_lock,
+                                    const block_t &_b_exec, const block_t &hqc_blk,
+                                    quorum_cert_bt &&hqc_qc) {
+    vheight = std::max(vheight, _vheight);
+    if (_b_exec)
+    {
+        b_exec = _b_exec;
+        /* the restored chain up to b_exec has been executed */
+        for (block_t b = b_exec; !b->decision;)
+        {
+            b->decision = 1;
+            if (b->parents.empty()) break;
+            b = b->parents[0];
+        }
+        if (b_exec != b0) tails.erase(b0);
+        window.advance(b_exec->height);
+    }
+    if (_b_lock && _b_lock->height > b_lock->height) b_lock = _b_lock;
+    if (hqc_blk) hqc = std::make_pair(hqc_blk, std::move(hqc_qc));
+    LOG_INFO("restored: %s", std::string(*this).c_str());
+}
+
 void HotStuffCore::update_hqc(const block_t &_hqc, const quorum_cert_bt &qc) {
     if (_hqc->height > hqc.first->height)
     {
         hqc = std::make_pair(_hqc, qc->clone());
+        do_persist_hqc(_hqc, *hqc.second);
         on_hqc_update();
     }
 }
@@ -142,35 +242,64 @@ std::vector<uint256_t> async_decode(RSE rse, std::vector<std::vector<uint8_t>> d
 }
 
 
-void HotStuffCore::update(const block_t &nblk) {
+void HotStuffCore::decode_cmds(const block_t &blk) {
+    string blk_hash = get_hex(blk->get_hash());
+    if (futures.count(blk_hash)) return;
+    if (!sc.enough(blk_hash))
+    {
+        LOG_WARN("1-chain: No sufficient Slice for blk %s", blk_hash.substr(0,10).c_str());
+    }
+    std::vector<std::vector<uint8_t>> decode_input;
+    if(sc.get_block(blk_hash, decode_input)==0)
+    {
+        std::future<std::vector<uint256_t> > fu = std::async(async_decode, rse, decode_input);
+        futures.insert(std::make_pair(blk_hash, fu.share()));
+    }
+}
+
+/* three-step HotStuff */
+template<>
+void HotStuffCore::update_chain<3>(const block_t &nblk) {
     /* nblk = b*, blk2 = b'', blk1 = b', blk = b */
-#ifndef HOTSTUFF_TWO_STEP
-    /* three-step HotStuff */
     const block_t &blk2 = nblk->qc_ref;
     if (blk2 == nullptr) return;
     /* decided blk could possible be incomplete due to pruning */
     if (blk2->decision) return;
-    string blk2_hash = get_hex((*blk2).get_hash());
     
     update_hqc(blk2, nblk->qc);
 
+    /* with the fast path, a replica locks on the one-chain block before
+     * voting, as in the two-step rule: all the voters of blk2 then hold a
+     * lock on blk1 */
+    if (fast_commit && blk2->height > b_lock->height)
+    {
+        b_lock = blk2;
+        do_persist_b_lock(b_lock);
+    }
+
     const block_t &blk1 = blk2->qc_ref;
     if (blk1 == nullptr) return;
     if (blk1->decision) return;
 
-    string blk1_hash = get_hex((*blk1).get_hash());
-    if (!sc.enough(blk1_hash))
+    decode_cmds(blk1);
+    
+    if (blk1->height > b_lock->height)
     {
-        LOG_WARN("1-chain: No sufficient Slice for blk %s", blk1_hash.substr(0,10).c_str());
+        b_lock = blk1;
+        do_persist_b_lock(b_lock);
     }
-    std::vector<std::vector<uint8_t>> decode_input;
-    if(sc.get_block(blk1_hash, decode_input)==0)
+
+    /* fast path: all replicas have voted for blk2 which directly extends
+     * blk1, and so are locked on blk1: it is committed by the two-chain.
+     * The flag of blk2 is certified by its QC, and only the replicas with
+     * fast-commit on vote for such a block, so they all took that lock. */
+    if (blk2->fast_commit && blk2->parents[0] == blk1 &&
+        nblk->qc->get_nparts() == config.nreplicas)
     {
-        std::future<std::vector<uint256_t> > fu = std::async(async_decode, rse, decode_input);
-        futures.insert(std::make_pair(blk1_hash, fu.share()));
+        LOG_PROTO("fast commit %s", std::string(*blk1).c_str());
+        commit(blk1);
+        return;
     }
-    
-    if (blk1->height > b_lock->height) b_lock = blk1;
 
     const block_t &blk = blk1->qc_ref;
     if (blk == nullptr) return;
@@ -178,13 +307,26 @@ void HotStuffCore::update(const block_t &nblk) {
 
     /* commit requires direct parent */
     if (blk2->parents[0] != blk1 || blk1->parents[0] != blk) return;
-#else
-    /* two-step HotStuff */
+    /* otherwise commit */
+    commit(blk);
+}
+
+/* two-step HotStuff */
+template<>
+void HotStuffCore::update_chain<2>(const block_t &nblk) {
+    /* nblk = b*, blk1 = b', blk = b */
     const block_t &blk1 = nblk->qc_ref;
     if (blk1 == nullptr) return;
     if (blk1->decision) return;
     update_hqc(blk1, nblk->qc);
-    if (blk1->height > b_lock->height) b_lock = blk1;
+
+    decode_cmds(blk1);
+
+    if (blk1->height > b_lock->height)
+    {
+        b_lock = blk1;
+        do_persist_b_lock(b_lock);
+    }
 
     const block_t &blk = blk1->qc_ref;
     if (blk == nullptr) return;
@@ -192,8 +334,11 @@ void HotStuffCore::update(const block_t &nblk) {
 
     /* commit requires direct parent */
     if (blk1->parents[0] != blk) return;
-#endif
     /* otherwise commit */
+    commit(blk);
+}
+
+void HotStuffCore::commit(const block_t &blk) {
     std::vector<block_t> commit_queue;
     block_t b;
     for (b = blk; b->height > b_exec->height; b = b->parents[0])
@@ -201,9 +346,13 @@ void HotStuffCore::update(const block_t &nblk) {
         commit_queue.push_back(b);
     }
     if (b != b_exec)
+    {
+        /* a late block from the history skipped by a restore */
+        if (blk->height <= root_height) return;
         throw std::runtime_error("safety breached :( " +
                                 std::string(*blk) + " " +
                                 std::string(*b_exec));
+    }
     for (auto it = commit_queue.rbegin(); it != commit_queue.rend(); it++)
     {
         const block_t &blk = *it;
@@ -211,10 +360,11 @@ void HotStuffCore::update(const block_t &nblk) {
         blk->decision = 1;
         do_consensus(blk);
         auto item = futures.find(blk_hash);
+        std::vector<uint256_t> blk_cmds;
         if (item != futures.end()) 
         {
             auto fu = item->second;
-            auto blk_cmds = fu.get();
+            blk_cmds = fu.get();
             futures.erase(blk_hash);
             sc.remove(blk_hash);
             LOG_PROTO("3-chain: find blk %s from cmds_db", get_hex10(blk->get_hash()).c_str());
@@ -227,8 +377,11 @@ void HotStuffCore::update(const block_t &nblk) {
         {
             LOG_WARN("3-chain: Cannot find blk %s from cmds_db", get_hex10(blk->get_hash()).c_str());
         }
+        do_persist_commit(blk, blk_cmds);
     }
     b_exec = blk;
+    window.advance(b_exec->height);
+    do_persist_b_exec(b_exec);
 }
 
 block_t HotStuffCore::on_propose(const std::vector<uint256_t> &cmds,
@@ -240,13 +393,13 @@ block_t HotStuffCore::on_propose(const std::vector<uint256_t> &cmds,
     /* create the new block */
     // todo: cmds -> cmds.hash
     Commands c(cmds);
-    std::vector<uint256_t> cmd_hash = {salticidae::get_hash(c)};
+    blk_hash_list_t cmd_hash{salticidae::get_hash(c)};
     block_t bnew = storage->add_blk(
         new Block(parents, cmd_hash,
             hqc.second->clone(), std::move(extra),
             parents[0]->height + 1,
             hqc.first,
-            nullptr
+            nullptr, 0, fast_commit
         ));
     const uint256_t bnew_hash = bnew->get_hash();
     bnew->self_qc = create_quorum_cert(bnew_hash);
@@ -310,24 +463,22 @@ void HotStuffCore::on_receive_proposal(const Proposal &prop) {
         update(bnew);
     }
     bool opinion = false;
-    if (bnew->height > vheight)
+    if (bnew->fast_commit != fast_commit)
+        LOG_WARN("fast-commit mismatch, not voting for %s",
+                std::string(*bnew).c_str());
+    else if (bnew->height > vheight)
     {
         if (bnew->qc_ref && bnew->qc_ref->height > b_lock->height)
         {
             opinion = true; // liveness condition
             vheight = bnew->height;
+            do_persist_vote(bnew);
         }
-        else
+        else if (window.is_ancestor(b_lock, bnew))
         {   // safety condition (extend the locked branch)
-            block_t b;
-            for (b = bnew;
-                b->height > b_lock->height;
-                b = b->parents[0]);
-            if (b == b_lock) /* on the same branch */
-            {
-                opinion = true;
-                vheight = bnew->height;
-            }
+            opinion = true;
+            vheight = bnew->height;
+            do_persist_vote(bnew);
         }
     }
     LOG_PROTO("now state: %s", std::string(*this).c_str());
@@ -346,8 +497,8 @@ void HotStuffCore::on_receive_vote(const Vote &vote) {
     block_t blk = get_delivered_blk(vote.blk_hash);
     assert(vote.cert);
     size_t qsize = blk->voted.size();
-    if (qsize >= config.nmajority) return;
-    if (!blk->voted.insert(vote.voter).second)
+    if (qsize >= config.nmajority && !fast_qc_waiting.count(blk)) return;
+    if (!blk->voted.insert(vote.voter, config.nreplicas))
     {
         LOG_WARN("duplicate vote for %s from %d", get_hex10(vote.blk_hash).c_str(), vote.voter);
         return;
@@ -361,10 +512,39 @@ void HotStuffCore::on_receive_vote(const Vote &vote) {
     qc->add_part(vote.voter, *vote.cert);
     if (qsize + 1 == config.nmajority)
     {
-        qc->compute();
-        update_hqc(blk, qc);
-        on_qc_finish(blk);
+        if (fast_commit && nchain == 3 && config.nmajority < config.nreplicas)
+        {
+            /* hold the QC back for a while to collect all the votes */
+            fast_qc_waiting.insert(blk);
+            do_fast_qc_wait(blk);
+            return;
+        }
+        finish_qc(blk);
     }
+    else if (qsize + 1 == config.nreplicas && fast_qc_waiting.erase(blk))
+        finish_qc(blk);
+}
+
+void HotStuffCore::on_fast_qc_timeout(const block_t &blk) {
+    if (!fast_qc_waiting.erase(blk)) return;
+    LOG_PROTO("fast path timeout for %s", std::string(*blk).c_str());
+    finish_qc(blk);
+}
+
+size_t HotStuffCore::get_nvotes_needed(const block_t &blk) const {
+    size_t nvoted = blk->voted.size();
+    size_t target = config.nmajority;
+    if (fast_commit && nchain == 3 &&
+        (nvoted < config.nmajority || fast_qc_waiting.count(blk)))
+        target = config.nreplicas;
+    return nvoted < target ? target - nvoted : 0;
+}
+
+void HotStuffCore::finish_qc(const block_t &blk) {
+    auto &qc = blk->self_qc;
+    qc->compute();
+    update_hqc(blk, qc);
+    on_qc_finish(blk);
 }
 
 void HotStuffCore::on_receive_slice(const Slice &slice) {
@@ -394,38 +574,49 @@ void HotStuffCore::on_init(uint32_t nfaulty) {
     hqc = std::make_pair(b0, b0->qc->clone());
 }
 
-void HotStuffCore::prune(uint32_t staleness) {
-    block_t start;
-    /* skip the blocks */
-    for (start = b_exec; staleness; staleness--, start = start->parents[0])
-        if (!start->parents.size()) return;
-    std::stack<block_t> s;
-    start->qc_ref = nullptr;
-    s.push(start);
-    while (!s.empty())
+size_t HotStuffCore::prune(uint32_t staleness, size_t nmax) {
+    if (b_exec->height < staleness) return 0;
+    uint32_t height = b_exec->height - staleness;
+    size_t n = 0;
+    for (; n < nmax && !prune_queue.empty() && prune_queue.top().first < height; n++)
     {
-        auto &blk = s.top();
-        if (blk->parents.empty())
+        block_t blk = storage->find_blk(prune_queue.top().second);
+        prune_queue.pop();
+        if (blk == nullptr || blk == b0) continue;
+        /* the blocks it refers to are lower, so already unlinked: they
+         * may go with it */
+        blk_list_t refs;
+        refs.swap(blk->parents);
+        if (blk->qc_ref)
         {
-            storage->try_release_blk(blk);
-            s.pop();
-            continue;
+            refs.push_back(std::move(blk->qc_ref));
+            blk->qc_ref = nullptr;
         }
-        blk->qc_ref = nullptr;
-        s.push(blk->parents.back());
-        blk->parents.pop_back();
+        blk->voted.clear();
+        blk->self_qc = nullptr;
+        tails.erase(blk);
+        qc_waiting.erase(blk);
+        fast_qc_waiting.erase(blk);
+        string blk_hash = get_hex(blk->get_hash());
+        futures.erase(blk_hash);
+        sc.remove(blk_hash);
+        do_prune(blk);
+        for (const auto &r: refs)
+            storage->try_release_blk(r);
+        storage->try_release_blk(blk);
     }
+    return n;
 }
 
 void HotStuffCore::add_replica(ReplicaID rid, const PeerId &peer_id,
                                 pubkey_bt &&pub_key) {
     config.add_replica(rid,
             ReplicaInfo(rid, peer_id, std::move(pub_key)));
-    b0->voted.insert(rid);
+    b0->voted.insert(rid, config.nreplicas);
 }
 
 promise_t HotStuffCore::async_qc_finish(const block_t &blk) {
-    if (blk->voted.size() >= config.nmajority)
+    if (blk->voted.size() >= config.nmajority && !fast_qc_waiting.count(blk))
         return promise_t([](promise_t &pm) {
             pm.resolve();
         });
@@ -14,6 +14,12 @@
  * limitations under the License.
  */
 
+#include <cstring>
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+#include <openssl/sha.h>
+
 #include "hotstuff/entity.h"
 #include "hotstuff/crypto.h"
 
@@ -22,44 +28,516 @@ namespace hotstuff {
 secp256k1_context_t secp256k1_default_sign_ctx = new Secp256k1Context(true);
 secp256k1_context_t secp256k1_default_verify_ctx = new Secp256k1Context(false);
 
+const secp256k1_context_t &secp256k1_thread_sign_ctx() {
+    thread_local secp256k1_context_t ctx = new Secp256k1Context(true);
+    return ctx;
+}
+
+const secp256k1_context_t &secp256k1_thread_verify_ctx() {
+    thread_local secp256k1_context_t ctx = new Secp256k1Context(false);
+    return ctx;
+}
+
+Secp256k1SigCache secp256k1_verified_sigs;
+
+Secp256k1SigCache::Secp256k1SigCache(size_t nslots): slots(nslots) {
+    if (!RAND_bytes(salt, sizeof salt))
+        throw std::runtime_error("cannot get rand bytes from openssl");
+}
+
+Secp256k1SigCache::Fingerprint Secp256k1SigCache::fingerprint(
+        const PubKeySecp256k1 &pub_key, const uint256_t &msg,
+        const SigSecp256k1 &sig) const {
+    /* the parsed key and signature are canonical, hash them as they are */
+    uint8_t buff[sizeof salt + sizeof pub_key.data.data +
+                32 + sizeof sig.data.data];
+    uint8_t *p = buff;
+    memmove(p, salt, sizeof salt); p += sizeof salt;
+    memmove(p, pub_key.data.data, sizeof pub_key.data.data);
+    p += sizeof pub_key.data.data;
+    memmove(p, msg.to_bytes().data(), 32); p += 32;
+    memmove(p, sig.data.data, sizeof sig.data.data);
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    ::SHA256(buff, sizeof buff, digest);
+    Fingerprint fp;
+    memmove(fp.tag, digest, sizeof fp.tag);
+    memmove(&fp.index, digest + sizeof fp.tag, sizeof fp.index);
+    /* an all-zero tag marks an empty slot */
+    if (!fp.tag[0] && !fp.tag[1]) fp.tag[0] = 1;
+    return fp;
+}
+
 QuorumCertSecp256k1::QuorumCertSecp256k1(
         const ReplicaConfig &config, const uint256_t &obj_hash):
-            QuorumCert(), obj_hash(obj_hash), rids(config.nreplicas) {
-    rids.clear();
-}
+            PackedQuorumCert(config.nreplicas, obj_hash) {}
    
 bool QuorumCertSecp256k1::verify(const ReplicaConfig &config) {
-    if (sigs.size() < config.nmajority) return false;
+    if (get_nparts() < config.nmajority) return false;
+    auto digest = salticidae::get_hash(*this);
+    if (config.verified_qcs.contains(digest)) return true;
+    const uint8_t *sig_data = sigs->data();
     for (size_t i = 0; i < rids.size(); i++)
         if (rids.get(i))
         {
             HOTSTUFF_LOG_DEBUG("checking cert(%d), obj_hash=%s",
                                 i, get_hex10(obj_hash).c_str());
-            if (!sigs[i].verify(obj_hash,
-                            static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i)),
-                            secp256k1_default_verify_ctx))
-            return false;
+            auto &pub_key = static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i));
+            SigSecp256k1 sig(secp256k1_default_verify_ctx);
+            if (!sig.from_compact(sig_data)) return false;
+            sig_data += sig_size;
+            /* already checked as a vote or in another QC */
+            if (secp256k1_verified_sigs.contains(pub_key, obj_hash, sig))
+                continue;
+            if (!sig.verify(obj_hash, pub_key, secp256k1_default_verify_ctx))
+                return false;
+            secp256k1_verified_sigs.insert(pub_key, obj_hash, sig);
+        }
+    config.verified_qcs.insert(digest);
+    return true;
+}
+
+veri_promise_t QuorumCertSecp256k1::verify(const ReplicaConfig &config, VeriPool &vpool) {
+    if (get_nparts() < config.nmajority)
+        return lwpromise::resolved(false);
+    return config.verified_qcs.verify(salticidae::get_hash(*this), [&]() {
+        std::vector<veritask_ut> tasks;
+        const uint8_t *sig_data = sigs->data();
+        for (size_t i = 0; i < rids.size(); i++)
+            if (rids.get(i))
+            {
+                HOTSTUFF_LOG_DEBUG("checking cert(%d), obj_hash=%s",
+                                    i, get_hex10(obj_hash).c_str());
+                auto &pub_key = static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i));
+                SigSecp256k1 sig(secp256k1_default_verify_ctx);
+                if (!sig.from_compact(sig_data))
+                    return lwpromise::resolved(false);
+                sig_data += sig_size;
+                if (!secp256k1_verified_sigs.contains(pub_key, obj_hash, sig))
+                    tasks.push_back(new Secp256k1VeriTask(obj_hash, pub_key, sig));
+            }
+        return vpool.verify_all(std::move(tasks));
+    });
+}
+
+/* === BIP340 Schnorr === */
+
+SchnorrGroup::SchnorrGroup():
+        group(EC_GROUP_new_by_curve_name(NID_secp256k1)),
+        order(BN_new()), prime(BN_new()) {
+    if (!group || !order || !prime ||
+        !EC_GROUP_get_order(group, order, nullptr) ||
+        !EC_GROUP_get_curve(group, prime, nullptr, nullptr, nullptr))
+        throw std::runtime_error("cannot set up secp256k1 with openssl");
+}
+
+SchnorrGroup::~SchnorrGroup() {
+    BN_free(prime);
+    BN_free(order);
+    EC_GROUP_free(group);
+}
+
+const SchnorrGroup schnorr_group;
+
+/** Temporary big numbers and points released at the end of the scope. */
+class SchnorrScratch {
+    BN_CTX *bn_ctx;
+    std::vector<EC_POINT *> points;
+
+    public:
+    SchnorrScratch(): bn_ctx(BN_CTX_new()) {
+        if (!bn_ctx) throw std::bad_alloc();
+        BN_CTX_start(bn_ctx);
+    }
+
+    SchnorrScratch(const SchnorrScratch &) = delete;
+
+    ~SchnorrScratch() {
+        for (auto p: points) EC_POINT_free(p);
+        BN_CTX_end(bn_ctx);
+        BN_CTX_free(bn_ctx);
+    }
+
+    BN_CTX *ctx() { return bn_ctx; }
+
+    BIGNUM *bn() {
+        auto ret = BN_CTX_get(bn_ctx);
+        if (!ret) throw std::bad_alloc();
+        return ret;
+    }
+
+    BIGNUM *bn(const uint8_t *bytes) {
+        auto ret = bn();
+        BN_bin2bn(bytes, 32, ret);
+        return ret;
+    }
+
+    EC_POINT *point() {
+        auto ret = EC_POINT_new(schnorr_group.group);
+        if (!ret) throw std::bad_alloc();
+        points.push_back(ret);
+        return ret;
+    }
+};
+
+/* SHA256(SHA256(tag) || SHA256(tag) || data...) */
+static void schnorr_tagged_hash(uint8_t *output, const char *tag,
+                        std::initializer_list<const uint8_t *> data) {
+    uint8_t tag_hash[32];
+    ::SHA256((const uint8_t *)tag, strlen(tag), tag_hash);
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md) throw std::bad_alloc();
+    EVP_DigestInit_ex(md, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(md, tag_hash, 32);
+    EVP_DigestUpdate(md, tag_hash, 32);
+    for (auto d: data)
+        EVP_DigestUpdate(md, d, 32);
+    EVP_DigestFinal_ex(md, output, nullptr);
+    EVP_MD_CTX_free(md);
+}
+
+/* e = H_challenge(r || pk || msg) mod n */
+static void schnorr_challenge(BIGNUM *e, const uint8_t *r, const uint8_t *pk,
+                        const uint8_t *msg, SchnorrScratch &sc) {
+    uint8_t hash[32];
+    schnorr_tagged_hash(hash, "BIP0340/challenge", {r, pk, msg});
+    BN_bin2bn(hash, 32, e);
+    BN_mod(e, e, schnorr_group.order, sc.ctx());
+}
+
+/* the x coordinate of p, with y returned in y */
+static void schnorr_get_xy(uint8_t *x, BIGNUM *y, const EC_POINT *p,
+                        SchnorrScratch &sc) {
+    auto bx = sc.bn();
+    if (!EC_POINT_get_affine_coordinates(schnorr_group.group, p, bx, y, sc.ctx()))
+        throw std::runtime_error("cannot get the coordinates of a point");
+    BN_bn2binpad(bx, x, 32);
+}
+
+/* the point on the curve with the x coordinate x and an even y */
+static bool schnorr_lift_x(EC_POINT *p, const BIGNUM *x, SchnorrScratch &sc) {
+    if (BN_cmp(x, schnorr_group.prime) >= 0) return false;
+    return EC_POINT_set_compressed_coordinates(schnorr_group.group, p, x, 0, sc.ctx());
+}
+
+/* Computes sum(scalars[i] * points[i]) with the bucket method (Pippenger):
+ * the scalars are cut into windows of c bits, and for each window the points
+ * are added into the bucket of their digit before the buckets are summed. */
+static void schnorr_multi_mul(EC_POINT *result,
+                        const std::vector<const EC_POINT *> &points,
+                        const std::vector<const BIGNUM *> &scalars,
+                        SchnorrScratch &sc) {
+    const EC_GROUP *group = schnorr_group.group;
+    size_t npoints = points.size();
+    int c = npoints < 8 ? 3 : npoints < 32 ? 4 : npoints < 128 ? 5 :
+            npoints < 512 ? 6 : 7;
+    int nbits = 0;
+    for (auto s: scalars)
+        nbits = std::max(nbits, BN_num_bits(s));
+    std::vector<EC_POINT *> buckets((1 << c) - 1);
+    for (auto &b: buckets) b = sc.point();
+    auto running = sc.point();
+    auto window_sum = sc.point();
+    auto ctx = sc.ctx();
+    EC_POINT_set_to_infinity(group, result);
+    for (int w = (nbits + c - 1) / c - 1; w >= 0; w--)
+    {
+        for (int i = 0; i < c; i++)
+            EC_POINT_dbl(group, result, result, ctx);
+        for (auto &b: buckets)
+            EC_POINT_set_to_infinity(group, b);
+        for (size_t i = 0; i < npoints; i++)
+        {
+            int digit = 0;
+            for (int j = c - 1; j >= 0; j--)
+                digit = (digit << 1) | BN_is_bit_set(scalars[i], w * c + j);
+            if (digit)
+                EC_POINT_add(group, buckets[digit - 1], buckets[digit - 1], points[i], ctx);
+        }
+        /* sum(digit * bucket[digit]) as a sum of running sums */
+        EC_POINT_set_to_infinity(group, running);
+        EC_POINT_set_to_infinity(group, window_sum);
+        for (size_t d = buckets.size(); d > 0; d--)
+        {
+            EC_POINT_add(group, running, running, buckets[d - 1], ctx);
+            EC_POINT_add(group, window_sum, window_sum, running, ctx);
         }
+        EC_POINT_add(group, result, result, window_sum, ctx);
+    }
+}
+
+void PubKeySchnorr::lift() {
+    SchnorrScratch sc;
+    if (!point) point = EC_POINT_new(schnorr_group.group);
+    if (!point) throw std::bad_alloc();
+    if (!schnorr_lift_x(point, sc.bn(data), sc))
+        throw std::invalid_argument("ill-formed public key");
+}
+
+PubKeySchnorr::PubKeySchnorr(const PrivKeySchnorr &priv_key):
+        PubKey(), point(nullptr) {
+    SchnorrScratch sc;
+    auto d = sc.bn(priv_key.data);
+    if (BN_is_zero(d) || BN_cmp(d, schnorr_group.order) >= 0)
+        throw std::invalid_argument("invalid schnorr private key");
+    auto p = sc.point();
+    EC_POINT_mul(schnorr_group.group, p, d, nullptr, nullptr, sc.ctx());
+    schnorr_get_xy(data, sc.bn(), p, sc);
+    lift();
+}
+
+PubKeySchnorr::PubKeySchnorr(const PubKeySchnorr &other):
+        PubKey(), point(nullptr) {
+    memmove(data, other.data, nbytes);
+    if (other.point)
+    {
+        point = EC_POINT_dup(other.point, schnorr_group.group);
+        if (!point) throw std::bad_alloc();
+    }
+}
+
+void PrivKeySchnorr::from_rand() {
+    SchnorrScratch sc;
+    auto d = sc.bn();
+    do {
+        if (!RAND_bytes(data, nbytes))
+            throw std::runtime_error("cannot get rand bytes from openssl");
+        BN_bin2bn(data, nbytes, d);
+    } while (BN_is_zero(d) || BN_cmp(d, schnorr_group.order) >= 0);
+}
+
+void SigSchnorr::sign(const bytearray_t &msg, const PrivKeySchnorr &priv_key,
+                    const uint8_t *aux_rand) {
+    check_msg_length(msg);
+    const auto &g = schnorr_group;
+    SchnorrScratch sc;
+    auto ctx = sc.ctx();
+    auto d = sc.bn(priv_key.data);
+    if (BN_is_zero(d) || BN_cmp(d, g.order) >= 0)
+        throw std::invalid_argument("invalid schnorr private key");
+    auto y = sc.bn();
+    auto p = sc.point();
+    uint8_t px[32];
+    EC_POINT_mul(g.group, p, d, nullptr, nullptr, ctx);
+    schnorr_get_xy(px, y, p, sc);
+    if (BN_is_odd(y)) BN_sub(d, g.order, d);
+    /* the nonce */
+    uint8_t aux[32], t[32], rand[32];
+    if (aux_rand)
+        memmove(aux, aux_rand, 32);
+    else if (!RAND_bytes(aux, 32))
+        throw std::runtime_error("cannot get rand bytes from openssl");
+    schnorr_tagged_hash(t, "BIP0340/aux", {aux});
+    uint8_t dbytes[32];
+    BN_bn2binpad(d, dbytes, 32);
+    for (int i = 0; i < 32; i++) t[i] ^= dbytes[i];
+    schnorr_tagged_hash(rand, "BIP0340/nonce", {t, px, &msg[0]});
+    auto k = sc.bn(rand);
+    BN_mod(k, k, g.order, ctx);
+    if (BN_is_zero(k))
+        throw std::runtime_error("failed to create schnorr signature");
+    auto r = sc.point();
+    EC_POINT_mul(g.group, r, k, nullptr, nullptr, ctx);
+    schnorr_get_xy(data, y, r, sc);
+    if (BN_is_odd(y)) BN_sub(k, g.order, k);
+    /* s = k + e * d */
+    auto e = sc.bn();
+    schnorr_challenge(e, data, px, &msg[0], sc);
+    auto s = sc.bn();
+    BN_mod_mul(s, e, d, g.order, ctx);
+    BN_mod_add(s, s, k, g.order, ctx);
+    BN_bn2binpad(s, data + 32, 32);
+}
+
+bool SigSchnorr::verify(const bytearray_t &msg, const PubKeySchnorr &pub_key) const {
+    check_msg_length(msg);
+    const auto &g = schnorr_group;
+    SchnorrScratch sc;
+    auto ctx = sc.ctx();
+    auto s = sc.bn(data + 32);
+    if (BN_cmp(sc.bn(data), g.prime) >= 0 || BN_cmp(s, g.order) >= 0)
+        return false;
+    /* R = s * G - e * P */
+    auto e = sc.bn();
+    schnorr_challenge(e, data, pub_key.data, &msg[0], sc);
+    BN_sub(e, g.order, e);
+    auto r = sc.point();
+    EC_POINT_mul(g.group, r, s, pub_key.point, e, ctx);
+    if (EC_POINT_is_at_infinity(g.group, r)) return false;
+    uint8_t rx[32];
+    auto y = sc.bn();
+    schnorr_get_xy(rx, y, r, sc);
+    return !BN_is_odd(y) && !memcmp(rx, data, 32);
+}
+
+bool SigSchnorr::verify_batch(const bytearray_t &msg,
+                            const std::vector<const PubKeySchnorr *> &pub_keys,
+                            const uint8_t *sigs) {
+    check_msg_length(msg);
+    size_t n = pub_keys.size();
+    if (n == 0) return true;
+    if (n == 1) return SigSchnorr(sigs).verify(msg, *pub_keys[0]);
+    const auto &g = schnorr_group;
+    SchnorrScratch sc;
+    auto ctx = sc.ctx();
+    /* with random a_1 = 1, a_2, ..., a_n, check
+     * (sum a_i s_i) * G + sum a_i * (-R_i) - sum (a_i e_i) * P_i = 0 */
+    std::vector<const EC_POINT *> points{EC_GROUP_get0_generator(g.group)};
+    std::vector<const BIGNUM *> scalars;
+    auto gs = sc.bn();
+    BN_zero(gs);
+    scalars.push_back(gs);
+    auto as = sc.bn();
+    for (size_t i = 0; i < n; i++, sigs += nbytes)
+    {
+        auto r = sc.bn(sigs);
+        auto s = sc.bn(sigs + 32);
+        if (BN_cmp(s, g.order) >= 0) return false;
+        auto rp = sc.point();
+        if (!schnorr_lift_x(rp, r, sc)) return false;
+        /* 128-bit randomizers are enough for the soundness of the check */
+        auto a = sc.bn();
+        if (i == 0)
+            BN_one(a);
+        else
+        {
+            uint8_t rand[16];
+            if (!RAND_bytes(rand, sizeof(rand)))
+                throw std::runtime_error("cannot get rand bytes from openssl");
+            BN_bin2bn(rand, sizeof(rand), a);
+        }
+        BN_mod_mul(as, a, s, g.order, ctx);
+        BN_mod_add(gs, gs, as, g.order, ctx);
+        auto ae = sc.bn();
+        schnorr_challenge(ae, sigs, pub_keys[i]->data, &msg[0], sc);
+        BN_mod_mul(ae, ae, a, g.order, ctx);
+        BN_sub(ae, g.order, ae);
+        /* negate R_i rather than a_i to keep the short scalar */
+        EC_POINT_invert(g.group, rp, ctx);
+        points.push_back(rp);
+        scalars.push_back(a);
+        points.push_back(pub_keys[i]->point);
+        scalars.push_back(ae);
+    }
+    auto res = sc.point();
+    schnorr_multi_mul(res, points, scalars, sc);
+    return EC_POINT_is_at_infinity(g.group, res);
+}
+
+QuorumCertSchnorr::QuorumCertSchnorr(
+        const ReplicaConfig &config, const uint256_t &obj_hash):
+            PackedQuorumCert(config.nreplicas, obj_hash) {}
+
+bool QuorumCertSchnorr::verify(const ReplicaConfig &config) {
+    if (get_nparts() < config.nmajority) return false;
+    auto digest = salticidae::get_hash(*this);
+    if (config.verified_qcs.contains(digest)) return true;
+    std::vector<const PubKeySchnorr *> pub_keys;
+    for (size_t i = 0; i < rids.size(); i++)
+        if (rids.get(i))
+            pub_keys.push_back(
+                &static_cast<const PubKeySchnorr &>(config.get_pubkey(i)));
+    if (!SigSchnorr::verify_batch(obj_hash, pub_keys, sigs->data()))
+        return false;
+    config.verified_qcs.insert(digest);
     return true;
 }
 
-promise_t QuorumCertSecp256k1::verify(const ReplicaConfig &config, VeriPool &vpool) {
-    if (sigs.size() < config.nmajority)
-        return promise_t([](promise_t &pm) { pm.resolve(false); });
-    std::vector<promise_t> vpm;
+veri_promise_t QuorumCertSchnorr::verify(const ReplicaConfig &config, VeriPool &vpool) {
+    if (get_nparts() < config.nmajority)
+        return lwpromise::resolved(false);
+    return config.verified_qcs.verify(salticidae::get_hash(*this), [&]() {
+        std::vector<PubKeySchnorr> pub_keys;
+        for (size_t i = 0; i < rids.size(); i++)
+            if (rids.get(i))
+                pub_keys.push_back(
+                    static_cast<const PubKeySchnorr &>(config.get_pubkey(i)));
+        return vpool.verify(new SchnorrBatchVeriTask(
+                    obj_hash, std::move(pub_keys), *sigs));
+    });
+}
+
+/* === Ed25519 === */
+
+void PubKeyEd25519::load() {
+    EVP_PKEY_free(pkey);
+    pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, data, nbytes);
+    if (!pkey) throw std::invalid_argument("ill-formed public key");
+}
+
+PubKeyEd25519::PubKeyEd25519(const PrivKeyEd25519 &priv_key):
+        PubKey(), pkey(nullptr) {
+    size_t len = nbytes;
+    if (!priv_key.pkey ||
+        !EVP_PKEY_get_raw_public_key(priv_key.pkey, data, &len))
+        throw std::invalid_argument("invalid ed25519 private key");
+    load();
+}
+
+void PrivKeyEd25519::load() {
+    EVP_PKEY_free(pkey);
+    pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, nullptr, data, nbytes);
+    if (!pkey) throw std::invalid_argument("invalid ed25519 private key");
+}
+
+void SigEd25519::sign(const bytearray_t &msg, const PrivKeyEd25519 &priv_key) {
+    check_msg_length(msg);
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    size_t len = nbytes;
+    bool ok = md && priv_key.pkey &&
+        EVP_DigestSignInit(md, nullptr, nullptr, nullptr, priv_key.pkey) == 1 &&
+        EVP_DigestSign(md, data, &len, &msg[0], msg.size()) == 1;
+    EVP_MD_CTX_free(md);
+    if (!ok)
+        throw std::invalid_argument("failed to create ed25519 signature");
+}
+
+bool SigEd25519::verify(const bytearray_t &msg, const PubKeyEd25519 &pub_key) const {
+    check_msg_length(msg);
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md) throw std::bad_alloc();
+    bool ok = pub_key.pkey &&
+        EVP_DigestVerifyInit(md, nullptr, nullptr, nullptr, pub_key.pkey) == 1 &&
+        EVP_DigestVerify(md, data, nbytes, &msg[0], msg.size()) == 1;
+    EVP_MD_CTX_free(md);
+    return ok;
+}
+
+QuorumCertEd25519::QuorumCertEd25519(
+        const ReplicaConfig &config, const uint256_t &obj_hash):
+            PackedQuorumCert(config.nreplicas, obj_hash) {}
+
+bool QuorumCertEd25519::verify(const ReplicaConfig &config) {
+    if (get_nparts() < config.nmajority) return false;
+    auto digest = salticidae::get_hash(*this);
+    if (config.verified_qcs.contains(digest)) return true;
+    const uint8_t *sig_data = sigs->data();
     for (size_t i = 0; i < rids.size(); i++)
         if (rids.get(i))
         {
-            HOTSTUFF_LOG_DEBUG("checking cert(%d), obj_hash=%s",
-                                i, get_hex10(obj_hash).c_str());
-            vpm.push_back(vpool.verify(new Secp256k1VeriTask(obj_hash,
-                            static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i)),
-                            sigs[i])));
+            if (!SigEd25519(sig_data).verify(obj_hash,
+                            static_cast<const PubKeyEd25519 &>(config.get_pubkey(i))))
+                return false;
+            sig_data += SigEd25519::nbytes;
         }
-    return mypromise::all(vpm).then([](const mypromise::values_t &values) {
-        for (const auto &v: values)
-            if (!mypromise::any_cast<bool>(v)) return false;
-        return true;
+    config.verified_qcs.insert(digest);
+    return true;
+}
+
+veri_promise_t QuorumCertEd25519::verify(const ReplicaConfig &config, VeriPool &vpool) {
+    if (get_nparts() < config.nmajority)
+        return lwpromise::resolved(false);
+    return config.verified_qcs.verify(salticidae::get_hash(*this), [&]() {
+        std::vector<veritask_ut> tasks;
+        const uint8_t *sig_data = sigs->data();
+        for (size_t i = 0; i < rids.size(); i++)
+            if (rids.get(i))
+            {
+                tasks.push_back(new Ed25519VeriTask(obj_hash,
+                                static_cast<const PubKeyEd25519 &>(config.get_pubkey(i)),
+                                SigEd25519(sig_data)));
+                sig_data += SigEd25519::nbytes;
+            }
+        return vpool.verify_all(std::move(tasks));
     });
 }
 
@@ -27,6 +27,7 @@ void Block::serialize(DataStream &s) const {
     for (auto cmd: cmds)
         s << cmd;
     s << *qc << htole((uint32_t)extra.size()) << extra;
+    s << (uint8_t)fast_commit;
 }
 
 void Block::unserialize(DataStream &s, HotStuffCore *hsc) {
@@ -53,18 +54,35 @@ void Block::unserialize(DataStream &s, HotStuffCore *hsc) {
         auto base = s.get_data_inplace(n);
         extra = bytearray_t(base, base + n);
     }
+    uint8_t fast;
+    s >> fast;
+    fast_commit = fast;
     this->hash = salticidae::get_hash(*this);
 }
 
+shared_block_t Block::detach() const {
+    Block *blk = new Block();
+    blk->parent_hashes = parent_hashes;
+    blk->cmds = cmds;
+    if (qc) blk->qc = quorum_cert_bt(qc->clone());
+    blk->extra = extra;
+    blk->fast_commit = fast_commit;
+    blk->hash = hash;
+    blk->height = height;
+    blk->delivered = delivered;
+    blk->decision = decision;
+    return blk;
+}
+
 bool Block::verify(const HotStuffCore *hsc) const {
     if (qc->get_obj_hash() == hsc->get_genesis()->get_hash())
         return true;
     return qc->verify(hsc->get_config());
 }
 
-promise_t Block::verify(const HotStuffCore *hsc, VeriPool &vpool) const {
+veri_promise_t Block::verify(const HotStuffCore *hsc, VeriPool &vpool) const {
     if (qc->get_obj_hash() == hsc->get_genesis()->get_hash())
-        return promise_t([](promise_t &pm) { pm.resolve(true); });
+        return lwpromise::resolved(true);
     return qc->verify(hsc->get_config(), vpool);
 }
 
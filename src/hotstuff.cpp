@@ -15,6 +15,9 @@
  * limitations under the License.
  */
 
+#include <map>
+#include <optional>
+
 #include "hotstuff/hotstuff.h"
 #include "hotstuff/client.h"
 #include "hotstuff/liveness.h"
@@ -57,15 +60,70 @@ MsgReqBlock::MsgReqBlock(DataStream &&s) {
 }
 
 const opcode_t MsgRespBlock::opcode;
-MsgRespBlock::MsgRespBlock(const std::vector<block_t> &blks) {
-    serialized << htole((uint32_t)blks.size());
+MsgRespBlock::MsgRespBlock(const std::vector<block_t> &blks,
+                            const std::vector<Ledger::blob_t> &blobs) {
+    serialized << htole((uint32_t)(blks.size() + blobs.size()));
     for (auto blk: blks) serialized << *blk;
+    for (const auto &b: blobs) serialized.put_data(b.data, b.data + b.size);
 }
 
 void MsgRespBlock::postponed_parse(HotStuffCore *hsc) {
     uint32_t size;
     serialized >> size;
     size = letoh(size);
+    /* no honest replica sends more */
+    if (size > blk_range_max) return;
+    blks.resize(size);
+    for (auto &blk: blks)
+    {
+        Block _blk;
+        _blk.unserialize(serialized, hsc);
+        blk = hsc->storage->add_blk(std::move(_blk), hsc->get_config());
+    }
+}
+
+const opcode_t MsgReqBlockRange::opcode;
+MsgReqBlockRange::MsgReqBlockRange(const uint256_t &blk_hash, uint32_t nblks):
+        type(RANGE_ANCESTORS), blk_hash(blk_hash), nblks(nblks) {
+    serialized << (uint8_t)type << blk_hash << htole(nblks);
+}
+
+MsgReqBlockRange::MsgReqBlockRange(uint32_t from_height, uint32_t to_height):
+        type(RANGE_HEIGHTS), from_height(from_height), to_height(to_height) {
+    serialized << (uint8_t)type << htole(from_height) << htole(to_height);
+}
+
+MsgReqBlockRange::MsgReqBlockRange(DataStream &&s) {
+    uint8_t _type;
+    s >> _type;
+    type = (RangeType)_type;
+    if (type == RANGE_ANCESTORS)
+    {
+        s >> blk_hash >> nblks;
+        nblks = letoh(nblks);
+    }
+    else
+    {
+        s >> from_height >> to_height;
+        from_height = letoh(from_height);
+        to_height = letoh(to_height);
+    }
+}
+
+const opcode_t MsgRespBlockRange::opcode;
+MsgRespBlockRange::MsgRespBlockRange(const std::vector<block_t> &blks,
+                                    const std::vector<Ledger::blob_t> &blobs) {
+    serialized << htole((uint32_t)(blobs.size() + blks.size()));
+    for (const auto &b: blobs) serialized.put_data(b.data, b.data + b.size);
+    for (auto blk: blks) serialized << *blk;
+}
+
+void MsgRespBlockRange::postponed_parse(HotStuffCore *hsc) {
+    uint32_t size;
+    serialized >> size;
+    size = letoh(size);
+    /* no honest replica sends more */
+    if (size > blk_range_max) return;
     blks.resize(size);
     for (auto &blk: blks)
     {
@@ -81,12 +139,58 @@ MsgSlice::MsgSlice(const Slice &slice) {
     serialized << hash << slice; }
 void MsgSlice::postponed_parse() { serialized >> hash >> slice; }
 
+const opcode_t MsgCheckpointVote::opcode;
+MsgCheckpointVote::MsgCheckpointVote(uint32_t height, const Vote &vote) {
+    serialized << htole(height) << vote;
+}
+
+void MsgCheckpointVote::postponed_parse(HotStuffCore *hsc) {
+    vote.hsc = hsc;
+    serialized >> height >> vote;
+    height = letoh(height);
+}
+
+const opcode_t MsgReqSnapshot::opcode;
+const uint32_t MsgReqSnapshot::manifest;
+MsgReqSnapshot::MsgReqSnapshot(uint32_t height, uint32_t chunk):
+        height(height), chunk(chunk) {
+    serialized << htole(height) << htole(chunk);
+}
+
+MsgReqSnapshot::MsgReqSnapshot(DataStream &&s) {
+    s >> height >> chunk;
+    height = letoh(height);
+    chunk = letoh(chunk);
+}
+
+const opcode_t MsgRespSnapshot::opcode;
+MsgRespSnapshot::MsgRespSnapshot(const Checkpoint &ckpt, uint32_t chunk):
+        height(ckpt.height), chunk(chunk) {
+    serialized << htole(height) << htole(chunk);
+    if (chunk == MsgReqSnapshot::manifest)
+    {
+        serialized << ckpt.blk_hash << htole((uint32_t)ckpt.data.size());
+        for (const auto &h: ckpt.chunk_hashes) serialized << h;
+    }
+    else
+    {
+        const uint8_t *p = ckpt.get_chunk(chunk);
+        serialized.put_data(p, p + ckpt.get_chunk_size(chunk));
+    }
+}
+
+MsgRespSnapshot::MsgRespSnapshot(DataStream &&s): serialized(std::move(s)) {
+    serialized >> height >> chunk;
+    height = letoh(height);
+    chunk = letoh(chunk);
+}
+
 // TODO: improve this function
 void HotStuffBase::exec_command(uint256_t cmd_hash, commit_cb_t callback) {
     cmd_pending.enqueue(std::make_pair(cmd_hash, callback));
 }
 
-void HotStuffBase::on_fetch_blk(const block_t &blk) {
+void HotStuffBase::on_fetch_blk(const block_t &blk, const PeerId *replica) {
 #ifdef HOTSTUFF_BLK_PROFILE
     blk_profiler.get_tx(blk->get_hash());
 #endif
@@ -98,6 +202,7 @@ void HotStuffBase::on_fetch_blk(const block_t &blk) {
     auto it = blk_fetch_waiting.find(blk_hash);
     if (it != blk_fetch_waiting.end())
     {
+        if (replica) it->second.on_response(*replica);
         it->second.resolve(blk);
         blk_fetch_waiting.erase(it);
     }
@@ -135,11 +240,14 @@ bool HotStuffBase::on_deliver_blk(const block_t &blk) {
             part_delivery_time_min = std::min(part_delivery_time_min, sec);
             part_delivery_time_max = std::max(part_delivery_time_max, sec);
 
+            /* children go on in run_delivery, not nested in this call */
+            for (const auto &child: pm.dependents)
+                delivery_steps.push(std::make_pair(child, false));
             pm.resolve(blk);
         }
         else
         {
-            pm.reject(blk);
+            /* erased below: what waits on the block is never run */
             res = false;
             // TODO: do we need to also free it from storage?
         }
@@ -171,38 +279,88 @@ promise_t HotStuffBase::async_fetch_blk(const uint256_t &blk_hash,
     return static_cast<promise_t &>(it->second);
 }
 
-promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash,
-                                        const PeerId &replica) {
-    if (storage->is_blk_delivered(blk_hash))
-        return promise_t([this, &blk_hash](promise_t pm) {
-            pm.resolve(storage->find_blk(blk_hash));
-        });
+deliver_promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash,
+                                        const PeerId &replica,
+                                        bool fetch_now) {
+    block_t blk = find_delivered_blk(blk_hash);
+    if (blk != nullptr)
+        return lwpromise::resolved(std::move(blk));
     auto it = blk_delivery_waiting.find(blk_hash);
     if (it != blk_delivery_waiting.end())
-        return static_cast<promise_t &>(it->second);
-    BlockDeliveryContext pm{[](promise_t){}};
+        return it->second;
+    BlockDeliveryContext pm{replica};
     it = blk_delivery_waiting.insert(std::make_pair(blk_hash, pm)).first;
     /* otherwise the on_deliver_batch will resolve */
-    async_fetch_blk(blk_hash, &replica).then([this, replica](block_t blk) {
-        /* qc_ref should be fetched */
-        std::vector<promise_t> pms;
-        const auto &qc = blk->get_qc();
-        assert(qc);
-        if (blk == get_genesis())
-            pms.push_back(promise_t([](promise_t &pm){ pm.resolve(true); }));
-        else
-            pms.push_back(blk->verify(this, vpool));
-        pms.push_back(async_fetch_blk(qc->get_obj_hash(), &replica));
-        /* the parents should be delivered */
-        for (const auto &phash: blk->get_parent_hashes())
-            pms.push_back(async_deliver_blk(phash, replica));
-        mypromise::all(pms).then([this, blk](const mypromise::values_t values) {
-            auto ret = mypromise::any_cast<bool>(values[0]) && this->on_deliver_blk(blk);
-            if (!ret)
-                HOTSTUFF_LOG_WARN("verification failed during async delivery");
-        });
+    async_fetch_blk(blk_hash, &replica, fetch_now).then([this](block_t blk) {
+        auto it = blk_delivery_waiting.find(blk->get_hash());
+        if (it == blk_delivery_waiting.end()) return;
+        it->second.blk = blk;
+        delivery_steps.push(std::make_pair(blk->get_hash(), true));
+        run_delivery();
     });
-    return static_cast<promise_t &>(pm);
+    return pm;
+}
+
+void HotStuffBase::expand_delivery(BlockDeliveryContext &ctx) {
+    const auto &blk = ctx.blk;
+    const uint256_t &blk_hash = blk->get_hash();
+    auto done = [this, blk_hash]() {
+        delivery_steps.push(std::make_pair(blk_hash, false));
+        run_delivery();
+    };
+    /* qc_ref should be fetched */
+    const auto &qc = blk->get_qc();
+    assert(qc);
+    ctx.nwaiting = 2;
+    async_fetch_blk(qc->get_obj_hash(), &ctx.replica).then(done);
+    (blk == get_genesis() ?
+        lwpromise::resolved(true) : blk->verify(this, vpool)).then(
+        [this, blk_hash, done](bool valid) {
+            /* the delivery may have been settled by a state transfer */
+            auto it = blk_delivery_waiting.find(blk_hash);
+            if (!valid && it != blk_delivery_waiting.end())
+                it->second.valid = false;
+            done();
+        });
+    /* the parents should be delivered: only the first visit of an ancestor
+     * starts its delivery, which is a fetch, never a walk down its chain */
+    for (const auto &phash: blk->get_parent_hashes())
+    {
+        if (find_delivered_blk(phash) != nullptr) continue;
+        /* a newly missing ancestor: fetch it along with its own ancestors
+         * in one round trip (the single fetch is left as the fallback on
+         * timeout) */
+        bool missing = !storage->is_blk_fetched(phash) &&
+                        !blk_fetch_waiting.count(phash);
+        if (missing)
+            pn.send_msg(MsgReqBlockRange(phash, blk_range_max), ctx.replica);
+        async_deliver_blk(phash, ctx.replica, !missing);
+        blk_delivery_waiting.at(phash).dependents.push_back(blk_hash);
+        ctx.nwaiting++;
+    }
+}
+
+void HotStuffBase::run_delivery() {
+    if (delivery_running) return;
+    delivery_running = true;
+    while (!delivery_steps.empty())
+    {
+        auto step = delivery_steps.front();
+        delivery_steps.pop();
+        auto it = blk_delivery_waiting.find(step.first);
+        if (it == blk_delivery_waiting.end()) continue;
+        auto &ctx = it->second;
+        if (step.second)
+            expand_delivery(ctx);
+        else
+            ctx.nwaiting--;
+        if (ctx.nwaiting) continue;
+        /* on_deliver_blk removes the context */
+        block_t blk = ctx.blk;
+        if (!(ctx.valid && on_deliver_blk(blk)))
+            HOTSTUFF_LOG_WARN("verification failed during async delivery");
+    }
+    delivery_running = false;
 }
 
 void HotStuffBase::propose_handler(MsgPropose &&msg, const Net::conn_t &conn) {
@@ -217,9 +375,7 @@ void HotStuffBase::propose_handler(MsgPropose &&msg, const Net::conn_t &conn) {
         LOG_WARN("invalid proposal from %d", prop.proposer);
         return;
     }
-    mypromise::all(std::vector<promise_t>{
-        async_deliver_blk(blk->get_hash(), peer)
-    }).then([this, prop = std::move(prop)]() {
+    async_deliver_blk(blk->get_hash(), peer).then([this, prop = std::move(prop)]() {
         on_receive_proposal(prop);
     });
 }
@@ -228,41 +384,624 @@ void HotStuffBase::vote_handler(MsgVote &&msg, const Net::conn_t &conn) {
     const auto &peer = conn->get_peer_id();
     if (peer.is_null()) return;
     msg.postponed_parse(this);
-    //auto &vote = msg.vote;
-    RcObj<Vote> v(new Vote(std::move(msg.vote)));
-    mypromise::all(std::vector<promise_t>{
-        async_deliver_blk(v->blk_hash, peer),
-        v->verify(vpool),
-    }).then([this, v=std::move(v)](const mypromise::values_t values) {
-        if (!mypromise::any_cast<bool>(values[1]))
-            LOG_WARN("invalid vote from %d", v->voter);
-        else
+    /* replica ids are dense, below nreplicas */
+    if (msg.vote.voter >= get_config().nreplicas)
+    {
+        part_vote_dropped++;
+        return;
+    }
+    BoxObj<Vote> v(new Vote(std::move(msg.vote)));
+    block_t blk = find_delivered_blk(v->blk_hash);
+    auto it = vote_ingest.find(v->blk_hash);
+    if (it == vote_ingest.end())
+    {
+        /* votes for a block not seen yet are held for a few of them only */
+        if (!blk && (is_vote_stale(v->blk_hash) ||
+            vote_ingest_undelivered.size() >= vote_ingest_undelivered_max))
+        {
+            part_vote_dropped++;
+            return;
+        }
+        it = vote_ingest.emplace(v->blk_hash, VoteIngestContext()).first;
+        if (!blk)
+            vote_ingest_undelivered.push(std::make_pair(
+                get_b_exec()->get_height(), v->blk_hash));
+    }
+    /* duplicates are dropped before any verification: a voter counts once
+     * verified, and until then once per peer relaying its vote */
+    auto &ctx = it->second;
+    bool direct = get_config().get_peer_id(v->voter) == peer;
+    if (ctx.verified.contains(v->voter) ||
+        !ctx.get_candidates(peer, direct).insert(v->voter, get_config().nreplicas))
+    {
+        part_vote_dropped++;
+        return;
+    }
+    /* the common case, with nothing to wait for */
+    if (blk)
+    {
+        ingest_vote(blk, std::move(v), peer);
+        return;
+    }
+    async_deliver_blk(v->blk_hash, peer).then([this, v=std::move(v), peer](const block_t &blk) mutable {
+        ingest_vote(blk, std::move(v), peer);
+    });
+}
+
+void HotStuffBase::ingest_vote(const block_t &blk, BoxObj<Vote> &&v, const PeerId &peer) {
+    auto it = vote_ingest.find(blk->get_hash());
+    /* dropped while the block was on its way */
+    if (it == vote_ingest.end())
+    {
+        part_vote_dropped++;
+        return;
+    }
+    auto &ctx = it->second;
+    ctx.delivered = true;
+    /* straight to verification unless votes are already held back */
+    if (ctx.deferred.empty() && ctx.nverifying < get_nvotes_needed(blk))
+    {
+        verify_vote(blk, ctx, std::move(v), peer);
+        return;
+    }
+    ctx.deferred.push(std::make_pair(std::move(v), peer));
+    drain_votes(blk);
+}
+
+void HotStuffBase::verify_vote(const block_t &blk, VoteIngestContext &ctx,
+                            BoxObj<Vote> &&v, const PeerId &peer) {
+    ctx.nverifying++;
+    part_vote_verified++;
+    v->verify(vpool, ctx.token).then([this, blk, v=std::move(v), peer,
+                                    token=ctx.token](bool valid) {
+        /* the context is kept while it has ongoing verifications, unless the
+         * block has been pruned, after which a later vote may have opened
+         * another one */
+        auto it = vote_ingest.find(blk->get_hash());
+        if (it == vote_ingest.end() ||
+            it->second.token.get() != token.get()) return;
+        auto &ctx = it->second;
+        ctx.nverifying--;
+        /* let the next vote of the voter from the peer in */
+        bool direct = get_config().get_peer_id(v->voter) == peer;
+        ctx.get_candidates(peer, direct).erase(v->voter);
+        if (valid)
+        {
+            ctx.verified.insert(v->voter, get_config().nreplicas);
             on_receive_vote(*v);
+        }
+        else if (!ctx.token->load(std::memory_order_relaxed))
+            LOG_WARN("invalid vote from %d", v->voter);
+        drain_votes(blk);
     });
 }
 
+void HotStuffBase::drain_votes(const block_t &blk) {
+    auto it = vote_ingest.find(blk->get_hash());
+    if (it == vote_ingest.end()) return;
+    auto &ctx = it->second;
+    size_t needed = get_nvotes_needed(blk);
+    while (ctx.nverifying < needed && !ctx.deferred.empty())
+    {
+        auto e = std::move(ctx.deferred.front());
+        ctx.deferred.pop();
+        if (ctx.verified.contains(e.first->voter))
+        {
+            /* another copy of the vote has been verified meanwhile */
+            bool direct = get_config().get_peer_id(e.first->voter) == e.second;
+            ctx.get_candidates(e.second, direct).erase(e.first->voter);
+            part_vote_dropped++;
+            continue;
+        }
+        verify_vote(blk, ctx, std::move(e.first), e.second);
+    }
+    if (needed) return;
+    /* the QC is finished, the rest of the votes are surplus */
+    part_vote_dropped += ctx.deferred.size();
+    ctx.deferred = std::queue<std::pair<BoxObj<Vote>, PeerId>>();
+    if (ctx.nverifying)
+        ctx.token->store(true, std::memory_order_relaxed);
+    else
+        vote_ingest.erase(it);
+}
+
+bool HotStuffBase::is_vote_stale(const uint256_t &blk_hash) const {
+    if (vote_ingest_pruned.count(blk_hash)) return true;
+    uint32_t height;
+    return ledger && ledger->find_height(blk_hash, height);
+}
+
+void HotStuffBase::expire_vote_ingest() {
+    uint32_t exec_height = get_b_exec()->get_height();
+    while (!vote_ingest_pruned_queue.empty())
+    {
+        auto &e = vote_ingest_pruned_queue.front();
+        if (e.first + vote_ingest_expiry > exec_height) break;
+        vote_ingest_pruned.erase(e.second);
+        vote_ingest_pruned_queue.pop();
+    }
+    while (!vote_ingest_undelivered.empty())
+    {
+        auto &e = vote_ingest_undelivered.front();
+        if (e.first + vote_ingest_expiry > exec_height) break;
+        auto it = vote_ingest.find(e.second);
+        if (it != vote_ingest.end() && !it->second.delivered)
+        {
+            part_vote_dropped += it->second.get_ncandidates();
+            vote_ingest.erase(it);
+        }
+        vote_ingest_undelivered.pop();
+    }
+}
+
 void HotStuffBase::req_blk_handler(MsgReqBlock &&msg, const Net::conn_t &conn) {
     const PeerId replica = conn->get_peer_id();
     if (replica.is_null()) return;
     auto &blk_hashes = msg.blk_hashes;
     std::vector<promise_t> pms;
+    /* committed blocks no longer in memory are copied from the ledger */
+    std::vector<uint32_t> stored;
     for (const auto &h: blk_hashes)
-        pms.push_back(async_fetch_blk(h, nullptr));
-    mypromise::all(pms).then([replica, this](const mypromise::values_t values) {
+    {
+        uint32_t height;
+        bool fetched = storage->is_blk_fetched(h);
+        if (!fetched && ledger && ledger->find_height(h, height))
+            stored.push_back(height);
+        else if (fetched || blk_fetch_waiting.count(h))
+            pms.push_back(async_fetch_blk(h, nullptr));
+        /* pruned without a ledger, or never seen: the block is left out
+         * rather than waited for, as nothing would fetch it */
+    }
+    auto send = [replica, stored, this](std::vector<block_t> &&blks) {
+        std::vector<Ledger::blob_t> blobs;
+        for (auto height: stored)
+        {
+            Ledger::blob_t blob;
+            if (ledger->get_blk(height, blob)) blobs.push_back(blob);
+        }
+        pn.send_msg(MsgRespBlock(blks, blobs), replica);
+    };
+    if (pms.empty())
+    {
+        send(std::vector<block_t>());
+        return;
+    }
+    mypromise::all(pms).then([send](const mypromise::values_t values) {
         std::vector<block_t> blks;
         for (auto &v: values)
         {
             auto blk = mypromise::any_cast<block_t>(v);
             blks.push_back(blk);
         }
-        pn.send_msg(MsgRespBlock(blks), replica);
+        send(std::move(blks));
     });
 }
 
-void HotStuffBase::resp_blk_handler(MsgRespBlock &&msg, const Net::conn_t &) {
+void HotStuffBase::resp_blk_handler(MsgRespBlock &&msg, const Net::conn_t &conn) {
+    const PeerId replica = conn->get_peer_id();
+    msg.postponed_parse(this);
+    for (const auto &blk: msg.blks)
+        if (blk) on_fetch_blk(blk, &replica);
+}
+
+void HotStuffBase::req_blk_range_handler(MsgReqBlockRange &&msg, const Net::conn_t &conn) {
+    const PeerId replica = conn->get_peer_id();
+    if (replica.is_null()) return;
+    std::vector<block_t> blks;
+    /* the part of the range only found in the ledger, newest first */
+    std::vector<Ledger::blob_t> blobs;
+    uint32_t height;
+    if (msg.type == MsgReqBlockRange::RANGE_ANCESTORS)
+    {
+        uint32_t nblks = std::min(msg.nblks, blk_range_max);
+        auto blk = storage->find_blk(msg.blk_hash);
+        uint256_t next_hash = msg.blk_hash;
+        for (; blk && blks.size() < nblks;)
+        {
+            blks.push_back(blk);
+            const auto &phashes = blk->get_parent_hashes();
+            if (phashes.empty()) break;
+            next_hash = phashes[0];
+            blk = storage->find_blk(next_hash);
+        }
+        /* the older ancestors are committed and may have been pruned */
+        if (!blk && ledger && ledger->find_height(next_hash, height))
+        {
+            Ledger::blob_t blob;
+            for (; blks.size() + blobs.size() < nblks &&
+                    ledger->get_blk(height, blob); height--)
+                blobs.push_back(blob);
+        }
+    }
+    else if (ledger && msg.from_height >= ledger->get_base_height() &&
+            msg.from_height < ledger->get_end_height())
+    {
+        uint32_t to_height = std::min({msg.to_height,
+                                    msg.from_height + blk_range_max - 1,
+                                    ledger->get_end_height() - 1});
+        Ledger::blob_t blob;
+        for (height = to_height + 1; height-- > msg.from_height;)
+            if (ledger->get_blk(height, blob)) blobs.push_back(blob);
+    }
+    else
+    {
+        /* heights on the committed chain are consecutive: send the lowest
+         * blk_range_max of the range */
+        uint32_t to_height = std::min(msg.to_height,
+                                    msg.from_height + blk_range_max - 1);
+        /* start from the top of the range; if it is not indexed, only walk
+         * down from b_exec over the blocks restored below it, and otherwise
+         * (pruned, and not in the ledger) send nothing */
+        block_t blk = get_b_exec();
+        if (to_height < blk->get_height())
+        {
+            auto it = exec_hashes.find(to_height);
+            if (it != exec_hashes.end())
+                blk = storage->find_blk(it->second);
+            else if (blk->get_height() - to_height > recover_depth)
+                blk = nullptr;
+        }
+        for (; blk && blk->get_height() >= msg.from_height;)
+        {
+            if (blk->get_height() <= to_height)
+                blks.push_back(blk);
+            const auto &phashes = blk->get_parent_hashes();
+            if (phashes.empty()) break;
+            blk = storage->find_blk(phashes[0]);
+        }
+    }
+    std::reverse(blks.begin(), blks.end());
+    std::reverse(blobs.begin(), blobs.end());
+    pn.send_msg(MsgRespBlockRange(blks, blobs), replica);
+}
+
+void HotStuffBase::resp_blk_range_handler(MsgRespBlockRange &&msg, const Net::conn_t &conn) {
+    const PeerId replica = conn->get_peer_id();
     msg.postponed_parse(this);
+    /* oldest first, so the walk of a delivery finds the ancestors in place */
     for (const auto &blk: msg.blks)
-        if (blk) on_fetch_blk(blk);
+        if (blk) on_fetch_blk(blk, &replica);
+}
+
+void HotStuffBase::fetch_blk_range(uint32_t from_height, uint32_t to_height,
+                                    const PeerId &replica) {
+    pn.send_msg(MsgReqBlockRange(from_height, to_height), replica);
+}
+
+void HotStuffBase::ckpt_vote_handler(MsgCheckpointVote &&msg, const Net::conn_t &conn) {
+    const PeerId &peer = conn->get_peer_id();
+    if (peer.is_null() || !ckpt_interval) return;
+    msg.postponed_parse(this);
+    uint32_t height = msg.height;
+    if ((stable_ckpt && height <= stable_ckpt->height) ||
+        height % ckpt_interval)
+        return;
+    RcObj<Vote> v(new Vote(std::move(msg.vote)));
+    v->verify(vpool).then([this, height, v=std::move(v)](bool valid) {
+        if (valid)
+            on_checkpoint_vote(height, *v);
+        else
+            LOG_WARN("invalid checkpoint vote from %d", v->voter);
+    });
+}
+
+void HotStuffBase::req_snapshot_handler(MsgReqSnapshot &&msg, const Net::conn_t &conn) {
+    const PeerId replica = conn->get_peer_id();
+    if (replica.is_null()) return;
+    /* only the stable checkpoint is served, the others are asked for
+     * anything else */
+    if (!stable_ckpt || stable_ckpt->height != msg.height) return;
+    if (msg.chunk != MsgReqSnapshot::manifest &&
+        msg.chunk >= stable_ckpt->chunk_hashes.size())
+        return;
+    pn.send_msg(MsgRespSnapshot(*stable_ckpt, msg.chunk), replica);
+}
+
+void HotStuffBase::resp_snapshot_handler(MsgRespSnapshot &&msg, const Net::conn_t &conn) {
+    const PeerId replica = conn->get_peer_id();
+    if (replica.is_null() || !transfer || msg.height != transfer->height) return;
+    auto &t = *transfer;
+    auto &s = msg.serialized;
+    if (msg.chunk == MsgReqSnapshot::manifest)
+    {
+        if (t.has_manifest) return;
+        uint256_t blk_hash;
+        uint32_t size;
+        s >> blk_hash >> size;
+        size = letoh(size);
+        std::vector<uint256_t> chunk_hashes(Checkpoint::get_nchunks(size));
+        for (auto &h: chunk_hashes) s >> h;
+        /* the manifest must be what the QC is for */
+        if (Checkpoint::get_digest(t.height, blk_hash, size, chunk_hashes) != t.digest)
+        {
+            LOG_WARN("invalid snapshot manifest from %d", get_config().get_rid(replica));
+            return;
+        }
+        t.has_manifest = true;
+        t.blk_hash = blk_hash;
+        t.data.resize(size);
+        t.chunk_hashes = std::move(chunk_hashes);
+        t.received.assign(t.chunk_hashes.size(), false);
+        if (t.received.empty())
+            finish_transfer();
+        else
+            request_snapshot();
+        return;
+    }
+    if (!t.has_manifest || msg.chunk >= t.received.size() || t.received[msg.chunk])
+        return;
+    size_t offset = (size_t)msg.chunk * snapshot_chunk_size;
+    size_t len = std::min(t.data.size() - offset, (size_t)snapshot_chunk_size);
+    if (s.size() != len ||
+        Checkpoint::get_chunk_hash(s.data(), len) != t.chunk_hashes[msg.chunk])
+    {
+        LOG_WARN("invalid snapshot chunk from %d", get_config().get_rid(replica));
+        return;
+    }
+    std::copy(s.data(), s.data() + len, t.data.begin() + offset);
+    t.received[msg.chunk] = true;
+    if (++t.nreceived == t.received.size())
+    {
+        finish_transfer();
+        return;
+    }
+    /* keep the window full */
+    if (t.next_chunk < t.received.size())
+        pn.send_msg(MsgReqSnapshot(t.height, t.next_chunk++), t.replicas[t.replica_idx]);
+    t.timeout.del();
+    t.timeout.add(fetch_latency.get_timeout());
+}
+
+void HotStuffBase::make_checkpoint(const block_t &blk) {
+    uint32_t height = blk->get_height();
+    bytearray_t snapshot;
+    if (!state_machine_snapshot(height, snapshot)) return;
+    pending_ckpt = new Checkpoint(height, blk->get_hash(), std::move(snapshot));
+    const uint256_t digest = pending_ckpt->digest;
+    Vote vote(get_id(), digest, sign(digest), this);
+    pn.multicast_msg(MsgCheckpointVote(height, vote), peers);
+    on_checkpoint_vote(height, vote);
+    /* the others may have finished the QC before this replica got here */
+    if (pending_ckpt && pending_ckpt->height == height &&
+        ckpt_votes[height].digests[digest].voters.size() >= get_config().nmajority)
+        on_checkpoint_certified(height, digest);
+}
+
+void HotStuffBase::on_checkpoint_vote(uint32_t height, const Vote &vote) {
+    uint32_t base = stable_ckpt ? stable_ckpt->height : 0;
+    if (height <= base || height % ckpt_interval) return;
+    if (height - base > ckpt_vote_window * ckpt_interval)
+    {
+        on_checkpoint_vote_ahead(height, vote);
+        return;
+    }
+    auto &hvotes = ckpt_votes[height];
+    if (!hvotes.voters.insert(vote.voter).second) return;
+    auto &votes = hvotes.digests[vote.blk_hash];
+    if (votes.voters.size() >= get_config().nmajority ||
+        !votes.voters.insert(vote.voter).second)
+        return;
+    if (!votes.qc) votes.qc = create_quorum_cert(vote.blk_hash);
+    votes.qc->add_part(vote.voter, *vote.cert);
+    if (votes.voters.size() < get_config().nmajority) return;
+    votes.qc->compute();
+    on_checkpoint_certified(height, vote.blk_hash);
+}
+
+void HotStuffBase::on_checkpoint_vote_ahead(uint32_t height, const Vote &vote) {
+    auto it = ckpt_votes_ahead.find(vote.voter);
+    if (it != ckpt_votes_ahead.end())
+    {
+        if (height <= it->second.first) return;
+        ckpt_votes_ahead.erase(it);
+    }
+    ckpt_votes_ahead.emplace(vote.voter, std::make_pair(height, vote));
+    /* a majority of the latest votes on the same checkpoint certifies it */
+    std::vector<const Vote *> same;
+    for (const auto &e: ckpt_votes_ahead)
+        if (e.second.first == height && e.second.second.blk_hash == vote.blk_hash)
+            same.push_back(&e.second.second);
+    if (same.size() < get_config().nmajority) return;
+    auto &votes = ckpt_votes[height].digests[vote.blk_hash];
+    if (votes.qc) return;
+    votes.qc = create_quorum_cert(vote.blk_hash);
+    for (auto v: same)
+    {
+        votes.voters.insert(v->voter);
+        votes.qc->add_part(v->voter, *v->cert);
+    }
+    votes.qc->compute();
+    on_checkpoint_certified(height, vote.blk_hash);
+}
+
+void HotStuffBase::on_checkpoint_certified(uint32_t height, const uint256_t &digest) {
+    auto &votes = ckpt_votes[height].digests[digest];
+    if (pending_ckpt && pending_ckpt->height == height)
+    {
+        if (pending_ckpt->digest != digest)
+        {
+            LOG_WARN("checkpoint at height %u differs from the certified one", height);
+            return;
+        }
+        pending_ckpt->qc = votes.qc->clone();
+        set_stable_checkpoint(std::move(pending_ckpt));
+    }
+    else if (ckpt_interval && !transfer &&
+            height >= get_b_exec()->get_height() + (state_lost ? 1 : ckpt_interval))
+        start_transfer(height, digest);
+}
+
+void HotStuffBase::set_stable_checkpoint(BoxObj<Checkpoint> &&ckpt) {
+    stable_ckpt = std::move(ckpt);
+    uint32_t height = stable_ckpt->height;
+    ckpt_votes.erase(ckpt_votes.begin(), ckpt_votes.upper_bound(height));
+    for (auto it = ckpt_votes_ahead.begin(); it != ckpt_votes_ahead.end();)
+        if (it->second.first <= height)
+            it = ckpt_votes_ahead.erase(it);
+        else
+            it++;
+    if (pending_ckpt && pending_ckpt->height <= height)
+        pending_ckpt = nullptr;
+    if (ledger)
+    {
+        /* on disk before the blocks it stands for are dropped */
+        ledger->put_checkpoint(encode_checkpoint(*stable_ckpt));
+        ledger->truncate(height);
+    }
+    LOG_INFO("checkpoint at height %u is stable", height);
+}
+
+void HotStuffBase::start_transfer(uint32_t height, const uint256_t &digest) {
+    auto &votes = ckpt_votes[height].digests[digest];
+    std::vector<PeerId> replicas;
+    for (auto rid: votes.voters)
+        if (rid != get_id())
+            replicas.push_back(get_config().get_peer_id(rid));
+    if (replicas.empty()) return;
+    /* the most responsive replicas first */
+    std::sort(replicas.begin(), replicas.end(),
+        [this](const PeerId &a, const PeerId &b) {
+            return get_fetch_score(a) < get_fetch_score(b);
+        });
+    LOG_INFO("%u commits behind, fetching the checkpoint at height %u",
+            height - get_b_exec()->get_height(), height);
+    transfer = new SnapshotTransfer(height, digest, votes.qc->clone(), std::move(replicas));
+    transfer->timeout = TimerEvent(ec, [this](TimerEvent &) {
+        /* ask the next replica for what is still missing */
+        transfer->replica_idx = (transfer->replica_idx + 1) % transfer->replicas.size();
+        request_snapshot();
+    });
+    request_snapshot();
+}
+
+void HotStuffBase::request_snapshot() {
+    auto &t = *transfer;
+    const auto &replica = t.replicas[t.replica_idx];
+    if (!t.has_manifest)
+        pn.send_msg(MsgReqSnapshot(t.height, MsgReqSnapshot::manifest), replica);
+    else
+    {
+        /* the chunks asked for and not received, then new ones */
+        uint32_t nasked = 0;
+        for (uint32_t i = 0; i < t.next_chunk; i++)
+            if (!t.received[i])
+            {
+                pn.send_msg(MsgReqSnapshot(t.height, i), replica);
+                nasked++;
+            }
+        for (; nasked < snapshot_fetch_window && t.next_chunk < t.received.size(); nasked++)
+            pn.send_msg(MsgReqSnapshot(t.height, t.next_chunk++), replica);
+    }
+    t.timeout.del();
+    t.timeout.add(fetch_latency.get_timeout());
+}
+
+void HotStuffBase::finish_transfer() {
+    auto &t = *transfer;
+    t.fetching_blk = true;
+    /* the checkpoint block is where the chain goes on from: ask the
+     * replicas in turn, and give the transfer up if none sends it */
+    t.timeout = TimerEvent(ec, [this](TimerEvent &) {
+        auto &t = *transfer;
+        if (++t.nblk_asked == t.replicas.size())
+        {
+            LOG_WARN("state transfer: the block of the checkpoint at "
+                    "height %u is not found", t.height);
+            /* a later certified checkpoint starts over */
+            transfer = nullptr;
+            return;
+        }
+        t.replica_idx = (t.replica_idx + 1) % t.replicas.size();
+        async_fetch_blk(t.blk_hash, &t.replicas[t.replica_idx]);
+        t.timeout.add(fetch_latency.get_timeout());
+    });
+    t.timeout.add(fetch_latency.get_timeout());
+    const uint32_t t_height = t.height;
+    async_fetch_blk(t.blk_hash, &t.replicas[t.replica_idx]).then([this, t_height](block_t blk) {
+        /* given up meanwhile */
+        if (!transfer || !transfer->fetching_blk || transfer->height != t_height)
+            return;
+        auto &t = *transfer;
+        t.timeout.del();
+        BoxObj<Checkpoint> ckpt = new Checkpoint(t.height, t.blk_hash, std::move(t.data));
+        ckpt->qc = std::move(t.qc);
+        t.elapsed.stop(false);
+        double elapsed = t.elapsed.elapsed_sec;
+        transfer = nullptr;
+        uint32_t height = ckpt->height;
+        if (height <= get_b_exec()->get_height())
+        {
+            LOG_INFO("caught up before the checkpoint at height %u was fetched", height);
+            return;
+        }
+        state_machine_restore(height, ckpt->data);
+        state_lost = false;
+        on_restore_blk(blk, height, true);
+        on_restore_state(height, blk, blk, nullptr, nullptr);
+        settle_deliveries(blk, height);
+        do_persist_blk(blk);
+        do_persist_b_lock(blk);
+        do_persist_b_exec(blk);
+        LOG_INFO("state transfer: checkpoint at height %u, %lu bytes in %.3f sec",
+                height, ckpt->data.size(), elapsed);
+        set_stable_checkpoint(std::move(ckpt));
+        run_delivery();
+    });
+}
+
+void HotStuffBase::settle_deliveries(const block_t &blk, uint32_t height) {
+    std::vector<uint256_t> dropped;
+    for (auto &e: blk_delivery_waiting)
+    {
+        const auto &b = e.second.blk;
+        /* not fetched yet: the delivery fails on the parents when it is */
+        if (b == nullptr || b == blk || b->get_height() > height) continue;
+        dropped.push_back(e.first);
+    }
+    /* then what waits on them, which would never be delivered */
+    for (size_t i = 0; i < dropped.size(); i++)
+    {
+        auto it = blk_delivery_waiting.find(dropped[i]);
+        if (it == blk_delivery_waiting.end()) continue;
+        for (const auto &child: it->second.dependents)
+            if (child != blk->get_hash()) dropped.push_back(child);
+        blk_delivery_waiting.erase(it);
+    }
+    /* the restored block is delivered: what waits on it goes on */
+    auto it = blk_delivery_waiting.find(blk->get_hash());
+    if (it != blk_delivery_waiting.end())
+    {
+        auto &pm = it->second;
+        for (const auto &child: pm.dependents)
+            delivery_steps.push(std::make_pair(child, false));
+        pm.resolve(blk);
+        blk_delivery_waiting.erase(it);
+    }
+}
+
+bytearray_t HotStuffBase::encode_checkpoint(const Checkpoint &ckpt) const {
+    DataStream s;
+    s << htole(ckpt.height) << ckpt.blk_hash << *ckpt.qc
+      << htole((uint32_t)ckpt.data.size());
+    s.put_data(ckpt.data.data(), ckpt.data.data() + ckpt.data.size());
+    return bytearray_t(std::move(s));
+}
+
+BoxObj<Checkpoint> HotStuffBase::decode_checkpoint(const bytearray_t &data) {
+    DataStream s(data.data(), data.data() + data.size());
+    uint32_t height, size;
+    uint256_t blk_hash;
+    s >> height >> blk_hash;
+    quorum_cert_bt qc = parse_quorum_cert(s);
+    s >> size;
+    size = letoh(size);
+    auto snapshot = s.get_data_inplace(size);
+    BoxObj<Checkpoint> ckpt = new Checkpoint(letoh(height), blk_hash,
+                                            bytearray_t(snapshot, snapshot + size));
+    if (ckpt->digest != qc->get_obj_hash() || !qc->verify(get_config()))
+        throw HotStuffError("the stored checkpoint does not match its QC");
+    ckpt->qc = std::move(qc);
+    return ckpt;
 }
 
 void HotStuffBase::slice_handler(MsgSlice &&msg, const Net::conn_t &conn) {
@@ -304,7 +1043,7 @@ void HotStuffBase::print_stat() const {
     LOG_INFO("fetched: %lu", fetched);
     LOG_INFO("delivered: %lu", delivered);
     LOG_INFO("cmd_cache: %lu", storage->get_cmd_cache_size());
-    LOG_INFO("blk_cache: %lu", storage->get_blk_cache_size());
+    LOG_INFO("blk_cache: %lu, %u pruned", storage->get_blk_cache_size(), part_pruned);
     LOG_INFO("------ misc (10s) -----");
     LOG_INFO("fetched: %lu", part_fetched);
     LOG_INFO("delivered: %lu", part_delivered);
@@ -316,6 +1055,34 @@ void HotStuffBase::print_stat() const {
             part_delivered ? part_delivery_time / double(part_delivered) : 0,
             part_delivery_time_min == double_inf ? 0 : part_delivery_time_min,
             part_delivery_time_max);
+    LOG_INFO("committed (proposed by self): %lu", part_committed);
+    LOG_INFO("commit latency: %.4f avg, %.4f min, %.4f max",
+            part_committed ? part_commit_time / double(part_committed) : 0,
+            part_commit_time_min == double_inf ? 0 : part_commit_time_min,
+            part_commit_time_max);
+    LOG_INFO("votes: %lu verified, %lu dropped",
+            part_vote_verified, part_vote_dropped);
+    LOG_INFO("fetch: %.4f hedge delay, %.4f timeout",
+            fetch_latency.get_hedge_delay(), fetch_latency.get_timeout());
+    LOG_INFO("veri_pool: depth %lu, %lu done, latency %.6f avg, %.6f max",
+            vpool.get_depth(), vpool.get_ndone(),
+            vpool.get_latency_avg(), vpool.get_latency_max());
+    vpool.clear_stat();
+    if (safety_log)
+    {
+        LOG_INFO("safety_log: %lu batches, %.1f records, %.0f bytes avg, "
+                "fsync %.6f avg, %.6f max",
+                safety_log->get_nbatches(),
+                safety_log->get_batch_records_avg(),
+                safety_log->get_batch_bytes_avg(),
+                safety_log->get_fsync_time_avg(),
+                safety_log->get_fsync_time_max());
+        safety_log->clear_stat();
+    }
+    if (stable_ckpt)
+        LOG_INFO("checkpoint: stable at height %u, %lu bytes in %lu chunks",
+                stable_ckpt->height, stable_ckpt->data.size(),
+                stable_ckpt->chunk_hashes.size());
 
     part_parent_size = 0;
     part_fetched = 0;
@@ -325,6 +1092,13 @@ void HotStuffBase::print_stat() const {
     part_delivery_time = 0;
     part_delivery_time_min = double_inf;
     part_delivery_time_max = 0;
+    part_committed = 0;
+    part_commit_time = 0;
+    part_commit_time_min = double_inf;
+    part_commit_time_max = 0;
+    part_vote_verified = 0;
+    part_vote_dropped = 0;
+    part_pruned = 0;
 #ifdef HOTSTUFF_MSG_STAT
     LOG_INFO("--- replica msg. (10s) ---");
     size_t _nsent = 0;
@@ -362,16 +1136,26 @@ HotStuffBase::HotStuffBase(uint32_t blk_size,
                     pacemaker_bt pmaker,
                     EventContext ec,
                     size_t nworker,
-                    const Net::Config &netconfig):
-        HotStuffCore(rid, std::move(priv_key)),
+                    const Net::Config &netconfig,
+                    uint8_t nchain):
+        HotStuffCore(rid, std::move(priv_key), nchain),
         listen_addr(listen_addr),
         blk_size(blk_size),
         ec(ec),
         tcall(ec),
         vpool(ec, nworker),
+        ckpt_interval(0),
+        state_lost(false),
         pn(ec, netconfig),
         pmaker(std::move(pmaker)),
+        delivery_running(false),
+        fast_qc_timeout(0.01),
+        prune_retention(prune_retention_default),
+        prune_set(false),
+        prune_blk_max(0),
+        prune_scheduled(false),
 
+        start_time(0), first_vote_sent(false), first_vote_delay(0),
         fetched(0), delivered(0),
         nsent(0), nrecv(0),
         part_parent_size(0),
@@ -381,14 +1165,26 @@ HotStuffBase::HotStuffBase(uint32_t blk_size,
         part_gened(0),
         part_delivery_time(0),
         part_delivery_time_min(double_inf),
-        part_delivery_time_max(0)
+        part_delivery_time_max(0),
+        part_committed(0),
+        part_commit_time(0),
+        part_commit_time_min(double_inf),
+        part_commit_time_max(0),
+        part_vote_verified(0),
+        part_vote_dropped(0),
+        part_pruned(0)
 {
     /* register the handlers for msg from replicas */
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::propose_handler, this, _1, _2));
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::vote_handler, this, _1, _2));
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_blk_handler, this, _1, _2));
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::resp_blk_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_blk_range_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::resp_blk_range_handler, this, _1, _2));
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::slice_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::ckpt_vote_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_snapshot_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::resp_snapshot_handler, this, _1, _2));
     pn.reg_conn_handler(salticidae::generic_bind(&HotStuffBase::conn_handler, this, _1, _2));
     pn.reg_error_handler([](const std::exception_ptr _err, bool fatal, int32_t async_id) {
         try {
@@ -399,6 +1195,22 @@ HotStuffBase::HotStuffBase(uint32_t blk_size,
     });
     pn.start();
     pn.listen(listen_addr);
+    prune_timer = TimerEvent(ec, [this](TimerEvent &) {
+        prune_scheduled = false;
+        uint32_t staleness = prune_retention;
+        if (prune_blk_max && storage->get_blk_cache_size() > prune_blk_max)
+            staleness = std::min(staleness, recover_depth);
+        size_t n = prune(staleness, prune_batch);
+        part_pruned += n;
+        /* the rest in the next iterations, letting other events in */
+        if (n == prune_batch) schedule_prune();
+    });
+}
+
+void HotStuffBase::schedule_prune() {
+    if (!prune_retention || prune_scheduled) return;
+    prune_scheduled = true;
+    prune_timer.add(0);
 }
 
 void HotStuffBase::do_broadcast_slice(const Slice &slice) {
@@ -417,6 +1229,8 @@ void HotStuffBase::do_broadcast_proposal_with_slice(const std::vector<Proposal>
     // pn.multicast_msg(MsgPropose(prop), peers);
     //for (const auto &replica: peers)
     //    pn.send_msg(prop_msg, replica);
+    auto &et = commit_timers[props[0].blk->get_hash()];
+    et.start();
     for(auto peer: peers) {
         auto rid = get_config().get_rid(peer);
         pn.send_msg(MsgPropose(props[rid]), peer);
@@ -424,25 +1238,132 @@ void HotStuffBase::do_broadcast_proposal_with_slice(const std::vector<Proposal>
 }
 
 void HotStuffBase::do_vote(ReplicaID last_proposer, const Vote &vote) {
-    pmaker->beat_resp(last_proposer)
-            .then([this, vote](ReplicaID proposer) {
-        if (proposer == get_id())
-        {
-            //throw HotStuffError("unreachable line");
-            on_receive_vote(vote);
-        }
-        else
-            pn.send_msg(MsgVote(vote), get_config().get_peer_id(proposer));
+    auto send = [this, last_proposer, vote]() {
+        pmaker->beat_resp(last_proposer)
+                .then([this, vote](ReplicaID proposer) {
+            if (proposer == get_id())
+            {
+                //throw HotStuffError("unreachable line");
+                on_receive_vote(vote);
+            }
+            else
+                pn.send_msg(MsgVote(vote), get_config().get_peer_id(proposer));
+            if (!first_vote_sent)
+            {
+                first_vote_sent = true;
+                first_vote_delay = fetch_clock() - start_time;
+                LOG_INFO("first vote %.3f sec after start", first_vote_delay);
+            }
+        });
+    };
+    /* the vote must not leave before the state it commits to is durable */
+    if (safety_log)
+        safety_log->after_flush(std::move(send));
+    else
+        send();
+}
+
+void HotStuffBase::do_persist_blk(const block_t &blk) {
+    if (!safety_log) return;
+    DataStream s;
+    s << htole(blk->get_height()) << *blk;
+    safety_log->append(SafetyLog::REC_BLOCK, bytearray_t(std::move(s)));
+}
+
+void HotStuffBase::do_persist_vote(const block_t &blk) {
+    if (!safety_log) return;
+    voted = std::make_pair(blk->get_hash(), blk->get_height());
+    DataStream s;
+    s << blk->get_hash() << htole(blk->get_height());
+    safety_log->append(SafetyLog::REC_VOTE, bytearray_t(std::move(s)));
+}
+
+void HotStuffBase::do_persist_b_lock(const block_t &blk) {
+    if (!safety_log) return;
+    DataStream s;
+    s << blk->get_hash() << htole(blk->get_height());
+    safety_log->append(SafetyLog::REC_B_LOCK, bytearray_t(std::move(s)));
+}
+
+void HotStuffBase::do_persist_b_exec(const block_t &blk) {
+    if (!safety_log) return;
+    DataStream s;
+    s << blk->get_hash() << htole(blk->get_height());
+    safety_log->append(SafetyLog::REC_B_EXEC, bytearray_t(std::move(s)));
+    /* the records below the new b_exec are mostly stale by now */
+    if (safety_log->get_size() >= std::max(safety_log_compact_size,
+                                        2 * safety_log->get_base_size()))
+        safety_log->compact(get_safety_records());
+}
+
+void HotStuffBase::do_persist_commit(const block_t &blk,
+                                    const std::vector<uint256_t> &cmds) {
+    /* the ledger and the state go on from the next checkpoint */
+    if (state_lost) return;
+    if (ledger) ledger->append(blk, cmds);
+    /* the commands of blk have been executed by now */
+    if (ckpt_interval && blk->get_height() % ckpt_interval == 0)
+        make_checkpoint(blk);
+}
+
+void HotStuffBase::do_persist_hqc(const block_t &blk, const QuorumCert &qc) {
+    if (!safety_log) return;
+    DataStream s;
+    s << blk->get_hash() << htole(blk->get_height()) << qc;
+    safety_log->append(SafetyLog::REC_HQC, bytearray_t(std::move(s)));
+}
+
+void HotStuffBase::do_fast_qc_wait(const block_t &blk) {
+    const uint256_t blk_hash = blk->get_hash();
+    auto &timer = fast_qc_timers[blk_hash];
+    timer = TimerEvent(ec, [this, blk, blk_hash](TimerEvent &) {
+        on_fast_qc_timeout(blk);
+        /* votes still being verified are no longer needed */
+        drain_votes(blk);
+        fast_qc_timers.erase(blk_hash);
     });
+    timer.add(fast_qc_timeout);
 }
 
 void HotStuffBase::do_consensus(const block_t &blk) {
+    auto it = commit_timers.find(blk->get_hash());
+    if (it != commit_timers.end())
+    {
+        auto &et = it->second;
+        et.stop(false);
+        auto sec = et.elapsed_sec;
+        part_commit_time += sec;
+        part_commit_time_min = std::min(part_commit_time_min, sec);
+        part_commit_time_max = std::max(part_commit_time_max, sec);
+        part_committed++;
+        commit_timers.erase(it);
+    }
+    exec_hashes[blk->get_height()] = blk->get_hash();
     pmaker->on_consensus(blk);
+    expire_vote_ingest();
+    schedule_prune();
+}
+
+void HotStuffBase::do_prune(const block_t &blk) {
+    /* a proposal that never got committed */
+    commit_timers.erase(blk->get_hash());
+    if (blk->get_decision() == 1)
+        exec_hashes.erase(blk->get_height());
+    /* votes that came after the QC was finished, or for a fork */
+    auto it = vote_ingest.find(blk->get_hash());
+    if (it != vote_ingest.end())
+    {
+        it->second.token->store(true, std::memory_order_relaxed);
+        vote_ingest.erase(it);
+    }
+    if (vote_ingest_pruned.insert(blk->get_hash()).second)
+        vote_ingest_pruned_queue.push(std::make_pair(
+            get_b_exec()->get_height(), blk->get_hash()));
 }
 
 void HotStuffBase::do_decide(Finality &&fin) {
     part_decided++;
-    state_machine_execute(fin);
+    if (!state_lost) state_machine_execute(fin);
     auto it = decision_waiting.find(fin.cmd_hash);
     if (it != decision_waiting.end())
     {
@@ -453,9 +1374,240 @@ void HotStuffBase::do_decide(Finality &&fin) {
 
 HotStuffBase::~HotStuffBase() {}
 
+void HotStuffBase::recover() {
+    using blk_ref_t = std::pair<uint256_t, uint32_t>;
+    /* delivered blocks by height, as logged */
+    std::map<uint32_t, std::vector<bytearray_t>> logged;
+    std::optional<blk_ref_t> vote, lock, exec, hqc_ref;
+    quorum_cert_bt hqc_qc;
+    size_t nrecords = 0;
+    /* the application state as of the last stable checkpoint */
+    bytearray_t ckpt_data;
+    if (ledger && ledger->get_checkpoint(ckpt_data))
+    {
+        stable_ckpt = decode_checkpoint(ckpt_data);
+        state_machine_restore(stable_ckpt->height, stable_ckpt->data);
+    }
+    auto read_ref = [](DataStream &s) {
+        blk_ref_t ref;
+        s >> ref.first >> ref.second;
+        ref.second = letoh(ref.second);
+        return ref;
+    };
+    if (!safety_log_path.empty())
+        nrecords = SafetyLog::replay(safety_log_path,
+                [&](SafetyLog::RecordType type, DataStream &s) {
+            switch (type)
+            {
+                case SafetyLog::REC_BLOCK:
+                {
+                    uint32_t height;
+                    s >> height;
+                    logged[letoh(height)].push_back(
+                        bytearray_t(s.data(), s.data() + s.size()));
+                    break;
+                }
+                case SafetyLog::REC_VOTE:
+                    vote = read_ref(s);
+                    break;
+                case SafetyLog::REC_B_LOCK:
+                    lock = read_ref(s);
+                    break;
+                case SafetyLog::REC_B_EXEC:
+                {
+                    exec = read_ref(s);
+                    /* drop the committed blocks no longer needed, unless
+                     * the ledger misses them */
+                    uint32_t h = exec->second > recover_depth ?
+                                    exec->second - recover_depth : 0;
+                    if (ledger) h = std::min(h, ledger->get_end_height());
+                    logged.erase(logged.begin(), logged.lower_bound(h));
+                    break;
+                }
+                case SafetyLog::REC_HQC:
+                    hqc_ref = read_ref(s);
+                    hqc_qc = parse_quorum_cert(s);
+                    break;
+                default:
+                    throw HotStuffError("unknown record type %d in safety log", type);
+            }
+        });
+    if (!exec)
+    {
+        if (ledger && ledger->get_size())
+        {
+            /* no safety log: resume from the last committed block */
+            uint32_t h = ledger->get_end_height() - 1;
+            exec = std::make_pair(ledger->get_blk_hash(h), h);
+        }
+        else if (nrecords)
+            exec = std::make_pair(get_genesis()->get_hash(), (uint32_t)0);
+    }
+    if (exec)
+    {
+        ElapsedTime elapsed;
+        elapsed.start();
+        const uint32_t exec_height = exec->second;
+        std::vector<block_t> restored;
+        auto restore = [&](DataStream &s, uint32_t height, bool root) {
+            Block _blk;
+            _blk.unserialize(s, this);
+            auto blk = storage->add_blk(std::move(_blk), get_config());
+            /* also in the ledger */
+            if (blk->is_delivered()) return;
+            /* the last executed block stands on its own if the ledger does
+             * not have its parent */
+            if (on_restore_blk(blk, height, root || blk->get_hash() == exec->first))
+                restored.push_back(blk);
+            else
+                /* on a fork that was given up */
+                storage->try_release_blk(blk);
+        };
+        /* the tail of the committed chain */
+        if (ledger && ledger->get_size())
+        {
+            uint32_t from = std::max(ledger->get_base_height(),
+                exec_height > recover_depth ? exec_height - recover_depth : 0);
+            uint32_t to = std::min(ledger->get_end_height(), exec_height + 1);
+            for (uint32_t h = from; h < to; h++)
+            {
+                Ledger::blob_t blob;
+                ledger->get_blk(h, blob);
+                DataStream s(blob.data, blob.data + blob.size);
+                restore(s, h, true);
+            }
+        }
+        /* then the blocks delivered before the restart, parents first */
+        for (auto &e: logged)
+            for (auto &data: e.second)
+            {
+                DataStream s(std::move(data));
+                restore(s, e.first, false);
+            }
+
+        auto find_restored = [this](const blk_ref_t &ref, const char *name) {
+            block_t blk = storage->find_blk(ref.first);
+            if (blk == nullptr || !blk->is_delivered())
+                throw HotStuffError("cannot restore %s %s at height %u", name,
+                                    get_hex10(ref.first).c_str(), ref.second);
+            return blk;
+        };
+        block_t b_exec = find_restored(*exec, "b_exec");
+        block_t b_lock = lock ? find_restored(*lock, "b_lock") : nullptr;
+        block_t hqc_blk = hqc_ref ? find_restored(*hqc_ref, "hqc") : nullptr;
+        if (!hqc_blk && b_exec->get_qc_ref() && b_exec->get_qc_ref()->is_delivered())
+        {
+            /* without a log, the QC in the last executed block is the
+             * highest known */
+            hqc_blk = b_exec->get_qc_ref();
+            hqc_qc = b_exec->get_qc()->clone();
+        }
+        /* no block at or below b_exec can get a vote any more */
+        uint32_t vheight = std::max(vote ? vote->second : 0, exec_height);
+        on_restore_state(vheight, b_lock, b_exec, hqc_blk, std::move(hqc_qc));
+
+        /* the heights from here on have no commands to replay */
+        uint32_t replay_end = ledger ? ledger->get_end_height() : 0;
+        if (ledger && replay_end <= exec_height && ckpt_interval)
+        {
+            /* the ledger lost its last blocks in a crash, with the commands
+             * they decided: the state stops at the end of the ledger until
+             * it is replaced by a checkpoint above b_exec */
+            LOG_WARN("ledger: the commands of heights %u to %u are lost, "
+                    "waiting for a checkpoint", replay_end, exec_height);
+            state_lost = true;
+        }
+        else if (ledger && replay_end <= exec_height)
+        {
+            /* without checkpoints, put back the blocks the log still has,
+             * so that the ledger goes on */
+            std::vector<block_t> chain;
+            for (block_t b = b_exec; b->get_height() >= ledger->get_end_height();
+                    b = b->get_parents()[0])
+            {
+                chain.push_back(b);
+                if (b->get_parents().empty()) break;
+            }
+            if (ledger->get_size() &&
+                chain.back()->get_height() != ledger->get_end_height())
+                throw HotStuffError("ledger ends at height %u, below the "
+                                    "restored blocks", ledger->get_end_height());
+            LOG_WARN("ledger: the commands of heights %u to %u are lost",
+                    chain.back()->get_height(), exec_height);
+            for (auto it = chain.rbegin(); it != chain.rend(); it++)
+                ledger->append(*it, std::vector<uint256_t>());
+        }
+        if (stable_ckpt && ledger)
+        {
+            /* bring the application state up to b_exec, or as far as the
+             * commands are known */
+            for (uint32_t h = std::max(stable_ckpt->height + 1, ledger->get_base_height());
+                    h <= exec_height && h < replay_end; h++)
+            {
+                auto blk_hash = ledger->get_blk_hash(h);
+                auto cmds = ledger->get_cmds(h);
+                for (uint32_t i = 0; i < cmds.size(); i++)
+                    state_machine_execute(Finality(id, 1, i, h, cmds[i], blk_hash));
+            }
+        }
+        elapsed.stop(true);
+        LOG_INFO("recovered %lu blocks, executed up to height %u, from %lu log records in %.3f sec",
+                restored.size(), exec_height, nrecords, elapsed.elapsed_sec);
+
+        /* start over with a log of what has just been restored */
+        voted = vote;
+        if (!safety_log_path.empty())
+            SafetyLog::rewrite(safety_log_path, get_safety_records());
+    }
+    if (!safety_log_path.empty())
+        safety_log = new SafetyLog(ec, safety_log_path);
+}
+
+std::vector<SafetyLog::record_t> HotStuffBase::get_safety_records() {
+    std::vector<SafetyLog::record_t> records;
+    auto add = [&records](SafetyLog::RecordType type, DataStream &&s) {
+        records.push_back(std::make_pair(type, bytearray_t(std::move(s))));
+    };
+    auto ref = [](const block_t &blk) {
+        DataStream s;
+        s << blk->get_hash() << htole(blk->get_height());
+        return s;
+    };
+    /* the blocks recover() would keep from a full log */
+    const auto &b_exec = get_b_exec();
+    uint32_t height = b_exec->get_height() > recover_depth ?
+                        b_exec->get_height() - recover_depth : 0;
+    if (ledger) height = std::min(height, ledger->get_end_height());
+    for (const auto &blk: get_delivered_blks(height))
+    {
+        DataStream s;
+        s << htole(blk->get_height()) << *blk;
+        add(SafetyLog::REC_BLOCK, std::move(s));
+    }
+    add(SafetyLog::REC_B_EXEC, ref(b_exec));
+    /* left out if stale, e.g. across a state transfer, as their blocks are
+     * not in the log */
+    if (get_b_lock()->get_height() >= height)
+        add(SafetyLog::REC_B_LOCK, ref(get_b_lock()));
+    if (get_hqc()->get_height() >= height)
+    {
+        DataStream s = ref(get_hqc());
+        s << *get_hqc_qc();
+        add(SafetyLog::REC_HQC, std::move(s));
+    }
+    if (voted)
+    {
+        DataStream s;
+        s << voted->first << htole(voted->second);
+        add(SafetyLog::REC_VOTE, std::move(s));
+    }
+    return records;
+}
+
 void HotStuffBase::start(
         std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> &&replicas,
         bool ec_loop) {
+    start_time = fetch_clock();
     LOG_INFO("Raplica size: %d", replicas.size());
     rse.set_params(replicas.size());
     LOG_INFO("%s", rse.print().c_str());
@@ -482,6 +1634,10 @@ void HotStuffBase::start(
     if (nfaulty == 0)
         LOG_WARN("too few replicas in the system to tolerate any failure");
     on_init(nfaulty);
+    /* a pruned block could be served by nothing else */
+    if (!prune_set && !ledger && !ckpt_interval)
+        prune_retention = 0;
+    recover();
     pmaker->init(this);
     if (ec_loop)
         ec.dispatch();
@@ -33,6 +33,10 @@ int main(int argc, char **argv) {
     auto &algo = opt_algo->get();
     if (algo == "secp256k1")
         priv_key = new hotstuff::PrivKeySecp256k1();
+    else if (algo == "schnorr")
+        priv_key = new hotstuff::PrivKeySchnorr();
+    else if (algo == "ed25519")
+        priv_key = new hotstuff::PrivKeyEd25519();
     else
         error(1, 0, "algo not supported");
     int n = opt_n->get();
@@ -0,0 +1,313 @@
+/**
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hotstuff/util.h"
+#include "hotstuff/ledger.h"
+
+namespace hotstuff {
+
+/* entries the index grows by at first */
+static const size_t index_cap_min = 1024;
+
+/* replace_file() or throw */
+static void replace_file_or_throw(const std::string &path, const uint8_t *data, size_t len) {
+    if (int err = replace_file(path, data, len))
+        throw HotStuffError("cannot replace %s: %s", path.c_str(), strerror(err));
+}
+
+std::string Ledger::seg_path(uint32_t seg) const {
+    char name[32];
+    snprintf(name, sizeof name, "/seg-%08u", seg);
+    return dir + name;
+}
+
+void Ledger::map_index(size_t cap) {
+    if (header)
+        munmap(header, sizeof(Header) + index_cap * sizeof(Entry));
+    size_t len = sizeof(Header) + cap * sizeof(Entry);
+    if (ftruncate(index_fd, len) < 0)
+        throw HotStuffError("cannot grow ledger index: %s", strerror(errno));
+    void *base = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    if (base == MAP_FAILED)
+        throw HotStuffError("cannot map ledger index: %s", strerror(errno));
+    header = static_cast<Header *>(base);
+    index_cap = cap;
+}
+
+void Ledger::open_segment(uint32_t seg, size_t size) {
+    auto path = seg_path(seg);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw HotStuffError("cannot open ledger segment %s: %s",
+                            path.c_str(), strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        (size && (size_t)st.st_size != size && ftruncate(fd, size) < 0))
+    {
+        ::close(fd);
+        throw HotStuffError("cannot size ledger segment %s: %s",
+                            path.c_str(), strerror(errno));
+    }
+    /* an existing segment is mapped as it is */
+    if (!size) size = st.st_size;
+    void *base = size ?
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : nullptr;
+    if (base == MAP_FAILED)
+    {
+        ::close(fd);
+        throw HotStuffError("cannot map ledger segment %s: %s",
+                            path.c_str(), strerror(errno));
+    }
+    segs.push_back(Segment{fd, static_cast<uint8_t *>(base), size, 0});
+}
+
+void Ledger::close_segment(uint32_t seg) {
+    auto &s = segs[seg];
+    if (s.base) munmap(s.base, s.size);
+    ::close(s.fd);
+    s = Segment{-1, nullptr, 0, 0};
+}
+
+Ledger::Ledger(const std::string &dir, size_t seg_size):
+        dir(dir), seg_size(seg_size), header(nullptr), index_cap(0) {
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+        throw HotStuffError("cannot create ledger directory %s: %s",
+                            dir.c_str(), strerror(errno));
+    auto index_path = dir + "/index";
+    index_fd = ::open(index_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (index_fd < 0)
+        throw HotStuffError("cannot open ledger index %s: %s",
+                            index_path.c_str(), strerror(errno));
+    struct stat st;
+    if (fstat(index_fd, &st) < 0)
+        throw HotStuffError("cannot stat ledger index: %s", strerror(errno));
+    if ((size_t)st.st_size < sizeof(Header))
+    {
+        map_index(index_cap_min);
+        header->magic = magic;
+        header->base_height = 0;
+        header->nblks = 0;
+        return;
+    }
+    map_index(std::max((st.st_size - sizeof(Header)) / sizeof(Entry), index_cap_min));
+    if (header->magic != magic)
+        throw HotStuffError("%s is not a ledger index", index_path.c_str());
+    /* keep the entries up to the first one not fully written */
+    uint32_t n = std::min((size_t)header->nblks, index_cap);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const Entry &e = entries()[i];
+        /* the segments before the first block have been dropped */
+        if (i == 0)
+            while (segs.size() < e.seg)
+                segs.push_back(Segment{-1, nullptr, 0, 0});
+        if (e.seg > segs.size()) { n = i; break; }
+        if (e.seg == segs.size())
+            open_segment(e.seg, 0);
+        auto &seg = segs[e.seg];
+        if (e.blk_len > e.rec_len || e.offset + e.rec_len > seg.size ||
+            crc32(seg.base + e.offset, e.rec_len) != e.crc)
+        {
+            n = i;
+            break;
+        }
+        seg.used = e.offset + e.rec_len;
+        heights.emplace(std::hash<uint256_t>()(uint256_t(e.blk_hash)),
+                        header->base_height + i);
+    }
+    if (n != header->nblks)
+        HOTSTUFF_LOG_WARN("ledger: dropped %u damaged entries at the tail",
+                            header->nblks - n);
+    header->nblks = n;
+}
+
+Ledger::~Ledger() {
+    for (uint32_t i = 0; i < segs.size(); i++)
+        if (segs[i].fd >= 0) close_segment(i);
+    if (header)
+        munmap(header, sizeof(Header) + index_cap * sizeof(Entry));
+    ::close(index_fd);
+}
+
+void Ledger::append(const block_t &blk, const std::vector<uint256_t> &cmds) {
+    uint32_t height = blk->get_height();
+    if (header->nblks == 0)
+        header->base_height = height;
+    else if (height < get_end_height())
+        return;
+    else if (height != get_end_height())
+        throw HotStuffError("ledger: height %u follows %u",
+                            height, get_end_height() - 1);
+    DataStream s;
+    s << *blk;
+    uint32_t blk_len = s.size();
+    s << htole((uint32_t)cmds.size());
+    for (const auto &cmd: cmds) s << cmd;
+    uint32_t rec_len = s.size();
+
+    if (segs.empty() || segs.back().used + rec_len > segs.back().size)
+    {
+        /* the full segment is only read from now on */
+        if (!segs.empty() && segs.back().base)
+            msync(segs.back().base, segs.back().used, MS_ASYNC);
+        open_segment(segs.size(), std::max(seg_size, (size_t)rec_len));
+    }
+    auto &seg = segs.back();
+    memcpy(seg.base + seg.used, s.data(), rec_len);
+
+    if (header->nblks == index_cap) map_index(index_cap * 2);
+    Entry &e = entries()[header->nblks];
+    e.offset = seg.used;
+    e.seg = segs.size() - 1;
+    e.blk_len = blk_len;
+    e.rec_len = rec_len;
+    e.crc = crc32(seg.base + seg.used, rec_len);
+    auto hash = blk->get_hash().to_bytes();
+    memcpy(e.blk_hash, hash.data(), sizeof e.blk_hash);
+    seg.used += rec_len;
+    /* the entry is complete before it is counted */
+    header->nblks++;
+    heights.emplace(std::hash<uint256_t>()(blk->get_hash()), height);
+}
+
+void Ledger::truncate(uint32_t height) {
+    if (height <= get_base_height()) return;
+    uint32_t ndropped = std::min(height, get_end_height()) - get_base_height();
+    uint32_t nkept = header->nblks - ndropped;
+    for (uint32_t i = 0; i < ndropped; i++)
+        erase_height(uint256_t(entries()[i].blk_hash), get_base_height() + i);
+    Header h{magic, nkept ? get_base_height() + ndropped : height, nkept};
+    bytearray_t index(reinterpret_cast<const uint8_t *>(&h),
+                    reinterpret_cast<const uint8_t *>(&h + 1));
+    auto kept = reinterpret_cast<const uint8_t *>(entries() + ndropped);
+    index.insert(index.end(), kept, kept + nkept * sizeof(Entry));
+    uint32_t first_seg = nkept ? entries()[ndropped].seg : segs.size();
+
+    auto index_path = dir + "/index";
+    replace_file_or_throw(index_path, index.data(), index.size());
+    munmap(header, sizeof(Header) + index_cap * sizeof(Entry));
+    header = nullptr;
+    ::close(index_fd);
+    index_fd = ::open(index_path.c_str(), O_RDWR | O_CLOEXEC);
+    if (index_fd < 0)
+        throw HotStuffError("cannot open ledger index %s: %s",
+                            index_path.c_str(), strerror(errno));
+    map_index(std::max((size_t)nkept, index_cap_min));
+    for (uint32_t i = 0; i < first_seg; i++)
+    {
+        if (segs[i].fd < 0) continue;
+        close_segment(i);
+        ::unlink(seg_path(i).c_str());
+    }
+}
+
+void Ledger::put_checkpoint(const bytearray_t &data) {
+    replace_file_or_throw(dir + "/checkpoint", data.data(), data.size());
+}
+
+bool Ledger::get_checkpoint(bytearray_t &data) const {
+    auto path = dir + "/checkpoint";
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno == ENOENT) return false;
+        throw HotStuffError("cannot open %s: %s", path.c_str(), strerror(errno));
+    }
+    data.clear();
+    uint8_t buff[1 << 16];
+    for (ssize_t ret; (ret = ::read(fd, buff, sizeof buff));)
+    {
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            throw HotStuffError("cannot read %s: %s", path.c_str(), strerror(errno));
+        }
+        data.insert(data.end(), buff, buff + ret);
+    }
+    ::close(fd);
+    return true;
+}
+
+const Ledger::Entry *Ledger::find_entry(uint32_t height) const {
+    if (height < get_base_height() || height >= get_end_height())
+        return nullptr;
+    return &entries()[height - get_base_height()];
+}
+
+void Ledger::erase_height(const uint256_t &blk_hash, uint32_t height) {
+    auto range = heights.equal_range(std::hash<uint256_t>()(blk_hash));
+    for (auto it = range.first; it != range.second; it++)
+        if (it->second == height)
+        {
+            heights.erase(it);
+            return;
+        }
+}
+
+bool Ledger::find_height(const uint256_t &blk_hash, uint32_t &height) const {
+    auto range = heights.equal_range(std::hash<uint256_t>()(blk_hash));
+    for (auto it = range.first; it != range.second; it++)
+    {
+        auto e = find_entry(it->second);
+        if (e && uint256_t(e->blk_hash) == blk_hash)
+        {
+            height = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Ledger::get_blk(uint32_t height, blob_t &blob) const {
+    auto e = find_entry(height);
+    if (e == nullptr) return false;
+    blob.data = segs[e->seg].base + e->offset;
+    blob.size = e->blk_len;
+    return true;
+}
+
+uint256_t Ledger::get_blk_hash(uint32_t height) const {
+    auto e = find_entry(height);
+    if (e == nullptr)
+        throw HotStuffError("ledger: height %u not stored", height);
+    return uint256_t(e->blk_hash);
+}
+
+std::vector<uint256_t> Ledger::get_cmds(uint32_t height) const {
+    auto e = find_entry(height);
+    if (e == nullptr)
+        throw HotStuffError("ledger: height %u not stored", height);
+    const uint8_t *rec = segs[e->seg].base + e->offset;
+    DataStream s(rec + e->blk_len, rec + e->rec_len);
+    uint32_t n;
+    s >> n;
+    n = letoh(n);
+    std::vector<uint256_t> cmds(n);
+    for (auto &cmd: cmds) s >> cmd;
+    return cmds;
+}
+
+}
@@ -14,10 +14,80 @@
  * limitations under the License.
  */
 
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "hotstuff/util.h"
 
 namespace hotstuff {
 
 Logger logger("hotstuff");
 
+namespace {
+
+struct CRC32Table {
+    uint32_t t[256];
+    constexpr CRC32Table(): t() {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+
+constexpr CRC32Table crc32_table;
+
+}
+
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc) {
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = crc32_table.t[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+int write_all(int fd, const uint8_t *data, size_t len) {
+    while (len)
+    {
+        ssize_t ret = ::write(fd, data, len);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+int replace_file(const std::string &path, const uint8_t *data, size_t len) {
+    auto tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return errno;
+    int err = write_all(fd, data, len);
+    if (!err && ::fdatasync(fd) < 0) err = errno;
+    ::close(fd);
+    if (!err && rename(tmp_path.c_str(), path.c_str()) < 0) err = errno;
+    if (err)
+    {
+        unlink(tmp_path.c_str());
+        return err;
+    }
+    /* make the rename itself durable */
+    auto slash = path.rfind('/');
+    auto dir = slash == std::string::npos ? std::string(".") :
+                slash == 0 ? std::string("/") : path.substr(0, slash);
+    int dfd = ::open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dfd < 0) return errno;
+    if (::fsync(dfd) < 0) err = errno;
+    ::close(dfd);
+    return err;
+}
+
 }
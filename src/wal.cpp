@@ -0,0 +1,283 @@
+/**
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hotstuff/wal.h"
+
+namespace hotstuff {
+
+namespace {
+
+void put_le32(bytearray_t &buff, uint32_t v) {
+    for (int i = 0; i < 4; i++)
+        buff.push_back((v >> (8 * i)) & 0xff);
+}
+
+uint32_t get_le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+}
+
+SafetyLog::SafetyLog(const EventContext &ec, const std::string &path):
+        path(path), pending(new Batch()), flushing(false),
+        to_write(nullptr), stopped(false),
+        part_nbatches(0), part_nrecords(0), part_nbytes(0),
+        part_fsync_time(0), part_fsync_time_max(0) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        int err = errno;
+        if (fd >= 0) ::close(fd);
+        delete pending;
+        throw HotStuffError("cannot open safety log %s: %s",
+                            path.c_str(), strerror(err));
+    }
+    size = base_size = st.st_size;
+    /* at the end of the iteration that appended the first record */
+    flush_timer = TimerEvent(ec, [this](TimerEvent &) { start_flush(); });
+    done_queue.reg_handler(ec, [this](batch_queue_t &q) {
+        Batch *batch;
+        while (q.try_dequeue(batch))
+            on_flushed(batch);
+        return false;
+    });
+    writer = std::thread([this]() { run_writer(); });
+}
+
+SafetyLog::~SafetyLog() {
+    {
+        std::lock_guard<std::mutex> _(mlock);
+        stopped = true;
+    }
+    cv.notify_one();
+    writer.join();
+    Batch *batch;
+    while (done_queue.try_dequeue(batch)) delete batch;
+    delete pending;
+    ::close(fd);
+}
+
+void SafetyLog::encode(bytearray_t &data, RecordType type, const bytearray_t &payload) {
+    uint8_t t = type;
+    put_le32(data, payload.size());
+    put_le32(data, crc32(payload.data(), payload.size(), crc32(&t, 1)));
+    data.push_back(t);
+    data.insert(data.end(), payload.begin(), payload.end());
+}
+
+void SafetyLog::append(RecordType type, const bytearray_t &payload) {
+    if (!(pending->nrecords || pending->rewrite)) schedule_flush();
+    size_t n = pending->data.size();
+    encode(pending->data, type, payload);
+    size += pending->data.size() - n;
+    pending->nrecords++;
+}
+
+void SafetyLog::compact(const std::vector<record_t> &records) {
+    if (!(pending->nrecords || pending->rewrite)) schedule_flush();
+    /* the records of this iteration are superseded too: the batch starts
+     * over as the content of the new log */
+    pending->data.clear();
+    for (const auto &r: records)
+        encode(pending->data, r.first, r.second);
+    pending->nrecords = records.size();
+    pending->rewrite = true;
+    size = base_size = pending->data.size();
+}
+
+size_t SafetyLog::replay(const std::string &path, const replay_cb_t &cb) {
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno == ENOENT) return 0;
+        throw HotStuffError("cannot open safety log %s: %s",
+                            path.c_str(), strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        ::close(fd);
+        throw HotStuffError("cannot open safety log %s: %s",
+                            path.c_str(), strerror(errno));
+    }
+    const size_t fsize = st.st_size;
+    const size_t header_size = 9;
+    const size_t chunk_size = 1 << 16;
+    /* the bytes read and not parsed yet start at buff[pos], which is at
+     * off in the file */
+    bytearray_t buff;
+    size_t pos = 0, off = 0, nrecords = 0;
+    auto fill = [&](size_t need) {
+        if (buff.size() - pos >= need) return;
+        buff.erase(buff.begin(), buff.begin() + pos);
+        pos = 0;
+        size_t n = buff.size();
+        buff.resize(std::max(need, std::min(n + chunk_size, fsize - off)));
+        while (n < buff.size())
+        {
+            ssize_t ret = ::read(fd, buff.data() + n, buff.size() - n);
+            if (ret < 0 && errno == EINTR) continue;
+            if (ret <= 0)
+            {
+                int err = ret < 0 ? errno : EIO;
+                ::close(fd);
+                throw HotStuffError("cannot read safety log %s: %s",
+                                    path.c_str(), strerror(err));
+            }
+            n += ret;
+        }
+    };
+    while (fsize - off >= header_size)
+    {
+        fill(header_size);
+        uint32_t len = get_le32(&buff[pos]);
+        uint32_t crc = get_le32(&buff[pos + 4]);
+        /* a length past the end is a torn write */
+        if (fsize - off - header_size < len) break;
+        fill(header_size + len);
+        const uint8_t *p = &buff[pos];
+        if (crc32(p + header_size, len, crc32(p + 8, 1)) != crc) break;
+        DataStream s(p + header_size, p + header_size + len);
+        cb((RecordType)p[8], s);
+        pos += header_size + len;
+        off += header_size + len;
+        nrecords++;
+    }
+    if (off != fsize)
+    {
+        HOTSTUFF_LOG_WARN("safety log: cutting %lu damaged bytes at the tail",
+                            fsize - off);
+        if (ftruncate(fd, off) < 0 || ::fdatasync(fd) < 0)
+        {
+            ::close(fd);
+            throw HotStuffError("cannot truncate safety log %s: %s",
+                                path.c_str(), strerror(errno));
+        }
+    }
+    ::close(fd);
+    return nrecords;
+}
+
+void SafetyLog::rewrite(const std::string &path, const std::vector<record_t> &records) {
+    bytearray_t data;
+    for (const auto &r: records)
+        encode(data, r.first, r.second);
+    if (int err = replace_file(path, data.data(), data.size()))
+        throw HotStuffError("cannot replace safety log %s: %s",
+                            path.c_str(), strerror(err));
+}
+
+void SafetyLog::after_flush(flush_cb_t cb) {
+    if (pending->nrecords || pending->rewrite)
+        pending_cbs.push_back(std::move(cb));
+    else if (flushing)
+        flushing_cbs.push_back(std::move(cb));
+    else
+        cb();
+}
+
+void SafetyLog::schedule_flush() {
+    flush_timer.del();
+    flush_timer.add(0);
+}
+
+void SafetyLog::start_flush() {
+    /* one batch at a time: the records keep piling up meanwhile and go
+     * out together once the current one is done */
+    if (flushing || !(pending->nrecords || pending->rewrite)) return;
+    flushing = true;
+    flushing_cbs = std::move(pending_cbs);
+    pending_cbs.clear();
+    {
+        std::lock_guard<std::mutex> _(mlock);
+        to_write = pending;
+    }
+    cv.notify_one();
+    pending = new Batch();
+}
+
+void SafetyLog::on_flushed(Batch *batch) {
+    int err = batch->err;
+    if (!err)
+    {
+        part_nbatches++;
+        part_nrecords += batch->nrecords;
+        part_nbytes += batch->data.size();
+        part_fsync_time += batch->fsync_time;
+        if (batch->fsync_time > part_fsync_time_max)
+            part_fsync_time_max = batch->fsync_time;
+    }
+    delete batch;
+    /* the votes depending on the lost records must never be sent */
+    if (err)
+        throw HotStuffError("cannot write safety log %s: %s",
+                            path.c_str(), strerror(err));
+    auto cbs = std::move(flushing_cbs);
+    flushing_cbs.clear();
+    flushing = false;
+    start_flush();
+    for (auto &cb: cbs) cb();
+}
+
+void SafetyLog::run_writer() {
+    for (;;)
+    {
+        Batch *batch;
+        {
+            std::unique_lock<std::mutex> lk(mlock);
+            cv.wait(lk, [this]() { return stopped || to_write; });
+            /* finish the batch handed over before stopping */
+            if (!to_write) return;
+            batch = to_write;
+            to_write = nullptr;
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (batch->rewrite)
+        {
+            /* the log goes on in the new file */
+            batch->err = replace_file(path, batch->data.data(), batch->data.size());
+            int nfd = -1;
+            if (!batch->err &&
+                (nfd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC)) < 0)
+                batch->err = errno;
+            if (nfd >= 0)
+            {
+                ::close(fd);
+                fd = nfd;
+            }
+        }
+        else
+        {
+            batch->err = write_all(fd, batch->data.data(), batch->data.size());
+            if (!batch->err && ::fdatasync(fd) < 0)
+                batch->err = errno;
+        }
+        batch->fsync_time = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        done_queue.enqueue(batch);
+    }
+}
+
+}
@@ -0,0 +1,146 @@
+#include <random>
+#include <set>
+#include "hotstuff/entity.h"
+#include "bench_util.h"
+
+using namespace hotstuff;
+
+/* cost (ns/op) of the ancestry check and of reading the tails on a long
+ * uncommitted chain, as left by a leader outage: nothing is committed and
+ * every few heights a proposal is abandoned, leaving a fork behind; the
+ * check is also compared with a plain walk, on the forks, after the window
+ * advances and above a restored root, and any mismatch fails the run */
+
+/* the ancestry check walking one parent at a time */
+static bool walk_is_ancestor(const block_t &a, const block_t &b) {
+    const Block *blk = b.get();
+    while (blk->get_height() > a->get_height())
+    {
+        /* a restored root is not linked to what is below it */
+        if (blk->get_parents().empty()) return false;
+        blk = blk->get_parents()[0].get();
+    }
+    return blk == a.get();
+}
+
+int main(int argc, char **argv) {
+    const uint32_t nblks = get_arg(argc, argv, 1, 100000);
+    const uint32_t fork_interval = get_arg(argc, argv, 2, 16);
+    const size_t nops = 100000;
+    ReplicaConfig config;
+    BlockWindow window;
+    std::set<block_t> tails;
+    std::vector<block_t> blks{new Block(true, 1)};
+    std::vector<block_t> forks;
+    window.add(blks[0]);
+    tails.insert(blks[0]);
+
+    auto make_blk = [&](BlockWindow &w, blk_list_t &&parents, uint32_t height,
+                        const uint256_t &qc_hash) {
+        block_t blk = new Block(parents, {}, new QuorumCertDummy(
+                                config, qc_hash), bytearray_t(),
+                                height, nullptr, nullptr);
+        w.add(blk);
+        blks.push_back(blk);
+        return blk;
+    };
+    auto extend = [&](const block_t &parent) {
+        block_t blk = make_blk(window, {parent}, parent->get_height() + 1,
+                                parent->get_hash());
+        tails.erase(parent);
+        tails.insert(blk);
+        return blk;
+    };
+    auto grow = [&](block_t tip, uint32_t n) {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if ((tip->get_height() + 1) % fork_interval == 0)
+                forks.push_back(extend(tip));
+            tip = extend(tip);
+        }
+        return tip;
+    };
+    block_t tip = grow(blks[0], nblks);
+
+    std::mt19937 rng(1);
+    /* every fourth query is an abandoned proposal */
+    auto pick_queries = [&](size_t n) {
+        std::vector<block_t> queries;
+        for (size_t i = 0; i < n; i++)
+            queries.push_back(i % 4 == 0 && !forks.empty() ?
+                            forks[rng() % forks.size()] :
+                            blks[rng() % blks.size()]);
+        return queries;
+    };
+    size_t nchecks = 0, nmismatches = 0;
+    auto check = [&](const BlockWindow &w, const std::vector<block_t> &queries,
+                    const block_t &b) {
+        for (const auto &q: queries)
+        {
+            nchecks++;
+            if (w.is_ancestor(q, b) == walk_is_ancestor(q, b)) continue;
+            printf("mismatch: is_ancestor(%u, %u)\n",
+                    q->get_height(), b->get_height());
+            nmismatches++;
+        }
+    };
+
+    std::vector<block_t> queries = pick_queries(1024);
+    check(window, queries, tip);
+    for (size_t i = 0; i < 4 && !forks.empty(); i++)
+        check(window, queries, forks[rng() % forks.size()]);
+
+
+    size_t nyes = 0;
+    double t_walk = measure(nops / 100, [&](size_t i) {
+        nyes += walk_is_ancestor(queries[i & 1023], tip);
+    });
+    double t_skip = measure(nops, [&](size_t i) {
+        nyes += window.is_ancestor(queries[i & 1023], tip);
+    });
+    double t_copy = measure(nops / 100, [&](size_t) {
+        std::set<block_t> copy = tails;
+        nyes += copy.size();
+    });
+    double t_ref = measure(nops, [&](size_t) {
+        const auto &ref = tails;
+        nyes += ref.size();
+    });
+
+    printf("%u blocks, %lu tails\n"
+            "is_ancestor: walk %.1f ns/op, skip list %.1f ns/op\n"
+            "get_tails: copy %.1f ns/op, reference %.1f ns/op\n",
+            nblks, tails.size(), t_walk, t_skip, t_copy, t_ref);
+
+    /* the window drops the lower half, then the chain goes on */
+    window.advance(nblks / 2);
+    check(window, queries, tip);
+    tip = grow(tip, nblks / 4);
+    check(window, pick_queries(256), tip);
+
+    /* a chain restored from a root not linked to its parent, above blocks
+     * of the chain built so far */
+    {
+        BlockWindow restored;
+        const uint32_t root_height = nblks / 2 + 7;
+        restored.advance(root_height);
+        block_t rtip = make_blk(restored, {}, root_height, tip->get_hash());
+        for (uint32_t i = 0; i < nblks / 4; i++)
+        {
+            if ((rtip->get_height() + 1) % fork_interval == 0)
+                forks.push_back(make_blk(restored, {rtip},
+                                rtip->get_height() + 1, rtip->get_hash()));
+            rtip = make_blk(restored, {rtip}, rtip->get_height() + 1,
+                            rtip->get_hash());
+        }
+        check(restored, pick_queries(256), rtip);
+    }
+    printf("%lu checks: %lu mismatches\n", nchecks, nmismatches);
+    /* release the chain from the tip down, not by recursion */
+    window = BlockWindow();
+    tails.clear();
+    tip = nullptr;
+    forks.clear();
+    while (!blks.empty()) blks.pop_back();
+    return nyes && !nmismatches ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <new>
+#include "hotstuff/consensus.h"
+#include "bench_util.h"
+
+using namespace hotstuff;
+
+/* heap allocations per block left in the propose/vote/commit loop of a
+ * replica, as bench_refcount drives it: each block is made (as if parsed
+ * off the wire), delivered, its proposal goes through the commit rule, the
+ * votes (made beforehand) are collected into its QC, and the committed
+ * blocks are then pruned, keeping the last retention heights */
+
+static size_t nallocs = 0;
+
+void *operator new(size_t size) {
+    nallocs++;
+    if (void *p = malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+/* the allocations of each step of the loop */
+struct Counts {
+    size_t make, deliver, propose, vote, prune;
+    Counts(): make(0), deliver(0), propose(0), vote(0), prune(0) {}
+};
+
+/* a replica with the dummy certificates, which leads every next view and
+ * takes its own vote right away */
+class Replica: public HotStuffCore {
+    std::vector<MerkleProof> proofs;
+
+    protected:
+    void do_decide(Finality &&) override {}
+    void do_consensus(const block_t &) override {}
+    void do_broadcast_slice(const Slice &) override {}
+    void do_broadcast_proposal(const Proposal &) override {}
+    void do_broadcast_proposal_with_slice(const std::vector<Proposal> &) override {}
+    void do_vote(ReplicaID, const Vote &vote) override { on_receive_vote(vote); }
+    void do_fast_qc_wait(const block_t &) override {}
+
+    public:
+    part_cert_bt create_part_cert(const PrivKey &, const uint256_t &blk_hash) override {
+        return new PartCertDummy(blk_hash);
+    }
+    part_cert_bt parse_part_cert(DataStream &s) override {
+        auto pc = new PartCertDummy();
+        pc->unserialize(s);
+        return pc;
+    }
+    quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertDummy(get_config(), blk_hash);
+    }
+    quorum_cert_bt parse_quorum_cert(DataStream &s) override {
+        auto qc = new QuorumCertDummy();
+        qc->unserialize(s);
+        return qc;
+    }
+
+    Replica(size_t nreplicas): HotStuffCore(1, new PrivKeyDummy()) {
+        for (ReplicaID i = 0; i < nreplicas; i++)
+            add_replica(i, PeerId(), new PubKeyDummy());
+        on_init((nreplicas - 1) / 3);
+        sc.set_pramas(nreplicas);
+        /* every proposal carries the same (valid) slice */
+        proofs = MerkleTree(std::vector<std::vector<uint8_t>>(
+                            nreplicas, std::vector<uint8_t>(64))).proofs();
+    }
+
+    void step(uint32_t retention, Counts &c) {
+        const auto &config = get_config();
+        size_t n0 = nallocs;
+        /* propose: replica 0 extends the block of the highest QC */
+        block_t parent = get_hqc();
+        block_t blk = storage->add_blk(new Block({parent}, {},
+                        new QuorumCertDummy(config, parent->get_hash()),
+                        bytearray_t(), parent->get_height() + 1, parent,
+                        /* the QC the votes go into */
+                        new QuorumCertDummy(config, uint256_t())));
+        size_t n1 = nallocs;
+        on_deliver_blk(blk);
+        size_t n2 = nallocs;
+        /* the votes of the others, as parsed off the wire */
+        std::vector<Vote> votes;
+        for (ReplicaID i = 0; i < config.nreplicas; i++)
+            if (i != get_id())
+                votes.push_back(Vote(i, blk->get_hash(),
+                                new PartCertDummy(blk->get_hash()), this));
+        size_t n3 = nallocs;
+        /* the replica's own vote goes in with the proposal */
+        on_receive_proposal(Proposal(0, Slice(proofs[get_id()],
+                                            blk->get_hash()), blk, this));
+        size_t n4 = nallocs;
+        for (const auto &v: votes) on_receive_vote(v);
+        votes.clear();
+        size_t n5 = nallocs;
+        prune(retention);
+        size_t n6 = nallocs;
+        c.make += n1 - n0;
+        c.deliver += n2 - n1;
+        c.propose += n4 - n3;
+        c.vote += n5 - n4;
+        c.prune += n6 - n5;
+    }
+};
+
+int main(int argc, char **argv) {
+    const size_t nblks = get_arg(argc, argv, 1, 1000000);
+    const size_t nreplicas = get_arg(argc, argv, 2, 4);
+    const uint32_t retention = get_arg(argc, argv, 3, 64);
+    Replica r(nreplicas);
+    /* the first blocks fill up the free lists */
+    const size_t warmup = 2 * retention + 64;
+    Counts c, ignored;
+
+    /* the replica has none of the slices to decode the commands from, and
+     * warns about it for every block */
+    int err_fd = dup(2);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 2);
+    for (size_t i = 0; i < nblks; i++)
+        r.step(retention, i < warmup ? ignored : c);
+    dup2(err_fd, 2);
+    close(null_fd);
+    close(err_fd);
+
+    double ncounted = nblks > warmup ? nblks - warmup : 1;
+    size_t total = c.make + c.deliver + c.propose + c.vote + c.prune;
+    printf("%lu blocks, %lu replicas, retention %u\n"
+            "allocs/blk: make %.3f, deliver %.3f, propose %.3f, "
+            "votes %.3f, prune %.3f, total %.3f\n",
+            nblks, nreplicas, retention,
+            c.make / ncounted, c.deliver / ncounted, c.propose / ncounted,
+            c.vote / ncounted, c.prune / ncounted, total / ncounted);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <chrono>
+#include <thread>
+#include "hotstuff/entity.h"
+#include "hotstuff/crypto.h"
+
+using namespace hotstuff;
+
+/* total throughput (ops/sec) of nthreads threads each running op nops times */
+template<typename Func>
+double throughput(size_t nthreads, size_t nops, Func op) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < nthreads; t++)
+        threads.emplace_back([&op, nops]() {
+            auto ctx = op.prepare();
+            for (size_t i = 0; i < nops; i++) op(ctx);
+        });
+    for (auto &t: threads) t.join();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return nthreads * nops / elapsed.count();
+}
+
+template<typename PrivKeyType, typename PubKeyType,
+        typename PartCertType, typename QuorumCertType>
+class CryptoBench {
+    ReplicaConfig config;
+    std::vector<PrivKeyType> priv_keys;
+    uint256_t obj_hash;
+    QuorumCertType qc;
+
+    public:
+    CryptoBench(size_t n): priv_keys(n) {
+        for (size_t i = 0; i < n; i++)
+        {
+            priv_keys[i].from_rand();
+            config.add_replica(i,
+                ReplicaInfo(i, salticidae::PeerId(salticidae::NetAddr("127.0.0.1", 10000 + i)),
+                            priv_keys[i].get_pubkey()));
+        }
+        config.nmajority = n - (n - 1) / 3;
+        bytearray_t rand(32);
+        if (!RAND_bytes(&rand[0], rand.size()))
+            throw std::runtime_error("cannot get rand bytes from openssl");
+        obj_hash = uint256_t(rand);
+        qc = QuorumCertType(config, obj_hash);
+        for (size_t i = 0; i < config.nmajority; i++)
+            qc.add_part(i, PartCertType(priv_keys[i], obj_hash));
+    }
+
+    struct Sign {
+        const CryptoBench *b;
+        int prepare() const { return 0; }
+        void operator()(int) const {
+            PartCertType pc(b->priv_keys[0], b->obj_hash);
+            (void)pc;
+        }
+    };
+
+    struct Verify {
+        const CryptoBench *b;
+        PartCertType prepare() const {
+            return PartCertType(b->priv_keys[0], b->obj_hash);
+        }
+        void operator()(PartCertType &pc) const {
+            if (!pc.verify(b->config.get_pubkey(0)))
+                throw std::runtime_error("verification failed");
+        }
+    };
+
+    struct VerifyQC {
+        const CryptoBench *b;
+        /* each thread has its own copy of the configuration (and its cache) */
+        std::pair<ReplicaConfig, QuorumCertType> prepare() const {
+            return std::make_pair(b->config, b->qc);
+        }
+        void operator()(std::pair<ReplicaConfig, QuorumCertType> &ctx) const {
+            /* measure the verification itself, not the cache */
+            ctx.first.verified_qcs = VerifiedQCCache();
+            if (!ctx.second.verify(ctx.first))
+                throw std::runtime_error("QC verification failed");
+        }
+    };
+
+    void run(const char *name, size_t nops) {
+        for (size_t nthreads: {1, 2, 4, 8})
+            printf("%10s %8lu %14.1f %14.1f %14.1f\n", name, nthreads,
+                throughput(nthreads, nops, Sign{this}),
+                throughput(nthreads, nops, Verify{this}),
+                throughput(nthreads, std::max(nops / 64, (size_t)1), VerifyQC{this}));
+    }
+};
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? atoi(argv[1]) : 64;
+    size_t nops = argc > 2 ? atoi(argv[2]) : 2000;
+    /* measure the signature checks themselves, not the memo of valid ones */
+    secp256k1_verified_sigs.reset(0);
+    printf("QCs are formed by %lu out of %lu replicas\n", n - (n - 1) / 3, n);
+    printf("%10s %8s %14s %14s %14s\n", "algo", "threads", "sign/s", "verify/s", "qc/s");
+    CryptoBench<PrivKeySecp256k1, PubKeySecp256k1,
+                PartCertSecp256k1, QuorumCertSecp256k1>(n).run("secp256k1", nops);
+    CryptoBench<PrivKeySchnorr, PubKeySchnorr,
+                PartCertSchnorr, QuorumCertSchnorr>(n).run("schnorr", nops);
+    CryptoBench<PrivKeyEd25519, PubKeyEd25519,
+                PartCertEd25519, QuorumCertEd25519>(n).run("ed25519", nops);
+    return 0;
+}
@@ -0,0 +1,261 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <functional>
+#include <queue>
+#include "hotstuff/consensus.h"
+#include "bench_util.h"
+
+using namespace hotstuff;
+
+/* commit latency (simulated ms from the proposal of a block to its commit by
+ * the leader) of three-step HotStuff with and without fast-commit: the
+ * replicas exchange their proposals and votes, serialized, over links of a
+ * fixed delay, with one replica slower than the others; replica 0 leads
+ * every view and proposes as soon as it has the QC of its last block */
+
+/* a dummy QC that counts its parts, so that the fast path can tell when all
+ * the replicas are in */
+class QuorumCertCount final: public QuorumCert {
+    uint256_t obj_hash;
+    uint32_t nparts;
+    public:
+    QuorumCertCount(): nparts(0) {}
+    QuorumCertCount(const uint256_t &obj_hash):
+        obj_hash(obj_hash), nparts(0) {}
+
+    void serialize(DataStream &s) const override {
+        s << obj_hash << htole(nparts);
+    }
+
+    void unserialize(DataStream &s) override {
+        s >> obj_hash >> nparts;
+        nparts = letoh(nparts);
+    }
+
+    QuorumCert *clone() override { return new QuorumCertCount(*this); }
+
+    void add_part(ReplicaID, const PartCert &) override { nparts++; }
+    void compute() override {}
+    bool verify(const ReplicaConfig &) override { return true; }
+    veri_promise_t verify(const ReplicaConfig &, VeriPool &) override {
+        return lwpromise::resolved(true);
+    }
+
+    const uint256_t &get_obj_hash() const override { return obj_hash; }
+    size_t get_nparts() const override { return nparts; }
+};
+
+class Network;
+
+class Replica: public HotStuffCore {
+    Network &net;
+
+    protected:
+    void do_decide(Finality &&) override {}
+    void do_consensus(const block_t &blk) override;
+    void do_broadcast_slice(const Slice &) override {}
+    void do_broadcast_proposal(const Proposal &) override {}
+    void do_broadcast_proposal_with_slice(const std::vector<Proposal> &props) override;
+    void do_vote(ReplicaID proposer, const Vote &vote) override;
+    void do_fast_qc_wait(const block_t &blk) override;
+    void do_persist_hqc(const block_t &blk, const QuorumCert &) override;
+
+    public:
+    part_cert_bt create_part_cert(const PrivKey &, const uint256_t &blk_hash) override {
+        return new PartCertDummy(blk_hash);
+    }
+    part_cert_bt parse_part_cert(DataStream &s) override {
+        auto pc = new PartCertDummy();
+        pc->unserialize(s);
+        return pc;
+    }
+    quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertCount(blk_hash);
+    }
+    quorum_cert_bt parse_quorum_cert(DataStream &s) override {
+        auto qc = new QuorumCertCount();
+        qc->unserialize(s);
+        return qc;
+    }
+
+    Replica(ReplicaID id, size_t nreplicas, bool fast, Network &net):
+            HotStuffCore(id, new PrivKeyDummy()), net(net) {
+        for (ReplicaID i = 0; i < nreplicas; i++)
+            add_replica(i, PeerId(), new PubKeyDummy());
+        on_init((nreplicas - 1) / 3);
+        rse.set_params(nreplicas);
+        sc.set_pramas(nreplicas);
+        set_fast_commit(fast);
+    }
+};
+
+/* the replicas and the messages in flight, in the order of their arrival */
+class Network {
+    struct Event {
+        double t;
+        size_t seq;
+        std::function<void()> fn;
+        bool operator<(const Event &other) const {
+            return t > other.t || (t == other.t && seq > other.seq);
+        }
+    };
+    std::priority_queue<Event> events;
+    size_t nevents;
+    double now;
+
+    std::vector<std::unique_ptr<Replica>> replicas;
+    const double delay, slow, timeout;
+    const uint32_t nblks;
+    uint32_t last_proposed;
+    /* the time each block was proposed at, by height */
+    std::vector<double> proposed;
+
+    void schedule(double t, std::function<void()> fn) {
+        events.push(Event{now + t, nevents++, std::move(fn)});
+    }
+
+    /* the last replica is the slow one */
+    double get_delay(ReplicaID from, ReplicaID to) const {
+        if (from == to) return 0;
+        return from == replicas.size() - 1 ? delay + slow : delay;
+    }
+
+    void propose() {
+        auto &leader = *replicas[0];
+        block_t blk = leader.on_propose({uint256_t(bytearray_t(32, last_proposed))},
+                                        {leader.get_hqc()});
+        last_proposed = blk->get_height();
+        proposed.push_back(now);
+    }
+
+    public:
+    double latency;
+    size_t ncommitted;
+
+    Network(size_t nreplicas, bool fast,
+            double delay, double slow, double timeout, uint32_t nblks):
+            nevents(0), now(0),
+            delay(delay), slow(slow), timeout(timeout),
+            nblks(nblks), last_proposed(0), proposed{0},
+            latency(0), ncommitted(0) {
+        for (ReplicaID i = 0; i < nreplicas; i++)
+            replicas.emplace_back(new Replica(i, nreplicas, fast, *this));
+    }
+
+    void run() {
+        propose();
+        while (!events.empty())
+        {
+            /* pop before running, as the event may schedule others */
+            Event ev = events.top();
+            events.pop();
+            now = ev.t;
+            ev.fn();
+        }
+    }
+
+    void broadcast(ReplicaID from, const std::vector<Proposal> &props) {
+        for (ReplicaID i = 0; i < replicas.size(); i++)
+        {
+            if (i == from) continue;
+            auto s = std::make_shared<DataStream>();
+            *s << props[i];
+            schedule(get_delay(from, i), [this, i, s]() {
+                auto &r = *replicas[i];
+                Proposal prop;
+                prop.hsc = &r;
+                *s >> prop;
+                r.on_deliver_blk(prop.blk);
+                r.on_receive_proposal(prop);
+            });
+        }
+    }
+
+    void send_vote(ReplicaID from, ReplicaID to, const Vote &vote) {
+        auto s = std::make_shared<DataStream>();
+        *s << vote;
+        schedule(get_delay(from, to), [this, to, s]() {
+            auto &r = *replicas[to];
+            Vote vote;
+            vote.hsc = &r;
+            *s >> vote;
+            r.on_receive_vote(vote);
+        });
+    }
+
+    void wait_fast_qc(ReplicaID rid, const block_t &blk) {
+        schedule(timeout, [this, rid, blk]() {
+            replicas[rid]->on_fast_qc_timeout(blk);
+        });
+    }
+
+    void on_hqc(ReplicaID rid, const block_t &blk) {
+        /* the leader goes on once its last block has got its QC */
+        if (rid == 0 && blk->get_height() == last_proposed &&
+            last_proposed < nblks)
+            schedule(0, [this]() { propose(); });
+    }
+
+    void on_commit(ReplicaID rid, const block_t &blk) {
+        if (rid != 0) return;
+        latency += now - proposed[blk->get_height()];
+        ncommitted++;
+    }
+};
+
+void Replica::do_consensus(const block_t &blk) {
+    net.on_commit(get_id(), blk);
+}
+
+void Replica::do_broadcast_proposal_with_slice(const std::vector<Proposal> &props) {
+    net.broadcast(get_id(), props);
+}
+
+void Replica::do_vote(ReplicaID proposer, const Vote &vote) {
+    net.send_vote(get_id(), proposer, vote);
+}
+
+void Replica::do_fast_qc_wait(const block_t &blk) {
+    net.wait_fast_qc(get_id(), blk);
+}
+
+void Replica::do_persist_hqc(const block_t &blk, const QuorumCert &) {
+    net.on_hqc(get_id(), blk);
+}
+
+int main(int argc, char **argv) {
+    const uint32_t nblks = get_arg(argc, argv, 1, 1000);
+    const size_t nreplicas = get_arg(argc, argv, 2, 4);
+    /* one-way delay, extra delay of the slow replica and fast-path timeout,
+     * in ms */
+    const double delay = get_arg(argc, argv, 3, 10);
+    const double slow = get_arg(argc, argv, 4, 2);
+    const double timeout = get_arg(argc, argv, 5, 5);
+
+    /* the replicas miss the slices to decode the commands from, and the
+     * encoder talks about every proposal */
+    fflush(stdout);
+    int out_fd = dup(1), err_fd = dup(2);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 1);
+    dup2(null_fd, 2);
+    Network normal(nreplicas, false, delay, slow, timeout, nblks);
+    normal.run();
+    Network fast(nreplicas, true, delay, slow, timeout, nblks);
+    fast.run();
+    fflush(stdout);
+    dup2(out_fd, 1);
+    dup2(err_fd, 2);
+    close(null_fd);
+    close(out_fd);
+    close(err_fd);
+
+    printf("%u blocks, %lu replicas, delay %.0f ms (+%.0f ms for one), "
+            "fast timeout %.0f ms\n", nblks, nreplicas, delay, slow, timeout);
+    printf("commit latency: normal %.1f ms, fast-commit %.1f ms "
+            "(%lu and %lu blocks committed)\n",
+            normal.latency / normal.ncommitted, fast.latency / fast.ncommitted,
+            normal.ncommitted, fast.ncommitted);
+    /* all but the last three blocks are committed (two with the fast path) */
+    return normal.ncommitted + 3 == nblks && fast.ncommitted + 3 >= nblks ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+#include "hotstuff/lwpromise.hpp"
+#include "hotstuff/promise.hpp"
+#include "bench_util.h"
+
+using mypromise::promise_t;
+
+/* cost (ns/op) of the promise patterns on the vote and delivery paths,
+ * mypromise vs. lwpromise */
+
+/* a vote: the pool resolves the signature check, Vote::verify adds the
+ * object hash check and the handler consumes the result */
+static size_t nvalid = 0;
+
+void vote_mypromise(size_t i) {
+    promise_t pm([](promise_t &){});
+    pm.then([i](bool result) {
+        return result && (i & 1023) != 1023;
+    }).then([](bool valid) {
+        if (valid) nvalid++;
+    });
+    pm.resolve(true);
+}
+
+void vote_lwpromise(size_t i) {
+    lwpromise::promise<bool> pm;
+    pm.then([i](bool result) {
+        return result && (i & 1023) != 1023;
+    }).then([](bool valid) {
+        if (valid) nvalid++;
+    });
+    pm.resolve(true);
+}
+
+/* a block delivery: the QC check joined with the fetch of the QC's block
+ * and the delivery of the parent */
+static size_t ndelivered = 0;
+
+void deliver_mypromise(size_t) {
+    promise_t valid([](promise_t &){});
+    promise_t qc_blk([](promise_t &){});
+    promise_t parent([](promise_t &){});
+    mypromise::all(std::vector<promise_t>{valid, qc_blk, parent}).then(
+        [](const mypromise::values_t &values) {
+            if (mypromise::any_cast<bool>(values[0])) ndelivered++;
+        });
+    qc_blk.resolve(true);
+    parent.resolve(true);
+    valid.resolve(true);
+}
+
+void deliver_lwpromise(size_t) {
+    lwpromise::promise<bool> valid;
+    promise_t qc_blk([](promise_t &){});
+    promise_t parent([](promise_t &){});
+    mypromise::all(std::vector<promise_t>{qc_blk, parent}).then([valid]() {
+        valid.then([](bool valid) {
+            if (valid) ndelivered++;
+        });
+    });
+    qc_blk.resolve(true);
+    parent.resolve(true);
+    valid.resolve(true);
+}
+
+/* the signatures of a QC joined in the pool */
+static size_t nqc = 0;
+
+void qc_mypromise(size_t) {
+    std::vector<promise_t> pms(4, promise_t());
+    for (auto &pm: pms) pm = promise_t([](promise_t &){});
+    mypromise::all(pms).then([](const mypromise::values_t &values) {
+        for (const auto &v: values)
+            if (!mypromise::any_cast<bool>(v)) return false;
+        return true;
+    }).then([](bool valid) { if (valid) nqc++; });
+    for (auto &pm: pms) pm.resolve(true);
+}
+
+void qc_lwpromise(size_t) {
+    std::vector<lwpromise::promise<bool>> pms(4, lwpromise::promise<bool>(nullptr));
+    for (auto &pm: pms) pm = lwpromise::promise<bool>();
+    lwpromise::all_of(pms).then([](bool valid) { if (valid) nqc++; });
+    for (auto &pm: pms) pm.resolve(true);
+}
+
+int main(int argc, char **argv) {
+    size_t nops = get_arg(argc, argv, 1, 1000000);
+    printf("%10s %14s %14s\n", "path", "mypromise", "lwpromise");
+    printf("%10s %11.1fns %11.1fns\n", "vote",
+            measure(nops, vote_mypromise), measure(nops, vote_lwpromise));
+    printf("%10s %11.1fns %11.1fns\n", "delivery",
+            measure(nops, deliver_mypromise), measure(nops, deliver_lwpromise));
+    printf("%10s %11.1fns %11.1fns\n", "qc",
+            measure(nops, qc_mypromise), measure(nops, qc_lwpromise));
+    return !(nvalid && ndelivered && nqc);
+}
@@ -0,0 +1,125 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include "hotstuff/consensus.h"
+#include "bench_util.h"
+
+using namespace hotstuff;
+
+/* cost (ns/blk) of the propose/vote/commit loop of a replica on real
+ * blocks: each block is delivered, its proposal goes through the commit
+ * rule, the pacemaker waits for its QC, the votes are collected into it as
+ * by the next leader, and the committed blocks are then pruned; next to it,
+ * the cost of a copy of a block_t (non-atomic count) vs. a shared_block_t
+ * (atomic count) of the same blocks, and of handing a block to another
+ * thread */
+
+/* a replica with the dummy certificates, which leads every next view and
+ * takes its own vote right away */
+class Replica: public HotStuffCore {
+    std::vector<MerkleProof> proofs;
+    size_t nqc;
+
+    protected:
+    void do_decide(Finality &&) override {}
+    void do_consensus(const block_t &) override {}
+    void do_broadcast_slice(const Slice &) override {}
+    void do_broadcast_proposal(const Proposal &) override {}
+    void do_broadcast_proposal_with_slice(const std::vector<Proposal> &) override {}
+    void do_vote(ReplicaID, const Vote &vote) override { on_receive_vote(vote); }
+    void do_fast_qc_wait(const block_t &) override {}
+
+    public:
+    part_cert_bt create_part_cert(const PrivKey &, const uint256_t &blk_hash) override {
+        return new PartCertDummy(blk_hash);
+    }
+    part_cert_bt parse_part_cert(DataStream &s) override {
+        auto pc = new PartCertDummy();
+        pc->unserialize(s);
+        return pc;
+    }
+    quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertDummy(get_config(), blk_hash);
+    }
+    quorum_cert_bt parse_quorum_cert(DataStream &s) override {
+        auto qc = new QuorumCertDummy();
+        qc->unserialize(s);
+        return qc;
+    }
+
+    Replica(size_t nreplicas): HotStuffCore(1, new PrivKeyDummy()), nqc(0) {
+        for (ReplicaID i = 0; i < nreplicas; i++)
+            add_replica(i, PeerId(), new PubKeyDummy());
+        on_init((nreplicas - 1) / 3);
+        sc.set_pramas(nreplicas);
+        /* every proposal carries the same (valid) slice */
+        proofs = MerkleTree(std::vector<std::vector<uint8_t>>(
+                            nreplicas, std::vector<uint8_t>(64))).proofs();
+    }
+
+    void step(uint32_t retention) {
+        const auto &config = get_config();
+        /* propose: replica 0 extends the block of the highest QC */
+        block_t parent = get_hqc();
+        block_t blk = storage->add_blk(new Block({parent}, {},
+                        new QuorumCertDummy(config, parent->get_hash()),
+                        bytearray_t(), parent->get_height() + 1, parent,
+                        /* the QC the votes go into */
+                        new QuorumCertDummy(config, uint256_t())));
+        on_deliver_blk(blk);
+        async_qc_finish(blk).then([this, blk]() { nqc++; });
+        on_receive_proposal(Proposal(0, Slice(proofs[get_id()],
+                                            blk->get_hash()), blk, this));
+        /* vote: the replica's own vote is in, then come the others */
+        for (ReplicaID i = 0; i < config.nreplicas; i++)
+            if (i != get_id())
+                on_receive_vote(Vote(i, blk->get_hash(),
+                                new PartCertDummy(blk->get_hash()), this));
+        /* the commit rule has run on the proposal, prune what it left */
+        prune(retention);
+    }
+
+    size_t get_nqc() const { return nqc; }
+};
+
+int main(int argc, char **argv) {
+    const size_t nblks = get_arg(argc, argv, 1, 1000000);
+    const size_t nreplicas = get_arg(argc, argv, 2, 4);
+    const uint32_t retention = 64;
+    const size_t nops = 10000000;
+    Replica r(nreplicas);
+
+    /* the replica has none of the slices to decode the commands from, and
+     * warns about it for every block */
+    int err_fd = dup(2);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 2);
+    double t_loop = measure(nblks, [&](size_t) { r.step(retention); });
+    dup2(err_fd, 2);
+    close(null_fd);
+    close(err_fd);
+
+    /* the blocks left in memory, copied into a container and dropped */
+    auto blks = r.get_delivered_blks(0);
+    std::vector<shared_block_t> shared;
+    double t_share = measure(blks.size(), [&](size_t i) {
+        shared.push_back(r.share_blk(blks[i]));
+    });
+    std::vector<block_t> rc_copies;
+    double t_rc = measure(nops, [&](size_t i) {
+        rc_copies.push_back(blks[i % blks.size()]);
+        if (rc_copies.size() == 64) rc_copies.clear();
+    });
+    std::vector<shared_block_t> arc_copies;
+    double t_arc = measure(nops, [&](size_t i) {
+        arc_copies.push_back(shared[i % shared.size()]);
+        if (arc_copies.size() == 64) arc_copies.clear();
+    });
+
+    uint32_t exec_height = r.get_b_exec()->get_height();
+    printf("%lu blocks, %lu replicas: %.1f ns/blk, committed up to %u\n"
+            "handle copy: block_t %.1f ns, shared_block_t %.1f ns\n"
+            "share_blk: %.1f ns\n",
+            nblks, nreplicas, t_loop, exec_height, t_rc, t_arc, t_share);
+    /* every block got its QC, and all but the last three are committed */
+    return r.get_nqc() == nblks && exec_height + 3 == nblks ? 0 : 1;
+}
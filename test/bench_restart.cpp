@@ -0,0 +1,137 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include "hotstuff/hotstuff.h"
+#include "hotstuff/liveness.h"
+#include "bench_util.h"
+
+using namespace hotstuff;
+
+/* time (ms) from start() to the first vote of a replica restarting from a
+ * ledger of nblks committed blocks and a safety log of the last nlogged
+ * blocks delivered (with the state it voted, locked and executed at the
+ * tip, as test_wal sets up), vs. one starting afresh: the replica leads
+ * every view on its own, and proposes once it is given a command */
+
+/* a replica with the dummy certificates, which only executes nothing */
+class Replica: public HotStuffBase {
+    protected:
+    part_cert_bt create_part_cert(const PrivKey &, const uint256_t &blk_hash) override {
+        return new PartCertDummy(blk_hash);
+    }
+    part_cert_bt parse_part_cert(DataStream &s) override {
+        auto pc = new PartCertDummy();
+        pc->unserialize(s);
+        return pc;
+    }
+    quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertDummy(get_config(), blk_hash);
+    }
+    quorum_cert_bt parse_quorum_cert(DataStream &s) override {
+        auto qc = new QuorumCertDummy();
+        qc->unserialize(s);
+        return qc;
+    }
+    void state_machine_execute(const Finality &) override {}
+
+    public:
+    Replica(const NetAddr &addr, const EventContext &ec):
+        HotStuffBase(1, 0, new PrivKeyDummy(), addr,
+                    new PaceMakerDummyFixed(0, 1), ec, 1, Net::Config()) {}
+};
+
+/* the delay to the first vote of a replica started from what is in dir, 0
+ * if it did not vote */
+static double restart(const std::string &dir, bool restored, uint16_t port) {
+    EventContext ec;
+    NetAddr addr("127.0.0.1:" + std::to_string(port));
+    Replica r(addr, ec);
+    if (restored)
+    {
+        r.open_ledger(dir + "/ledger");
+        r.open_safety_log(dir + "/safety.log");
+    }
+    std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> replicas;
+    replicas.push_back(std::make_tuple(addr, new PubKeyDummy(), uint256_t()));
+    r.start(std::move(replicas));
+    r.exec_command(uint256_t(bytearray_t(32, 0xcc)), [](Finality) {});
+    double delay = 0;
+    TimerEvent poll(ec, [&](TimerEvent &t) {
+        if (r.get_first_vote_delay(delay)) ec.stop();
+        else t.add(0.001);
+    });
+    poll.add(0.001);
+    /* give up after a while */
+    TimerEvent limit(ec, [&](TimerEvent &) { ec.stop(); });
+    limit.add(10);
+    ec.dispatch();
+    return delay * 1e3;
+}
+
+int main(int argc, char **argv) {
+    const uint32_t nblks = get_arg(argc, argv, 1, 100000);
+    const uint32_t nlogged = get_arg(argc, argv, 2, 1000);
+    const size_t ncmds = get_arg(argc, argv, 3, 16);
+    char tmpl[] = "/tmp/hotstuff-restart-XXXXXX";
+    if (!mkdtemp(tmpl))
+        throw std::runtime_error("cannot create a temporary directory");
+    const std::string dir = tmpl;
+
+    /* the chain up to the tip, and a block past it for the QC of the tip */
+    ReplicaConfig config;
+    std::vector<block_t> chain{new Block(true, 1)};
+    for (uint32_t h = 1; h <= nblks + 1; h++)
+        chain.push_back(new Block({chain.back()}, {}, new QuorumCertDummy(
+                        config, chain.back()->get_hash()), bytearray_t(), h,
+                        chain.back(), nullptr));
+    const uint32_t exec_height = nblks - 2, lock_height = nblks - 1;
+    {
+        Ledger ledger(dir + "/ledger");
+        std::vector<uint256_t> cmds;
+        for (size_t i = 0; i < ncmds; i++)
+            cmds.push_back(uint256_t(bytearray_t(32, i)));
+        for (uint32_t h = 1; h <= exec_height; h++)
+            ledger.append(chain[h], cmds);
+    }
+    std::vector<SafetyLog::record_t> log;
+    auto ref = [](const block_t &blk) {
+        DataStream s;
+        s << blk->get_hash() << htole(blk->get_height());
+        return s;
+    };
+    for (uint32_t h = nblks > nlogged ? nblks - nlogged + 1 : 1; h <= nblks; h++)
+    {
+        DataStream s;
+        s << htole(h) << *chain[h];
+        log.push_back(std::make_pair(SafetyLog::REC_BLOCK, bytearray_t(std::move(s))));
+    }
+    DataStream hqc = ref(chain[nblks]);
+    hqc << *chain[nblks + 1]->get_qc();
+    log.push_back(std::make_pair(SafetyLog::REC_HQC, bytearray_t(std::move(hqc))));
+    log.push_back(std::make_pair(SafetyLog::REC_VOTE, bytearray_t(ref(chain[nblks]))));
+    log.push_back(std::make_pair(SafetyLog::REC_B_LOCK, bytearray_t(ref(chain[lock_height]))));
+    log.push_back(std::make_pair(SafetyLog::REC_B_EXEC, bytearray_t(ref(chain[exec_height]))));
+    SafetyLog::rewrite(dir + "/safety.log", log);
+
+    /* the encoder and the replica talk about every step */
+    fflush(stdout);
+    int out_fd = dup(1), err_fd = dup(2);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 1);
+    dup2(null_fd, 2);
+    uint16_t port = 20000 + getpid() % 10000;
+    double t_fresh = restart(dir, false, port);
+    double t_restored = restart(dir, true, port + 1);
+    fflush(stdout);
+    dup2(out_fd, 1);
+    dup2(err_fd, 2);
+    close(null_fd);
+    close(out_fd);
+    close(err_fd);
+
+    printf("%u blocks in the ledger (%lu commands each), %u in the log\n"
+            "start to first vote: fresh %.3f ms, restored %.3f ms\n",
+            nblks, ncmds, nlogged, t_fresh, t_restored);
+    system(("rm -rf " + dir).c_str());
+    return t_fresh > 0 && t_restored > 0 ? 0 : 1;
+}
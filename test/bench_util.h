@@ -0,0 +1,25 @@
+#ifndef _HOTSTUFF_BENCH_UTIL_H
+#define _HOTSTUFF_BENCH_UTIL_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+/* helpers shared by the micro-benchmarks */
+
+/* average cost (ns) of op(i) over i = 0..nops - 1 */
+template<typename Func>
+double measure(size_t nops, Func op) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < nops; i++) op(i);
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / nops;
+}
+
+/* the i-th command line argument as a number, or def if not given */
+static inline size_t get_arg(int argc, char **argv, int i, size_t def) {
+    return argc > i ? strtoul(argv[i], nullptr, 10) : def;
+}
+
+#endif
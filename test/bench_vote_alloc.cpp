@@ -0,0 +1,151 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include "hotstuff/hotstuff.h"
+#include "bench_util.h"
+
+using namespace hotstuff;
+
+/* heap allocations on the vote path of a leader, with secp256k1: each vote
+ * is parsed from its message, checked by the verification pool and taken
+ * into the QC of its block, as HotStuffBase does with a vote for a
+ * delivered block. The proposals and the votes (signed by the other
+ * replicas) are made outside of the count, and the vote completing a QC
+ * (which makes the new highest QC) is counted apart. */
+
+static std::atomic<size_t> nallocs(0);
+
+void *operator new(size_t size) {
+    nallocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+/* a leader with the secp256k1 certificates, which takes its own vote right
+ * away */
+class Replica: public HotStuffCore {
+    protected:
+    void do_decide(Finality &&) override {}
+    void do_consensus(const block_t &) override {}
+    void do_broadcast_slice(const Slice &) override {}
+    void do_broadcast_proposal(const Proposal &) override {}
+    void do_broadcast_proposal_with_slice(const std::vector<Proposal> &) override {}
+    void do_vote(ReplicaID, const Vote &vote) override { on_receive_vote(vote); }
+    void do_fast_qc_wait(const block_t &) override {}
+
+    public:
+    part_cert_bt create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) override {
+        return new PartCertSecp256k1(
+            static_cast<const PrivKeySecp256k1 &>(priv_key), blk_hash);
+    }
+    part_cert_bt parse_part_cert(DataStream &s) override {
+        auto pc = new PartCertSecp256k1();
+        pc->unserialize(s);
+        return pc;
+    }
+    quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertSecp256k1(get_config(), blk_hash);
+    }
+    quorum_cert_bt parse_quorum_cert(DataStream &s) override {
+        auto qc = new QuorumCertSecp256k1();
+        qc->unserialize(s);
+        return qc;
+    }
+
+    Replica(const std::vector<BoxObj<PrivKeySecp256k1>> &privs):
+            HotStuffCore(0, new PrivKeySecp256k1(privs[0]->to_bytes())) {
+        for (ReplicaID i = 0; i < privs.size(); i++)
+            add_replica(i, PeerId(), privs[i]->get_pubkey());
+        on_init((privs.size() - 1) / 3);
+        rse.set_params(privs.size());
+        sc.set_pramas(privs.size());
+    }
+};
+
+int main(int argc, char **argv) {
+    const size_t nblks = get_arg(argc, argv, 1, 10000);
+    const size_t nreplicas = get_arg(argc, argv, 2, 4);
+    const size_t nworkers = get_arg(argc, argv, 3, 2);
+    /* the first blocks fill up the free lists */
+    const size_t warmup = 64;
+    const uint32_t retention = 64;
+
+    std::vector<BoxObj<PrivKeySecp256k1>> privs;
+    for (size_t i = 0; i < nreplicas; i++)
+    {
+        privs.push_back(new PrivKeySecp256k1());
+        privs.back()->from_rand();
+    }
+    Replica r(privs);
+    EventContext ec;
+    VeriPool vpool(ec, nworkers);
+    size_t nvotes = 0, vote_allocs = 0, qc_allocs = 0;
+
+    /* the encoder talks about every proposal, and the leader has none of
+     * the slices to decode the commands from */
+    fflush(stdout);
+    int out_fd = dup(1), err_fd = dup(2);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, 1);
+    dup2(null_fd, 2);
+    for (size_t i = 0; i < nblks; i++)
+    {
+        block_t blk = r.on_propose({uint256_t(bytearray_t(32, i))},
+                                    {r.get_hqc()});
+        const uint256_t &blk_hash = blk->get_hash();
+        std::vector<DataStream> msgs;
+        for (ReplicaID j = 1; j < nreplicas; j++)
+        {
+            MsgVote msg(Vote(j, blk_hash,
+                new PartCertSecp256k1(*privs[j], blk_hash), &r));
+            msgs.push_back(std::move(msg.serialized));
+        }
+        veri_token_t token(new std::atomic<bool>(false));
+        bool counted = i >= warmup;
+        size_t nleft = msgs.size();
+        size_t start = nallocs.load();
+        size_t in_qc = 0;
+        for (auto &s: msgs)
+        {
+            MsgVote msg(std::move(s));
+            msg.postponed_parse(&r);
+            BoxObj<Vote> v(new Vote(std::move(msg.vote)));
+            v->verify(vpool, token).then([&, v=std::move(v)](bool valid) {
+                bool finishing = r.get_hqc() != blk;
+                size_t before = nallocs.load();
+                if (valid) r.on_receive_vote(*v);
+                if (finishing && r.get_hqc() == blk)
+                    in_qc += nallocs.load() - before;
+                if (!--nleft) ec.stop();
+            });
+        }
+        if (nleft) ec.dispatch();
+        if (counted)
+        {
+            nvotes += msgs.size();
+            vote_allocs += nallocs.load() - start - in_qc;
+            qc_allocs += in_qc;
+        }
+        r.prune(retention);
+    }
+    fflush(stdout);
+    dup2(out_fd, 1);
+    dup2(err_fd, 2);
+    close(null_fd);
+    close(out_fd);
+    close(err_fd);
+
+    size_t ncounted = nblks > warmup ? nblks - warmup : 0;
+    printf("%lu blocks, %lu replicas, %lu workers\n"
+            "votes: %.3f allocs/vote (%lu in %lu votes)\n"
+            "QC completion: %.1f allocs/blk\n",
+            nblks, nreplicas, nworkers,
+            nvotes ? (double)vote_allocs / nvotes : 0, vote_allocs, nvotes,
+            ncounted ? (double)qc_allocs / ncounted : 0);
+    /* votes that only go into a QC take nothing from the heap */
+    return vote_allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#include <cstdlib>
+#include "hotstuff/entity.h"
+#include "hotstuff/ledger.h"
+
+using namespace hotstuff;
+
+/* store a chain of blocks across several segments, reopen the ledger and
+ * check every block and command list comes back, then damage the last
+ * record and check it is dropped on the next open; finally drop the lower
+ * half of the chain along with a checkpoint */
+
+static bytearray_t to_bytes(const Block &blk) {
+    DataStream s;
+    s << blk;
+    return bytearray_t(std::move(s));
+}
+
+int main(int argc, char **argv) {
+    const uint32_t nblks = argc > 1 ? atoi(argv[1]) : 1000;
+    /* small segments, so that the chain spans many of them */
+    const size_t seg_size = 4096;
+    char tmpl[] = "/tmp/hotstuff-ledger-XXXXXX";
+    if (!mkdtemp(tmpl))
+        throw std::runtime_error("cannot create a temporary directory");
+    const std::string dir = tmpl;
+    ReplicaConfig config;
+
+    std::vector<block_t> chain{new Block(true, 1)};
+    std::vector<std::vector<uint256_t>> cmds{{}};
+    for (uint32_t h = 1; h <= nblks; h++)
+    {
+        std::vector<uint256_t> c;
+        for (uint32_t i = 0; i < h % 5; i++)
+        {
+            DataStream s;
+            s << h << i;
+            c.push_back(s.get_hash());
+        }
+        chain.push_back(new Block({chain.back()}, {}, new QuorumCertDummy(
+                        config, chain.back()->get_hash()), bytearray_t(), h,
+                        chain.back(), nullptr));
+        cmds.push_back(std::move(c));
+    }
+
+    size_t nerrors = 0;
+    Ledger::blob_t blob;
+    auto check = [&](const Ledger &ledger, uint32_t base, uint32_t end) {
+        if (ledger.get_base_height() != base || ledger.get_end_height() != end)
+        {
+            printf("heights: [%u, %u)\n", ledger.get_base_height(), ledger.get_end_height());
+            nerrors++;
+            return;
+        }
+        uint32_t height;
+        if (base > 1 && (ledger.find_height(chain[base - 1]->get_hash(), height) ||
+                        ledger.get_blk(base - 1, blob)))
+            nerrors++;
+        for (uint32_t h = base; h < end; h++)
+        {
+            if (!ledger.get_blk(h, blob) ||
+                bytearray_t(blob.data, blob.data + blob.size) != to_bytes(*chain[h]) ||
+                ledger.get_blk_hash(h) != chain[h]->get_hash() ||
+                !ledger.find_height(chain[h]->get_hash(), height) || height != h ||
+                ledger.get_cmds(h) != cmds[h])
+                nerrors++;
+        }
+    };
+
+    {
+        Ledger ledger(dir, seg_size);
+        for (uint32_t h = 1; h <= nblks; h++)
+            ledger.append(chain[h], cmds[h]);
+        /* heights already stored are skipped */
+        ledger.append(chain[1], cmds[1]);
+        check(ledger, 1, nblks + 1);
+    }
+    {
+        Ledger ledger(dir, seg_size);
+        check(ledger, 1, nblks + 1);
+    }
+
+    /* flip a byte of the last record */
+    {
+        Ledger ledger(dir, seg_size);
+        ledger.get_blk(nblks, blob);
+        const_cast<uint8_t *>(blob.data)[0] ^= 0xff;
+    }
+    {
+        Ledger ledger(dir, seg_size);
+        check(ledger, 1, nblks);
+    }
+
+    const uint32_t ckpt_height = nblks / 2;
+    const bytearray_t ckpt{1, 2, 3, 4};
+    {
+        Ledger ledger(dir, seg_size);
+        ledger.truncate(ckpt_height);
+        ledger.put_checkpoint(ckpt);
+        check(ledger, ckpt_height, nblks);
+        ledger.append(chain[nblks], cmds[nblks]);
+        check(ledger, ckpt_height, nblks + 1);
+    }
+    {
+        Ledger ledger(dir, seg_size);
+        bytearray_t data;
+        check(ledger, ckpt_height, nblks + 1);
+        if (!ledger.get_checkpoint(data) || data != ckpt)
+            nerrors++;
+        /* nothing left: the chain may go on from any height */
+        ledger.truncate(nblks + 10);
+        if (ledger.get_size() || ledger.get_base_height() != nblks + 10)
+            nerrors++;
+        ledger.append(chain[ckpt_height], cmds[ckpt_height]);
+        check(ledger, ckpt_height, ckpt_height + 1);
+    }
+
+    printf("%u blocks: %lu errors\n", nblks, nerrors);
+    system(("rm -rf " + dir).c_str());
+    return nerrors ? 1 : 0;
+}
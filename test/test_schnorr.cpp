@@ -0,0 +1,198 @@
+#include "hotstuff/crypto.h"
+
+using namespace hotstuff;
+
+/* the BIP340 test vectors (those on 32-byte messages), then batches of
+ * signatures on one message: a valid batch, and batches each spoilt by a
+ * single bad signature */
+
+struct TestVector {
+    const char *seckey;
+    const char *pubkey;
+    const char *aux_rand;
+    const char *msg;
+    const char *sig;
+    bool valid;
+    const char *comment;
+};
+
+static const TestVector vectors[] = {
+    {"0000000000000000000000000000000000000000000000000000000000000003",
+     "F9308A019258C31049344F85F89D5229B531C845836F99B08601F113BCE036F9",
+     "0000000000000000000000000000000000000000000000000000000000000000",
+     "0000000000000000000000000000000000000000000000000000000000000000",
+     "E907831F80848D1069A5371B402410364BDF1C5F8307B0084C55F1CE2DCA8215"
+     "25F66A4A85EA8B71E482A74F382D2CE5EBEEE8FDB2172F477DF4900D310536C0",
+     true, "0"},
+    {"B7E151628AED2A6ABF7158809CF4F3C762E7160F38B4DA56A784D9045190CFEF",
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     "0000000000000000000000000000000000000000000000000000000000000001",
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "6896BD60EEAE296DB48A229FF71DFE071BDE413E6D43F917DC8DCF8C78DE3341"
+     "8906D11AC976ABCCB20B091292BFF4EA897EFCB639EA871CFA95F6DE339E4B0A",
+     true, "1"},
+    {"C90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74020BBEA63B14E5C9",
+     "DD308AFEC5777E13121FA72B9CC1B7CC0139715309B086C960E18FD969774EB8",
+     "C87AA53824B4D7AE2EB035A2B5BBBCCC080E76CDC6D1692C4B0B62D798E6D906",
+     "7E2D58D8B3BCDF1ABADEC7829054F90DDA9805AAB56C77333024B9D0A508B75C",
+     "5831AAEED7B44BB74E5EAB94BA9D4294C49BCF2A60728D8B4C200F50DD313C1B"
+     "AB745879A5AD954A72C45A91C3A51D3C7ADEA98D82F8481E0E1E03674A6F3FB7",
+     true, "2"},
+    {"0B432B2677937381AEF05BB02A66ECD012773062CF3FA2549E44F58ED2401710",
+     "25D1DFF95105F5253C4022F628A996AD3A0D95FBF21D468A1B33F8C160D8F517",
+     "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF",
+     "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF",
+     "7EB0509757E246F19449885651611CB965ECC1A187DD51B64FDA1EDC9637D5EC"
+     "97582B9CB13DB3933705B32BA982AF5AF25FD78881EBB32771FC5922EFC66EA3",
+     true, "3: test fails if msg is reduced modulo p or n"},
+    {nullptr,
+     "D69C3509BB99E412E68B0FE8544E72837DFA30746D8BE2AA65975F29D22DC7B9",
+     nullptr,
+     "4DF3C3F68FCC83B27E9D42C90431A72499F17875C81A599B566C9889B9696703",
+     "00000000000000000000003B78CE563F89A0ED9414F5AA28AD0D96D6795F9C63"
+     "76AFB1548AF603B3EB45C9F8207DEE1060CB71C04E80F593060B07D28308D7F4",
+     true, "4"},
+    {nullptr,
+     "EEFDEA4CDB677750A420FEE807EACF21EB9898AE79B9768766E4FAA04A2D4A34",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "6CFF5C3BA86C69EA4B7376F31A9BCB4F74C1976089B2D9963DA2E5543E177769"
+     "69E89B4C5564D00349106B8497785DD7D1D713A8AE82B32FA79D5F7FC407D39B",
+     false, "5: public key not on the curve"},
+    {nullptr,
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "FFF97BD5755EEEA420453A14355235D382F6472F8568A18B2F057A1460297556"
+     "3CC27944640AC607CD107AE10923D9EF7A73C643E166BE5EBEAFA34B1AC553E2",
+     false, "6: has_even_y(R) is false"},
+    {nullptr,
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "1FA62E331EDBC21C394792D2AB1100A7B432B013DF3F6FF4F99FCB33E0E1515F"
+     "28890B3EDB6E7189B630448B515CE4F8622A954CFE545735AAEA5134FCCDB2BD",
+     false, "7: negated message"},
+    {nullptr,
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "6CFF5C3BA86C69EA4B7376F31A9BCB4F74C1976089B2D9963DA2E5543E177769"
+     "961764B3AA9B2FFCB6EF947B6887A226E8D7C93E00C5ED0C1834FF0D0C2E6DA6",
+     false, "8: negated s value"},
+    {nullptr,
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "0000000000000000000000000000000000000000000000000000000000000000"
+     "123DDA8328AF9C23A94C1FEECFD123BA4FB73476F0D594DCB65C6425BD186051",
+     false, "9: sG - eP is infinite, x(inf) taken as 0"},
+    {nullptr,
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "0000000000000000000000000000000000000000000000000000000000000001"
+     "7615FBAF5AE28864013C099742DEADB4DBA87F11AC6754F93780D5A1837CF197",
+     false, "10: sG - eP is infinite, x(inf) taken as 1"},
+    {nullptr,
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "4A298DACAE57395A15D0795DDBFD1DCB564DA82B0F269BC70A74F8220429BA1D"
+     "69E89B4C5564D00349106B8497785DD7D1D713A8AE82B32FA79D5F7FC407D39B",
+     false, "11: sig[0:32] is not an x coordinate on the curve"},
+    {nullptr,
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEFFFFFC2F"
+     "69E89B4C5564D00349106B8497785DD7D1D713A8AE82B32FA79D5F7FC407D39B",
+     false, "12: sig[0:32] is equal to the field size"},
+    {nullptr,
+     "DFF1D77F2A671C5F36183726DB2341BE58FEAE1DA2DECED843240F7B502BA659",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "6CFF5C3BA86C69EA4B7376F31A9BCB4F74C1976089B2D9963DA2E5543E177769"
+     "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEBAAEDCE6AF48A03BBFD25E8CD0364141",
+     false, "13: sig[32:64] is equal to the curve order"},
+    {nullptr,
+     "FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEFFFFFC30",
+     nullptr,
+     "243F6A8885A308D313198A2E03707344A4093822299F31D0082EFA98EC4E6C89",
+     "6CFF5C3BA86C69EA4B7376F31A9BCB4F74C1976089B2D9963DA2E5543E177769"
+     "69E89B4C5564D00349106B8497785DD7D1D713A8AE82B32FA79D5F7FC407D39B",
+     false, "14: public key is not a valid x coordinate (exceeds the field size)"},
+};
+
+int main(int argc, char **argv) {
+    const size_t nsigs = argc > 1 ? atoi(argv[1]) : 16;
+    size_t nerrors = 0;
+    auto expect = [&](bool ok, const char *what, const char *comment) {
+        if (ok) return;
+        printf("failed: %s (%s)\n", what, comment);
+        nerrors++;
+    };
+
+    for (const auto &v: vectors)
+    {
+        bytearray_t msg = from_hex(v.msg);
+        bytearray_t sig = from_hex(v.sig);
+        bool valid;
+        try {
+            PubKeySchnorr pub_key(from_hex(v.pubkey));
+            valid = SigSchnorr(sig.data()).verify(msg, pub_key);
+        } catch (std::invalid_argument &) {
+            /* the public key cannot be parsed */
+            valid = false;
+        }
+        expect(valid == v.valid, "verify", v.comment);
+        if (!v.seckey) continue;
+        PrivKeySchnorr priv_key(from_hex(v.seckey));
+        expect(PubKeySchnorr(priv_key).to_bytes() == from_hex(v.pubkey),
+                "public key", v.comment);
+        SigSchnorr mysig;
+        mysig.sign(msg, priv_key, from_hex(v.aux_rand).data());
+        expect(mysig.to_bytes() == sig, "sign", v.comment);
+    }
+
+    /* a batch of signatures on msg, packed as a QC carries them */
+    bytearray_t msg(32);
+    msg[0] = 1;
+    bytearray_t other_msg(32);
+    std::vector<PubKeySchnorr> pub_keys;
+    std::vector<PrivKeySchnorr> priv_keys(nsigs);
+    bytearray_t sigs;
+    for (auto &priv_key: priv_keys)
+    {
+        priv_key.from_rand();
+        pub_keys.push_back(PubKeySchnorr(priv_key));
+        auto sig = SigSchnorr(uint256_t(msg), priv_key).to_bytes();
+        sigs.insert(sigs.end(), sig.begin(), sig.end());
+    }
+    std::vector<const PubKeySchnorr *> pks;
+    for (const auto &pk: pub_keys) pks.push_back(&pk);
+    expect(SigSchnorr::verify_batch(msg, pks, sigs.data()), "batch", "valid");
+    expect(!SigSchnorr::verify_batch(other_msg, pks, sigs.data()),
+            "batch", "another message");
+    /* each of the following spoils the signature at i only */
+    for (size_t i = 0; i < nsigs; i += std::max<size_t>(nsigs / 4, 1))
+    {
+        auto bad = sigs;
+        bad[i * SigSchnorr::nbytes + 63] ^= 1;
+        expect(!SigSchnorr::verify_batch(msg, pks, bad.data()),
+                "batch", "one s value changed");
+        bad = sigs;
+        auto other = SigSchnorr(uint256_t(other_msg), priv_keys[i]).to_bytes();
+        std::copy(other.begin(), other.end(), bad.begin() + i * SigSchnorr::nbytes);
+        expect(!SigSchnorr::verify_batch(msg, pks, bad.data()),
+                "batch", "one signature on another message");
+        auto swapped = pks;
+        std::swap(swapped[i], swapped[(i + 1) % nsigs]);
+        expect(nsigs < 2 || !SigSchnorr::verify_batch(msg, swapped, sigs.data()),
+                "batch", "two signers swapped");
+    }
+
+    printf("%lu vectors, %lu signatures: %lu errors\n",
+            sizeof vectors / sizeof vectors[0], nsigs, nerrors);
+    return nerrors ? 1 : 0;
+}
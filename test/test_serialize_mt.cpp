@@ -0,0 +1,78 @@
+#include <atomic>
+#include <thread>
+#include "hotstuff/entity.h"
+#include "hotstuff/crypto.h"
+
+using namespace hotstuff;
+
+/* serialize keys, signatures and certificates from many threads at once and
+ * check every thread gets the same bytes as the single-threaded reference */
+
+static bytearray_t to_bytes(const Serializable &obj) {
+    DataStream s;
+    s << obj;
+    return bytearray_t(std::move(s));
+}
+
+int main(int argc, char **argv) {
+    const size_t nthreads = argc > 1 ? atoi(argv[1]) : 8;
+    const size_t nrounds = argc > 2 ? atoi(argv[2]) : 2000;
+    const size_t nreplicas = 4;
+
+    ReplicaConfig config;
+    std::vector<PrivKeySecp256k1> priv_keys(nreplicas);
+    for (size_t i = 0; i < nreplicas; i++)
+    {
+        priv_keys[i].from_rand();
+        config.add_replica(i,
+            ReplicaInfo(i, salticidae::PeerId(salticidae::NetAddr("127.0.0.1", 10000 + i)),
+                        priv_keys[i].get_pubkey()));
+    }
+    config.nmajority = nreplicas - (nreplicas - 1) / 3;
+
+    bytearray_t rand(32);
+    if (!RAND_bytes(&rand[0], rand.size()))
+        throw std::runtime_error("cannot get rand bytes from openssl");
+    uint256_t obj_hash(rand);
+
+    PubKeySecp256k1 pub(priv_keys[0]);
+    SigSecp256k1 sig(obj_hash, priv_keys[0]);
+    PartCertSecp256k1 _pc(priv_keys[0], obj_hash);
+    const PartCert &pc = _pc;
+    QuorumCertSecp256k1 qc(config, obj_hash);
+    for (size_t i = 0; i < config.nmajority; i++)
+        qc.add_part(i, PartCertSecp256k1(priv_keys[i], obj_hash));
+
+    const bytearray_t pub_ref = to_bytes(pub);
+    const bytearray_t sig_ref = to_bytes(sig);
+    const bytearray_t pc_ref = to_bytes(pc);
+    const bytearray_t qc_ref = to_bytes(qc);
+
+    std::atomic<size_t> nerrors(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nthreads; t++)
+        threads.emplace_back([&]() {
+            for (size_t i = 0; i < nrounds; i++)
+            {
+                /* signing is deterministic, so a fresh signature made with
+                 * the thread's own context must serialize identically */
+                SigSecp256k1 sig2(obj_hash, priv_keys[0], secp256k1_thread_sign_ctx());
+                if (to_bytes(pub) != pub_ref ||
+                    to_bytes(sig) != sig_ref ||
+                    to_bytes(sig2) != sig_ref ||
+                    to_bytes(pc) != pc_ref ||
+                    to_bytes(qc) != qc_ref)
+                    nerrors++;
+                DataStream s(sig_ref);
+                SigSecp256k1 sig3(secp256k1_thread_verify_ctx());
+                s >> sig3;
+                if (!sig3.verify(obj_hash, pub, secp256k1_thread_verify_ctx()))
+                    nerrors++;
+            }
+        });
+    for (auto &t: threads) t.join();
+
+    printf("%lu threads x %lu rounds: %lu errors\n",
+            nthreads, nrounds, nerrors.load());
+    return nerrors ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+#include "hotstuff/hotstuff.h"
+#include "hotstuff/liveness.h"
+
+using namespace hotstuff;
+
+/* write a safety log and read it back, with records larger than the read
+ * buffer; cut its last record short, then damage it, and check it is cut
+ * off each time; replace the log; compact a live log between appends;
+ * finally restart a replica from a log and check where it resumes */
+
+static std::vector<SafetyLog::record_t> make_records(size_t n, uint8_t seed) {
+    std::vector<SafetyLog::record_t> records;
+    for (size_t i = 0; i < n; i++)
+    {
+        /* every so often a record spanning several reads */
+        size_t size = i % 7 == 3 ? 100000 + i : i * 13 % 300;
+        bytearray_t payload(size);
+        for (size_t j = 0; j < size; j++)
+            payload[j] = seed + i + j * 7;
+        records.push_back(std::make_pair(
+            (SafetyLog::RecordType)(i % 5), std::move(payload)));
+    }
+    return records;
+}
+
+static std::vector<SafetyLog::record_t> read_all(const std::string &path) {
+    std::vector<SafetyLog::record_t> records;
+    SafetyLog::replay(path, [&](SafetyLog::RecordType type, DataStream &s) {
+        records.push_back(std::make_pair(type, bytearray_t(s.data(), s.data() + s.size())));
+    });
+    return records;
+}
+
+static size_t file_size(const std::string &path) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    return f ? (size_t)f.tellg() : 0;
+}
+
+/* a replica with the dummy certificates, which only executes nothing */
+class Replica: public HotStuffBase {
+    protected:
+    part_cert_bt create_part_cert(const PrivKey &, const uint256_t &blk_hash) override {
+        return new PartCertDummy(blk_hash);
+    }
+    part_cert_bt parse_part_cert(DataStream &s) override {
+        auto pc = new PartCertDummy();
+        pc->unserialize(s);
+        return pc;
+    }
+    quorum_cert_bt create_quorum_cert(const uint256_t &blk_hash) override {
+        return new QuorumCertDummy(get_config(), blk_hash);
+    }
+    quorum_cert_bt parse_quorum_cert(DataStream &s) override {
+        auto qc = new QuorumCertDummy();
+        qc->unserialize(s);
+        return qc;
+    }
+    void state_machine_execute(const Finality &) override {}
+
+    public:
+    Replica(const NetAddr &addr, const EventContext &ec):
+        HotStuffBase(1, 0, new PrivKeyDummy(), addr,
+                    new PaceMakerDummyFixed(0, 1), ec, 1, Net::Config()) {}
+};
+
+int main(int argc, char **argv) {
+    const size_t nrecords = argc > 1 ? atoi(argv[1]) : 100;
+    char tmpl[] = "/tmp/hotstuff-wal-XXXXXX";
+    if (!mkdtemp(tmpl))
+        throw std::runtime_error("cannot create a temporary directory");
+    const std::string dir = tmpl;
+    const std::string path = dir + "/safety.log";
+    size_t nerrors = 0;
+    auto expect = [&](bool ok, const char *what) {
+        if (ok) return;
+        printf("failed: %s\n", what);
+        nerrors++;
+    };
+
+    auto records = make_records(nrecords, 0);
+    SafetyLog::rewrite(path, records);
+    expect(read_all(path) == records, "replay");
+    expect(access((path + ".tmp").c_str(), F_OK) < 0, "no temporary file left");
+    const size_t full_size = file_size(path);
+    const size_t last_size = 9 + records.back().second.size();
+
+    /* a torn write: the last record is cut short */
+    truncate(path.c_str(), full_size - 3);
+    auto prefix = records;
+    prefix.pop_back();
+    expect(read_all(path) == prefix, "torn tail dropped");
+    expect(file_size(path) == full_size - last_size, "torn tail cut off");
+
+    /* a checksum mismatch in the (new) last record */
+    {
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(full_size - last_size - 1);
+        f.put(0x5a);
+    }
+    auto damaged = read_all(path);
+    expect(damaged.size() == nrecords - 2 &&
+        std::equal(damaged.begin(), damaged.end(), records.begin()),
+        "damaged record dropped");
+    expect(read_all(path) == damaged, "damaged record cut off");
+
+    /* an atomic replace by a shorter log */
+    auto replaced = make_records(nrecords / 2, 1);
+    SafetyLog::rewrite(path, replaced);
+    expect(read_all(path) == replaced, "replaced");
+
+    /* compaction of a live log: what comes after it follows the new
+     * records, and nothing from before is left */
+    {
+        EventContext ec;
+        auto before = make_records(nrecords, 2);
+        auto snapshot = make_records(3, 3);
+        auto after = make_records(5, 4);
+        {
+            SafetyLog log(ec, path);
+            for (const auto &r: before) log.append(r.first, r.second);
+            log.after_flush([&]() {
+                log.compact(snapshot);
+                expect(log.get_size() == log.get_base_size(), "compacted size");
+                for (const auto &r: after) log.append(r.first, r.second);
+                log.after_flush([&]() { ec.stop(); });
+            });
+            ec.dispatch();
+        }
+        auto expected = snapshot;
+        expected.insert(expected.end(), after.begin(), after.end());
+        expect(read_all(path) == expected, "compacted");
+    }
+
+    /* a replica resumes from the blocks and the state in the log */
+    {
+        const uint32_t nblks = 20, exec_height = 15, lock_height = 17;
+        ReplicaConfig config;
+        std::vector<block_t> chain{new Block(true, 1)};
+        for (uint32_t h = 1; h <= nblks; h++)
+            chain.push_back(new Block({chain.back()}, {}, new QuorumCertDummy(
+                            config, chain.back()->get_hash()), bytearray_t(), h,
+                            chain.back(), nullptr));
+        std::vector<SafetyLog::record_t> log;
+        auto ref = [](const block_t &blk) {
+            DataStream s;
+            s << blk->get_hash() << htole(blk->get_height());
+            return bytearray_t(std::move(s));
+        };
+        for (uint32_t h = 1; h <= nblks; h++)
+        {
+            DataStream s;
+            s << htole(h) << *chain[h];
+            log.push_back(std::make_pair(SafetyLog::REC_BLOCK, bytearray_t(std::move(s))));
+        }
+        log.push_back(std::make_pair(SafetyLog::REC_VOTE, ref(chain[nblks])));
+        log.push_back(std::make_pair(SafetyLog::REC_B_LOCK, ref(chain[lock_height])));
+        log.push_back(std::make_pair(SafetyLog::REC_B_EXEC, ref(chain[exec_height])));
+        SafetyLog::rewrite(path, log);
+        /* and a torn record behind them */
+        {
+            std::ofstream f(path, std::ios::binary | std::ios::app);
+            f.write("\x40\0\0\0\1\2", 6);
+        }
+
+        EventContext ec;
+        NetAddr addr("127.0.0.1:" + std::to_string(20000 + getpid() % 10000));
+        Replica r(addr, ec);
+        r.open_safety_log(path);
+        std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> replicas;
+        replicas.push_back(std::make_tuple(addr, new PubKeyDummy(), uint256_t()));
+        r.start(std::move(replicas));
+        expect(r.get_b_exec()->get_hash() == chain[exec_height]->get_hash(), "b_exec restored");
+        expect(r.get_b_lock()->get_hash() == chain[lock_height]->get_hash(), "b_lock restored");
+        /* without a ledger, the chain resumes from b_exec */
+        for (uint32_t h = exec_height; h <= nblks; h++)
+            expect(r.find_delivered_blk(chain[h]->get_hash()) != nullptr, "block restored");
+        /* the log now only holds what is needed to resume again */
+        size_t nblk_records = 0;
+        SafetyLog::replay(path, [&](SafetyLog::RecordType type, DataStream &) {
+            nblk_records += type == SafetyLog::REC_BLOCK;
+        });
+        expect(nblk_records == nblks - exec_height + 1, "log rewritten");
+    }
+
+    printf("%lu records: %lu errors\n", nrecords, nerrors);
+    system(("rm -rf " + dir).c_str());
+    return nerrors ? 1 : 0;
+}